@@ -11,7 +11,7 @@ public:
     sem() {
         if ( sem_init( &m_sem, 0, 0 ) != 0 ) {
             /* 构造函数没有返回值，可以通过抛出异常来报告错误 */
-            throw std::exception(" sem_init " );
+            throw std::exception();
         }
     }
     /* 销毁信号量 */
@@ -39,7 +39,7 @@ public:
     locker() {
         if ( pthread_mutex_init( &m_mutex, NULL ) != 0 ) {
             /* 构造函数没有返回值，可以通过抛出异常来报告错误 */
-            throw std::exception(" locker_init " );
+            throw std::exception();
         }
     }
     /* 销毁信号量 */
@@ -65,10 +65,10 @@ class cond {
 public:
     cond() {
         if ( pthread_cond_init( &m_cond, NULL ) != 0 ) {
-            throw std::exception( "cond_init" );
+            throw std::exception();
         }
         if ( pthread_mutex_init( &m_mutex, NULL ) != 0 ) {
-            throw std::exception( "mutex_init" );
+            throw std::exception();
         }
     }
     ~cond() {
@@ -1,123 +1,761 @@
 #ifndef THREADPOLL_H
 #define THREADPOLL_H
 
-#include <list>
 #include <cstdio>
+#include <cerrno>
 #include <exception>
 #include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include <vector>
 
-#include "14-2_locker.h"
+#include "scheduler.h"
+#include "latency_histogram.h"
+#include "placement.h"
 
+/* 自旋等待时提示 CPU 降低功耗，并让出超线程的执行资源 */
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do {} while ( 0 )
+#endif
 
-/* 线程池类，将它定义为模板类是为了代码复用。模板参数 T 是任务类 */
-template< typename T>
+
+/* 线程池指标的一次快照，由 threadpoll::snapshot 填写。计数从线程池创建时开始累计 */
+struct threadpoll_snapshot
+{
+    /* 每个工作线程自己的计数 */
+    struct worker
+    {
+        int id;
+        bool active;            // 这个 slot 上现在有工作线程
+        unsigned long tasks;    // 取出的任务数，包括过期的
+        unsigned long sleeps;   // 在 futex 上睡眠的次数
+        unsigned long expired;  // 取出时已经过了期限、没有执行 process() 的任务数
+        latency_snapshot wait;
+        latency_snapshot service;
+    };
+
+    int workers;                    // 当前的工作线程数
+    int depth;                      // 队列中等待处理的任务数
+    int running;                    // 正在执行 process() 的线程数
+    unsigned long rejected_full;    // 队列已满（达到 max_requests）而被拒绝的任务数
+    unsigned long rejected_closing; // 关闭过程中被拒绝的任务数
+    unsigned long expired;          // 过期而没有执行的任务数
+    latency_snapshot wait;          // 所有线程合并的排队时间，从入队到被工作线程取出
+    latency_snapshot service;       // 所有线程合并的 process() 运行时间
+    std::vector< worker > per_worker;
+
+    void print( FILE* out ) const
+    {
+        fprintf( out, "threadpoll: depth %d running %d, rejected %lu (full %lu, closing %lu), expired %lu\n", depth,
+            running, rejected_full + rejected_closing, rejected_full, rejected_closing, expired );
+        wait.print( out, "threadpoll queue wait (sampled)" );
+        service.print( out, "threadpoll service (sampled)" );
+        for ( size_t i = 0; i < per_worker.size(); ++i )
+        {
+            const worker& w = per_worker[i];
+            fprintf( out, "worker %d%s: tasks %lu expired %lu sleeps %lu, wait p99 %.1f us, service p50 %.1f p99 %.1f us\n",
+                w.id, w.active ? "" : " (retired)", w.tasks, w.expired, w.sleeps, w.wait.percentile( 99 ) / 1000.0,
+                w.service.percentile( 50 ) / 1000.0, w.service.percentile( 99 ) / 1000.0 );
+        }
+    }
+};
+
+
+/* 线程池类，将它定义为模板类是为了代码复用。模板参数 T 是任务类，S 是任务的调度策略（见 scheduler.h）：
+默认的 shared_queue 让所有线程共享一个无锁环形队列，work_stealing 给每个线程一个双端队列并允许互相窃取，
+priority_lanes 按任务的优先级分通道、按权重轮流出队。
+入队和出队都不加锁、不分配内存。取不到任务的工作线程先自旋一会儿，
+仍然没有任务才在自己的 futex 上睡眠。生产者只唤醒确实在睡眠的线程，并且把它标记为已通知，
+在它真正醒来之前后续的入队不会再对它发起唤醒的系统调用。
+每个提交任务的线程每 SAMPLE_EVERY 个任务在其中一个上记下入队时刻，工作线程把这些任务的排队时间和
+process() 的运行时间记入自己的直方图，读取时才合并，记录时不和其他线程共享任何缓存行。任务类 T 要有 long long 类型的公有成员 m_enqueue_ns 和 m_deadline_ns：
+m_deadline_ns 是 CLOCK_MONOTONIC 的纳秒时刻，为 0 表示没有期限，工作线程取出任务时如果已经过了期限，
+就不再执行 process()，交给 set_expired_handler 设置的函数处理（比如回复一个错误），没有设置时直接丢弃。
+弹性模式下线程数在 min_threads 和 max_threads 之间变化：管理线程每个周期汇总一次排队时间，
+p99 超过目标时增加线程，空闲超过冷却时间的线程自己退出 */
+template< typename T, typename S = shared_queue< T > >
 class threadpoll
 {
 public:
+    /* 取不到任务时在睡眠之前自旋重试的次数 */
+    static const int SPIN_COUNT = 128;
+    /* 弹性模式下管理线程的调整周期 */
+    static const int SCALE_INTERVAL_MS = 100;
+    /* 直方图的采样间隔。读一次时钟要几十纳秒，每个任务都在入队、取出和完成时各读一次，小任务的开销会明显增加 */
+    static const int SAMPLE_EVERY = 16;
+
+public:
+    /* 固定 thread_number 个线程 */
     threadpoll( int thread_number = 8, int max_requests = 10000 );
+    /* 弹性模式：先创建 min_threads 个线程，排队时间的 p99 超过 target_wait_us 微秒时增加线程，最多 max_threads 个；
+    空闲超过 idle_ms 毫秒的线程退出，至少保留 min_threads 个。min_threads 等于 max_threads 时就是固定线程数 */
+    /* cpus 不为空时 i 号工作线程启动后把自己绑定在 cpus[ i % cpu_count ] 上 */
+    threadpoll( int min_threads, int max_threads, int max_requests, int target_wait_us, int idle_ms,
+        const int* cpus = NULL, int cpu_count = 0 );
     ~threadpoll();
     /* 往请求队列中添加任务 */
     bool append( T* request );
+    /* 一次添加一批任务，只做一次入队的同步，按任务数唤醒睡眠的工作线程。accepted 不为空时逐项记录
+    是否入队成功，队列满时被拒绝的总是后面的一部分，调用者可以据此拒绝剩下的请求。返回入队的任务数 */
+    size_t append_batch( T** requests, size_t n, bool* accepted = NULL );
+    /* 队列中等待处理的任务数，只是一个近似值，供接纳控制使用 */
+    int depth() const { return ( int )m_workqueue.size(); }
+    /* 先排空再停止：不再接受新任务，等待队列中的和正在处理的任务在 timeout_ms 毫秒内完成，然后唤醒所有线程
+    并等待它们退出。期限内全部完成时返回 true，否则剩下的任务被丢弃。调用之前应当先停止提交任务的线程 */
+    bool shutdown( int timeout_ms );
+    /* 当前的工作线程数 */
+    int threads() const { return m_active.load( std::memory_order_relaxed ); }
+    /* id 号工作线程绑定的 CPU，没有绑定时返回 -1 */
+    int worker_cpu( int id ) const { return ( m_cpu_count > 0 ) ? m_cpus[ id % m_cpu_count ] : -1; }
+    /* 调用线程（reactor）之后提交的任务优先交给 worker 号工作线程：工作窃取时放进它的收件箱，共享队列时先唤醒它。
+    worker 为 -1 时取消 */
+    void set_home( int worker ) { t_home = ( worker < m_thread_number ) ? worker : -1; }
+    /* 过期任务的处理函数，在工作线程中调用。应当在启动提交任务的线程之前设置 */
+    typedef void ( *expired_handler )( T* request );
+    void set_expired_handler( expired_handler handler ) { m_expired_handler = handler; }
+    /* 当前时刻，与 m_deadline_ns 和 m_enqueue_ns 使用同一个时钟 */
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    /* 读取并合并所有工作线程的指标，可以在任何线程中随时调用，不影响工作线程 */
+    void snapshot( threadpoll_snapshot& out ) const;
+    /* 打印线程数的变化和 snapshot 的内容 */
+    void dump( FILE* out ) const;
 
 private:
     /* 工作线程运行的函数，它不断从工作队列中取出任务并执行之 */
     static void* worker( void* arg );
-    void run();
+    void run( int id );
+    /* 弹性模式的管理线程：周期性地回收退出的线程，按排队时间决定是否增加线程 */
+    static void* manager( void* arg );
+    void manage();
+    /* 在 id 号 slot 上启动一个工作线程 */
+    bool spawn( int id );
+    /* 空闲超时的工作线程尝试退出，线程数已经是下限时返回 false */
+    bool retire( int id );
+    /* 给采样的任务记下入队时刻，其余的记 0 */
+    void stamp( T** requests, size_t n );
+    /* 等待新任务：自旋之后在 futex 上睡眠，取到任务时返回 true */
+    bool wait_request( int id, T*& request );
+    /* 唤醒一个正在睡眠的工作线程，从 hint 开始找，没有睡眠的线程时什么也不做 */
+    void wake_one( int hint );
+    /* 让所有工作线程退出并回收它们，队列中剩下的任务不再处理 */
+    void stop_workers();
+
+private:
+    /* 工作线程的状态，同时也是它睡眠时等待的 futex 字。WORKER_OFF 表示这个 slot 上没有在工作的线程 */
+    enum WORKER_STATE { WORKER_RUNNING = 0, WORKER_SLEEPING, WORKER_NOTIFIED, WORKER_OFF };
+    /* 每个工作线程的状态独占一条缓存行，睡眠和唤醒不会干扰其他线程 */
+    struct worker_slot
+    {
+        std::atomic< int > state;
+        int id;
+        threadpoll* pool;
+        bool started;  // 有一个尚未回收的线程，只由构造函数、管理线程和 stop_workers 访问
+        char pad[ mpmc_queue< T >::CACHE_LINE - sizeof( std::atomic< int > ) - sizeof( int ) - sizeof( threadpoll* ) - sizeof( bool ) ];
+    };
+    /* 每个工作线程的计数，只由这个线程写。两个直方图有 8KB 多，和状态放在一起会让 wake_one 扫描的状态
+    分散到很多页上，所以单独放一个数组，最后留一条缓存行和下一个线程的计数隔开 */
+    struct worker_metrics
+    {
+        std::atomic< unsigned long > tasks;
+        std::atomic< unsigned long > sleeps;
+        std::atomic< unsigned long > expired;
+        latency_histogram wait;
+        latency_histogram service;
+        char tail_pad[ mpmc_queue< T >::CACHE_LINE ];
+    };
+    /* 当前线程所在的线程池和它的工作线程编号，工作线程提交的任务可以留在自己的队列中 */
+    static thread_local threadpoll* t_pool;
+    static thread_local int t_worker;
+    static thread_local int t_home;
+    static thread_local unsigned t_sample; // 这个线程提交的任务数，决定哪些任务被采样
 
 private:
-    int m_thread_number; // 线程池中的线程数
+    int m_thread_number; // 线程池中最多的线程数
+    int m_min_threads; // 线程池中最少的线程数
     int m_max_requests;  // 请求队列中允许的最大请求数
+    bool m_elastic; // 线程数是否可变
+    int m_target_wait_us; // 排队时间 p99 的目标
+    int m_idle_ms; // 空闲线程退出之前的冷却时间
+    int* m_cpus; // 工作线程绑定的 CPU，没有绑定时为空
+    int m_cpu_count;
     pthread_t* m_threads; // 描述线程池的数组，其大小为 m_thread_number
-    std::list<T*> m_workqueue; // 是否有任务需要处理
-    locker m_queuelocker;  // 是否有任务需要处理
-    sem m_queuestat;  // 是否有任务需要处理 
-    bool m_stop; // 是否结束线程
+    S m_workqueue; // 请求队列
+    std::atomic< bool > m_stop; // 是否结束线程
+    std::atomic< bool > m_closing; // 开始关闭，不再接受新任务
+    std::atomic< int > m_running; // 正在执行 process() 的线程数
+    bool m_joined; // 工作线程是否已经回收
+    worker_slot* m_slots; // 每个工作线程的状态
+    worker_metrics* m_metrics; // 每个工作线程的计数
+    std::atomic< int > m_sleepers; // 处于 WORKER_SLEEPING 状态、还没有被通知的工作线程数
+    std::atomic< int > m_active; // 正在工作的线程数
+    pthread_t m_manager; // 弹性模式的管理线程
+    bool m_has_manager;
+    std::atomic< int > m_manager_word; // 管理线程在这个 futex 字上等待下一个周期，停止时被唤醒
+    std::atomic< unsigned long > m_spawned; // 运行中增加的线程数
+    std::atomic< unsigned long > m_retired; // 空闲退出的线程数
+    std::atomic< unsigned > m_last_p99_us; // 最近一个有任务的周期的排队时间 p99
+    latency_snapshot m_last_wait; // 管理线程上一个周期结束时的排队时间，只由管理线程访问
+    unsigned long m_last_tasks; // 管理线程上一个周期结束时所有线程一共取出的任务数，只由管理线程访问
+    std::atomic< unsigned long > m_rejected_full; // 队列已满时被拒绝的任务数
+    std::atomic< unsigned long > m_rejected_closing; // 关闭过程中被拒绝的任务数
+    expired_handler m_expired_handler; // 过期任务的处理函数
 };
 
-template< typename T>
-threadpoll< T >::threadpoll( int thread_number = 8, int max_requests = 1000 ):
-    m_thread_number( thread_number), m_max_requests( max_requests ), m_stop( false ), m_threads( NULL )
+template< typename T, typename S >
+thread_local threadpoll< T, S >* threadpoll< T, S >::t_pool = NULL;
+template< typename T, typename S >
+thread_local int threadpoll< T, S >::t_worker = -1;
+template< typename T, typename S >
+thread_local int threadpoll< T, S >::t_home = -1;
+template< typename T, typename S >
+thread_local unsigned threadpoll< T, S >::t_sample = 0;
+
+template< typename T, typename S >
+threadpoll< T, S >::threadpoll( int thread_number, int max_requests ):
+    threadpoll( thread_number, thread_number, max_requests, 0, 0 )
+{
+}
+
+template< typename T, typename S >
+threadpoll< T, S >::threadpoll( int min_threads, int max_threads, int max_requests, int target_wait_us, int idle_ms,
+    const int* cpus, int cpu_count ):
+    m_thread_number( max_threads ), m_min_threads( min_threads ), m_max_requests( max_requests ),
+    m_elastic( min_threads < max_threads ), m_target_wait_us( target_wait_us ), m_idle_ms( idle_ms ),
+    m_cpus( NULL ), m_cpu_count( 0 ), m_threads( NULL ),
+    m_workqueue( max_threads > 0 ? max_threads : 1, max_requests > 0 ? max_requests : 1 ), m_stop( false ), m_closing( false ), m_running( 0 ), m_joined( false ), m_slots( NULL ), m_metrics( NULL ),
+    m_sleepers( 0 ), m_active( 0 ), m_has_manager( false ), m_manager_word( 0 ), m_spawned( 0 ), m_retired( 0 ), m_last_p99_us( 0 ),
+    m_last_tasks( 0 ), m_rejected_full( 0 ), m_rejected_closing( 0 ), m_expired_handler( NULL )
 {
-    if ( (thread_number <= 0 ) || ( max_requests <= 0 ) )
+    if ( ( min_threads <= 0 ) || ( max_threads < min_threads ) || ( max_requests <= 0 ) )
+    {
+        throw std::exception();
+    }
+    if ( m_elastic && ( ( target_wait_us <= 0 ) || ( idle_ms <= 0 ) ) )
     {
         throw std::exception();
     }
 
+    if ( cpus && ( cpu_count > 0 ) )
+    {
+        m_cpus = new int[ cpu_count ];
+        for ( int i = 0; i < cpu_count; ++i )
+        {
+            m_cpus[i] = cpus[i];
+        }
+        m_cpu_count = cpu_count;
+    }
     m_threads = new pthread_t[ m_thread_number ];
     if ( !m_threads )
     {
         throw std::exception();
     }
+    m_slots = new worker_slot[ m_thread_number ];
+    m_metrics = new worker_metrics[ m_thread_number ];
+    for ( int i = 0; i < m_thread_number; ++i )
+    {
+        m_slots[i].state.store( WORKER_OFF, std::memory_order_relaxed );
+        m_slots[i].id = i;
+        m_slots[i].pool = this;
+        m_slots[i].started = false;
+        m_metrics[i].tasks.store( 0, std::memory_order_relaxed );
+        m_metrics[i].sleeps.store( 0, std::memory_order_relaxed );
+        m_metrics[i].expired.store( 0, std::memory_order_relaxed );
+    }
     
-    /* 创建 thread_number 个线程，并将它们都设置为脱离线程 */
-    for ( int i = 0; i < thread_number; ++i )
+    /* 创建 min_threads 个线程。线程不再设置为脱离线程，关闭时要等它们处理完手上的任务再回收 */
+    bool failed = false;
+    for ( int i = 0; ( i < min_threads ) && !failed; ++i )
+    {
+        failed = !spawn( i );
+    }
+    if ( !failed && m_elastic )
+    {
+        failed = ( pthread_create( &m_manager, NULL, manager, this ) != 0 );
+        m_has_manager = !failed;
+    }
+    if ( failed )
+    {
+        /* 回收已经创建的线程，析构函数不会被调用 */
+        stop_workers();
+        delete []m_threads;
+        delete []m_slots;
+        delete []m_metrics;
+        delete []m_cpus;
+        throw std::exception();
+    }
+}
+
+template< typename T, typename S >
+threadpoll< T, S >::~threadpoll()
+{
+    /* 没有调用 shutdown 时不再排空，直接停止。必须先回收线程再释放它们使用的数组 */
+    stop_workers();
+    delete []m_threads;
+    delete []m_slots;
+    delete []m_metrics;
+    delete []m_cpus;
+}
+
+template< typename T, typename S >
+bool threadpoll< T, S >::shutdown( int timeout_ms )
+{
+    m_closing = true;
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    long long deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout_ms;
+    while ( ( m_workqueue.size() > 0 ) || ( m_running.load() > 0 ) )
     {
-        printf( "create the %dth thread\n", i );
-        if ( pthread_create( m_threads + i, NULL, worker, this ) != 0 )  // this 指针啥意思？传入的是这个对象？
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        if ( now.tv_sec * 1000LL + now.tv_nsec / 1000000 >= deadline )
         {
-            delete [] m_threads;
-            m_threads = nullptr;
-            throw std::exception();
-        }
-        if ( pthread_detach( m_threads[i] ) ) {
-            delete []m_threads;
-            m_threads = nullptr;
-            throw std::exception();
+            break;
         }
+        usleep( 1000 );
     }
+    bool drained = ( m_workqueue.size() == 0 ) && ( m_running.load() == 0 );
+    stop_workers();
+    return drained;
 }
 
-template< typename T>
-threadpoll<T>::~threadpoll()
+template< typename T, typename S >
+void threadpoll< T, S >::stop_workers()
 {
-    if ( !m_threads )  // 我自己加的，以防前面初始化过程中的 delete完了， 重复 delete，but 貌似构造函数里抛出异常，系统会自动回收
-        delete []m_threads;
+    if ( m_joined )
+    {
+        return;
+    }
+    m_closing = true;
     m_stop = true;
+    /* 先停止管理线程，之后不会再有新的线程启动 */
+    if ( m_has_manager )
+    {
+        m_manager_word.store( 1 );
+        syscall( SYS_futex, ( int* )&m_manager_word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+        pthread_join( m_manager, NULL );
+        m_has_manager = false;
+    }
+    /* 与 wait_request 中的栅栏配对：工作线程要么在睡眠前看到 m_stop，要么已经登记为睡眠，会在这里被通知 */
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    for ( int i = 0; i < m_thread_number; ++i )
+    {
+        if ( m_slots[i].started )
+        {
+            m_slots[i].state.exchange( WORKER_NOTIFIED, std::memory_order_acq_rel );
+            syscall( SYS_futex, ( int* )&m_slots[i].state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+        }
+    }
+    for ( int i = 0; i < m_thread_number; ++i )
+    {
+        if ( m_slots[i].started )
+        {
+            pthread_join( m_threads[i], NULL );
+            m_slots[i].started = false;
+        }
+    }
+    m_joined = true;
+}
+
+template< typename T, typename S >
+void threadpoll< T, S >::snapshot( threadpoll_snapshot& out ) const
+{
+    out.workers = threads();
+    out.depth = depth();
+    out.running = m_running.load( std::memory_order_relaxed );
+    out.rejected_full = m_rejected_full.load( std::memory_order_relaxed );
+    out.rejected_closing = m_rejected_closing.load( std::memory_order_relaxed );
+    out.expired = 0;
+    out.wait.clear();
+    out.service.clear();
+    out.per_worker.clear();
+    for ( int i = 0; i < m_thread_number; ++i )
+    {
+        const worker_metrics& metrics = m_metrics[i];
+        bool active = ( m_slots[i].state.load( std::memory_order_relaxed ) != WORKER_OFF );
+        unsigned long sleeps = metrics.sleeps.load( std::memory_order_relaxed );
+        /* 从来没有启动过的 slot 不列出。退出的线程都是从睡眠中退出的，睡眠次数不为 0 */
+        if ( !active && ( sleeps == 0 ) )
+        {
+            continue;
+        }
+        out.per_worker.push_back( threadpoll_snapshot::worker() );
+        threadpoll_snapshot::worker& w = out.per_worker.back();
+        w.id = i;
+        w.active = active;
+        w.sleeps = sleeps;
+        w.tasks = metrics.tasks.load( std::memory_order_relaxed );
+        w.expired = metrics.expired.load( std::memory_order_relaxed );
+        out.expired += w.expired;
+        w.wait.add( metrics.wait );
+        w.service.add( metrics.service );
+        out.wait.add( metrics.wait );
+        out.service.add( metrics.service );
+    }
+}
+
+template< typename T, typename S >
+void threadpoll< T, S >::dump( FILE* out ) const
+{
+    if ( !m_elastic )
+    {
+        fprintf( out, "threadpoll: %d workers\n", m_thread_number );
+    }
+    else
+    {
+        fprintf( out, "threadpoll: %d workers (%d-%d), spawned %lu retired %lu, last queue wait p99 < %u us (target %d us)\n",
+            threads(), m_min_threads, m_thread_number, m_spawned.load( std::memory_order_relaxed ),
+            m_retired.load( std::memory_order_relaxed ), m_last_p99_us.load( std::memory_order_relaxed ), m_target_wait_us );
+    }
+    threadpoll_snapshot s;
+    snapshot( s );
+    s.print( out );
+}
+
+template< typename T, typename S >
+bool threadpoll< T, S >::spawn( int id )
+{
+    worker_slot& slot = m_slots[ id ];
+    slot.state.store( WORKER_RUNNING, std::memory_order_relaxed );
+    m_active.fetch_add( 1 );
+    m_workqueue.set_running( id, true );
+    if ( pthread_create( m_threads + id, NULL, worker, &slot ) != 0 )
+    {
+        m_workqueue.set_running( id, false );
+        m_active.fetch_sub( 1 );
+        slot.state.store( WORKER_OFF, std::memory_order_relaxed );
+        return false;
+    }
+    slot.started = true;
+    return true;
+}
+
+template< typename T, typename S >
+bool threadpoll< T, S >::retire( int id )
+{
+    int active = m_active.load();
+    do
+    {
+        if ( active <= m_min_threads )
+        {
+            return false;
+        }
+    } while ( !m_active.compare_exchange_weak( active, active - 1 ) );
+
+    int expected = WORKER_SLEEPING;
+    if ( !m_slots[ id ].state.compare_exchange_strong( expected, WORKER_OFF, std::memory_order_acq_rel ) )
+    {
+        /* 生产者抢先通知了这个线程，它得继续工作 */
+        m_active.fetch_add( 1 );
+        return false;
+    }
+    /* 之后的任务不再放进这个线程的队列。通知这个线程的生产者会改为唤醒别的线程，
+    退出之前已经放进它的收件箱的任务由被唤醒的线程窃取 */
+    m_workqueue.set_running( id, false );
+    m_sleepers.fetch_sub( 1, std::memory_order_relaxed );
+    m_retired.fetch_add( 1, std::memory_order_relaxed );
+    return true;
 }
 
+template< typename T, typename S >
+void* threadpoll< T, S >::manager( void* arg )
+{
+    ( ( threadpoll* )arg )->manage();
+    return NULL;
+}
 
-template <typename T>
-bool threadpoll< T >::append( T* request ) {
-    /* 操作工作队列时一定要加锁，因为它被所有线程共享 */
-    m_queuelocker.lock();
-    if ( m_workqueue.size() > m_max_requests )
+template< typename T, typename S >
+void threadpoll< T, S >::manage()
+{
+    struct timespec interval = { 0, SCALE_INTERVAL_MS * 1000000L };
+    while ( !m_stop )
     {
-        m_queuelocker.unlock();
+        syscall( SYS_futex, ( int* )&m_manager_word, FUTEX_WAIT_PRIVATE, 0, &interval, NULL, 0 );
+        if ( m_stop )
+        {
+            break;
+        }
+
+        /* 回收空闲退出的线程，它们的 slot 可以重新使用 */
+        for ( int i = 0; i < m_thread_number; ++i )
+        {
+            if ( m_slots[i].started && ( m_slots[i].state.load( std::memory_order_acquire ) == WORKER_OFF ) )
+            {
+                pthread_join( m_threads[i], NULL );
+                m_slots[i].started = false;
+            }
+        }
+
+        /* 合并所有线程的排队时间，减去上个周期结束时的快照，得到这个周期的分布。排队时间只是采样，
+        这个周期有没有任务出队要看准确的任务计数 */
+        latency_snapshot now;
+        unsigned long tasks = 0;
+        for ( int i = 0; i < m_thread_number; ++i )
+        {
+            now.add( m_metrics[i].wait );
+            tasks += m_metrics[i].tasks.load( std::memory_order_relaxed );
+        }
+        latency_snapshot period = now;
+        period.subtract( m_last_wait );
+        m_last_wait = now;
+        unsigned long dequeued = tasks - m_last_tasks;
+        m_last_tasks = tasks;
+        bool behind = false;
+        if ( dequeued == 0 )
+        {
+            /* 整个周期没有任务出队而队列不空，说明所有线程都被长任务占着 */
+            behind = ( m_workqueue.size() > 0 );
+        }
+        else if ( period.count() > 0 )
+        {
+            unsigned long long p99_us = period.percentile( 99 ) / 1000;
+            m_last_p99_us.store( ( unsigned )p99_us, std::memory_order_relaxed );
+            behind = ( p99_us > ( unsigned long long )m_target_wait_us );
+        }
+
+        /* 白天和夜里的负载相差很大，每次增加现有线程数的一半，几个周期内就能跟上 */
+        int active = m_active.load();
+        int grow = behind ? ( active + 1 ) / 2 : 0;
+        for ( int i = 0; ( i < m_thread_number ) && ( grow > 0 ) && !m_stop; ++i )
+        {
+            if ( !m_slots[i].started )
+            {
+                if ( !spawn( i ) )
+                {
+                    break;
+                }
+                m_spawned.fetch_add( 1, std::memory_order_relaxed );
+                --grow;
+            }
+        }
+    }
+}
+
+
+template< typename T, typename S >
+void threadpoll< T, S >::stamp( T** requests, size_t n )
+{
+    /* 一批任务共用一次读到的时刻 */
+    long long now = 0;
+    for ( size_t i = 0; i < n; ++i )
+    {
+        if ( t_sample++ % SAMPLE_EVERY != 0 )
+        {
+            requests[i]->m_enqueue_ns = 0;
+            continue;
+        }
+        if ( now == 0 )
+        {
+            now = now_ns();
+        }
+        requests[i]->m_enqueue_ns = now;
+    }
+}
+
+template< typename T, typename S >
+bool threadpoll< T, S >::append( T* request ) {
+    if ( m_closing.load( std::memory_order_relaxed ) )
+    {
+        m_rejected_closing.fetch_add( 1, std::memory_order_relaxed );
         return false;
     }
-    m_workqueue.push_back( request );
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    stamp( &request, 1 );
+    int target = m_workqueue.push( request, ( t_pool == this ) ? t_worker : -1, t_home );
+    if ( target < 0 )
+    {
+        m_rejected_full.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+    /* 与 wait_request 中的栅栏配对：要么工作线程在睡眠前再次检查队列时看到这个任务，
+    要么这里看到它已经登记为睡眠者，不会两边都错过 */
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( m_sleepers.load( std::memory_order_relaxed ) > 0 )
+    {
+        wake_one( target );
+    }
     return true;
 }
 
-/* 每个线程的工作内容实际上是调用 threadpoll 上的 run() 函数，因此传入参数是 this 指针 */
-template< typename T>
-void* threadpoll<T>::worker( void* arg ) {
-    threadpoll* poll = ( threadpoll* ) arg;
-    pool->run();
+template< typename T, typename S >
+size_t threadpoll< T, S >::append_batch( T** requests, size_t n, bool* accepted )
+{
+    int target = 0;
+    size_t count = 0;
+    if ( n == 0 )
+    {
+        return 0;
+    }
+    if ( m_closing.load( std::memory_order_relaxed ) )
+    {
+        m_rejected_closing.fetch_add( n, std::memory_order_relaxed );
+    }
+    else
+    {
+        stamp( requests, n );
+        count = m_workqueue.push_batch( requests, n, ( t_pool == this ) ? t_worker : -1, t_home, &target );
+        if ( count < n )
+        {
+            m_rejected_full.fetch_add( n - count, std::memory_order_relaxed );
+        }
+    }
+    if ( accepted )
+    {
+        for ( size_t i = 0; i < n; ++i )
+        {
+            accepted[i] = ( i < count );
+        }
+    }
+    if ( count == 0 )
+    {
+        return 0;
+    }
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    /* 最多唤醒 count 个线程，睡眠的线程不够时有多少唤醒多少 */
+    for ( size_t i = 0; ( i < count ) && ( m_sleepers.load( std::memory_order_relaxed ) > 0 ); ++i )
+    {
+        wake_one( target < 0 ? 0 : target + ( int )i );
+    }
+    return count;
+}
+
+template< typename T, typename S >
+void threadpoll< T, S >::wake_one( int hint )
+{
+    /* 优先唤醒任务所在的线程，工作窃取模式下它的队列里就有这个任务 */
+    for ( int i = 0; i < m_thread_number; ++i )
+    {
+        worker_slot& slot = m_slots[ ( hint + i ) % m_thread_number ];
+        int expected = WORKER_SLEEPING;
+        if ( slot.state.compare_exchange_strong( expected, WORKER_NOTIFIED, std::memory_order_acq_rel ) )
+        {
+            m_sleepers.fetch_sub( 1, std::memory_order_relaxed );
+            syscall( SYS_futex, ( int* )&slot.state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+            return;
+        }
+    }
+    /* 登记的睡眠者刚刚自己取到了任务或者被别的生产者通知了，它们都会在睡眠前再检查一次队列 */
+}
+
+template< typename T, typename S >
+bool threadpoll< T, S >::wait_request( int id, T*& request )
+{
+    for ( int i = 0; i < SPIN_COUNT; ++i )
+    {
+        if ( m_workqueue.pop( id, request ) )
+        {
+            return true;
+        }
+        cpu_relax();
+    }
+
+    /* 先登记为睡眠者，再最后检查一次队列。这之后入队的生产者一定会看到这次登记并通知这个线程，
+    通知改变了 futex 字，FUTEX_WAIT 发现字的值不再是 WORKER_SLEEPING 就会立即返回 */
+    std::atomic< int >& state = m_slots[ id ].state;
+    state.store( WORKER_SLEEPING, std::memory_order_relaxed );
+    m_sleepers.fetch_add( 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( m_workqueue.pop( id, request ) || m_stop )
+    {
+        /* 撤销登记。如果生产者已经抢先通知了这个线程，计数已经由它减掉 */
+        int expected = WORKER_SLEEPING;
+        if ( state.compare_exchange_strong( expected, WORKER_RUNNING, std::memory_order_acq_rel ) )
+        {
+            m_sleepers.fetch_sub( 1, std::memory_order_relaxed );
+        }
+        state.store( WORKER_RUNNING, std::memory_order_relaxed );
+        return request != NULL;
+    }
+    std::atomic< unsigned long >& sleeps = m_metrics[ id ].sleeps;
+    sleeps.store( sleeps.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    while ( state.load( std::memory_order_acquire ) == WORKER_SLEEPING )
+    {
+        if ( !m_elastic )
+        {
+            syscall( SYS_futex, ( int* )&state, FUTEX_WAIT_PRIVATE, WORKER_SLEEPING, NULL, NULL, 0 );
+            continue;
+        }
+        /* 弹性模式下只睡冷却时间那么久，一直没有被唤醒就尝试退出 */
+        struct timespec timeout = { m_idle_ms / 1000, ( m_idle_ms % 1000 ) * 1000000L };
+        if ( ( syscall( SYS_futex, ( int* )&state, FUTEX_WAIT_PRIVATE, WORKER_SLEEPING, &timeout, NULL, 0 ) == -1 )
+            && ( errno == ETIMEDOUT ) && retire( id ) )
+        {
+            return false;
+        }
+    }
+    state.store( WORKER_RUNNING, std::memory_order_relaxed );
+    return false;
+}
+
+/* 每个线程的工作内容实际上是调用 threadpoll 上的 run() 函数，传入参数是这个线程的 slot，其中有线程池的指针 */
+template< typename T, typename S >
+void* threadpoll< T, S >::worker( void* arg ) {
+    worker_slot* slot = ( worker_slot* ) arg;
+    threadpoll* poll = slot->pool;
+    t_pool = poll;
+    t_worker = slot->id;
+    int cpu = poll->worker_cpu( slot->id );
+    if ( ( cpu >= 0 ) && !pin_current_thread( cpu ) )
+    {
+        printf( "worker %d: cannot bind to cpu %d\n", slot->id, cpu );
+    }
+    poll->run( t_worker );
     return poll;
 }
 
-template<typename T>
-void threadpoll<T>::run() {
+template< typename T, typename S >
+void threadpoll< T, S >::run( int id ) {
+    worker_metrics& metrics = m_metrics[ id ];
     while ( !m_stop )
     {
-        m_queuestat.wait();
-        m_queuelocker.lock();
-        if( m_workqueue.empty() ) {
-            m_queuelocker.unlock();
+        T* request = NULL;
+        if ( !m_workqueue.pop( id, request ) && !wait_request( id, request ) )
+        {
+            if ( m_slots[ id ].state.load( std::memory_order_relaxed ) == WORKER_OFF )
+            {
+                break;  // 空闲太久，已经退出线程池
+            }
             continue;
         }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
         if( !request ) {
             continue;
         
         }
+        /* 只有入队时被采样的任务和有期限的任务需要读时钟 */
+        metrics.tasks.store( metrics.tasks.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        bool sampled = ( request->m_enqueue_ns != 0 );
+        long long start = ( sampled || ( request->m_deadline_ns != 0 ) ) ? now_ns() : 0;
+        if ( sampled )
+        {
+            metrics.wait.record( ( start > request->m_enqueue_ns ) ? start - request->m_enqueue_ns : 0 );
+        }
+        /* 等得太久的任务结果已经没有人要了，不再占用工作线程，把时间留给还来得及的任务 */
+        if ( ( request->m_deadline_ns != 0 ) && ( start > request->m_deadline_ns ) )
+        {
+            metrics.expired.store( metrics.expired.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+            if ( m_expired_handler )
+            {
+                m_running.fetch_add( 1 );
+                m_expired_handler( request );
+                m_running.fetch_sub( 1 );
+            }
+            continue;
+        }
+        m_running.fetch_add( 1 );
         request->process();
+        m_running.fetch_sub( 1 );
+        if ( sampled )
+        {
+            metrics.service.record( now_ns() - start );
+        }
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -31,7 +31,7 @@ void addfd( int epollfd, int fd )
 }
 
 /* 向服务器写入 len 字节的数据 */
-bool write_nbytes( int sockfd , const char* buffer, itn len )
+bool write_nbytes( int sockfd , const char* buffer, int len )
 {
     int bytes_write = 0;
     printf( "write out %d bytes to socket %d \n", len, sockfd );
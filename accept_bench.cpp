@@ -0,0 +1,194 @@
+/* 测量接受连接的速度：-p 时每个线程一个 SO_REUSEPORT 监听 socket，由内核分配新连接；否则与 server_main 的默认模式
+相同，只有 0 号线程监听。客户端线程不停地建立并关闭连接，最后输出每个线程接受的连接数和速率。
+编译运行：g++ -O2 -pthread -o accept_bench accept_bench.cpp && ./accept_bench -t 4 -c 8 -n 200000 -p */
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <atomic>
+
+static const int MAX_THREADS = 64;
+static const int BACKLOG = 4096;
+
+struct acceptor
+{
+    int id;
+    int listenfd;
+    pthread_t thread;
+    long accepted;
+};
+
+static acceptor acceptors[ MAX_THREADS ];
+static struct sockaddr_in address;
+static std::atomic< long > remaining( 0 );
+static std::atomic< bool > done( false );
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int create_listener( bool reuseport )
+{
+    int fd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    int on = 1;
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+    if ( reuseport )
+    {
+        setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof( on ) );
+    }
+    if ( ( bind( fd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 ) || ( listen( fd, BACKLOG ) < 0 ) )
+    {
+        perror( "bind/listen" );
+        exit( 1 );
+    }
+    return fd;
+}
+
+/* 与 server_main 相同：ET 模式下每次事件都接受到 EAGAIN 为止 */
+static void* accept_thread( void* arg )
+{
+    acceptor* a = ( acceptor* )arg;
+    int epollfd = epoll_create( 5 );
+    epoll_event event;
+    event.data.fd = a->listenfd;
+    event.events = EPOLLIN | EPOLLET;
+    epoll_ctl( epollfd, EPOLL_CTL_ADD, a->listenfd, &event );
+    epoll_event events[ 16 ];
+    while ( !done )
+    {
+        int number = epoll_wait( epollfd, events, 16, 100 );
+        for ( int i = 0; i < number; ++i )
+        {
+            while ( true )
+            {
+                int connfd = accept4( a->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+                if ( connfd < 0 )
+                {
+                    if ( ( errno == EINTR ) || ( errno == ECONNABORTED ) )
+                        continue;
+                    break;
+                }
+                close( connfd );
+                ++a->accepted;
+            }
+        }
+    }
+    close( epollfd );
+    return NULL;
+}
+
+/* 客户端：建立连接后立刻关闭。SO_LINGER{ 1, 0 } 让关闭直接发送 RST，避免本机的临时端口耗尽在 TIME_WAIT 上 */
+static void* connect_thread( void* )
+{
+    struct linger lg = { 1, 0 };
+    while ( remaining.fetch_sub( 1 ) > 0 )
+    {
+        int fd = socket( PF_INET, SOCK_STREAM, 0 );
+        setsockopt( fd, SOL_SOCKET, SO_LINGER, &lg, sizeof( lg ) );
+        if ( connect( fd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 )
+        {
+            perror( "connect" );
+        }
+        close( fd );
+    }
+    return NULL;
+}
+
+int main( int argc, char* argv[] )
+{
+    int threads = 4;
+    int clients = 8;
+    long connections = 100000;
+    bool reuseport = false;
+    int port = 23456;
+    int opt = 0;
+    while ( ( opt = getopt( argc, argv, "t:c:n:pP:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 't': threads = atoi( optarg ); break;
+            case 'c': clients = atoi( optarg ); break;
+            case 'n': connections = atol( optarg ); break;
+            case 'p': reuseport = true; break;
+            case 'P': port = atoi( optarg ); break;
+            default:
+                printf( "usage: %s [-t accept_threads] [-c client_threads] [-n connections] [-p] [-P port]\n", argv[0] );
+                return 1;
+        }
+    }
+    if ( ( threads <= 0 ) || ( threads > MAX_THREADS ) || ( clients <= 0 ) )
+    {
+        return 1;
+    }
+
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+    inet_pton( AF_INET, "127.0.0.1", &address.sin_addr );
+
+    int shared = reuseport ? -1 : create_listener( false );
+    int accept_threads = reuseport ? threads : 1;
+    for ( int i = 0; i < accept_threads; ++i )
+    {
+        acceptors[i].id = i;
+        acceptors[i].accepted = 0;
+        acceptors[i].listenfd = reuseport ? create_listener( true ) : shared;
+        pthread_create( &acceptors[i].thread, NULL, accept_thread, &acceptors[i] );
+    }
+
+    remaining = connections;
+    pthread_t* client_threads = new pthread_t[ clients ];
+    double begin = now_sec();
+    for ( int i = 0; i < clients; ++i )
+    {
+        pthread_create( &client_threads[i], NULL, connect_thread, NULL );
+    }
+    for ( int i = 0; i < clients; ++i )
+    {
+        pthread_join( client_threads[i], NULL );
+    }
+    /* 等待最后一批连接被接受 */
+    long total = 0;
+    for ( int wait = 0; wait < 100; ++wait )
+    {
+        total = 0;
+        for ( int i = 0; i < accept_threads; ++i )
+            total += acceptors[i].accepted;
+        if ( total >= connections )
+            break;
+        usleep( 10000 );
+    }
+    double elapsed = now_sec() - begin;
+    done = true;
+    for ( int i = 0; i < accept_threads; ++i )
+    {
+        pthread_join( acceptors[i].thread, NULL );
+    }
+
+    printf( "%s listener, %d accept thread(s), %d client thread(s), %.2f s\n", reuseport ? "SO_REUSEPORT" : "shared",
+        accept_threads, clients, elapsed );
+    for ( int i = 0; i < accept_threads; ++i )
+    {
+        printf( "  thread %2d: %8ld accepts  %10.0f accepts/s\n", i, acceptors[i].accepted, acceptors[i].accepted / elapsed );
+        if ( reuseport )
+            close( acceptors[i].listenfd );
+    }
+    printf( "  total    : %8ld accepts  %10.0f accepts/s\n", total, total / elapsed );
+    if ( !reuseport )
+        close( shared );
+    delete []client_threads;
+    return 0;
+}
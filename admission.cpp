@@ -0,0 +1,101 @@
+#include "admission.h"
+
+
+admission::admission( int conn_high, int conn_low, int queue_high, int queue_low, pause_handler handler ):
+    m_conn_high( conn_high ), m_conn_low( conn_low ), m_queue_high( queue_high ), m_queue_low( queue_low ),
+    m_handler( handler ), m_paused( false ), m_closed( false ), m_admitted_conns( 0 ), m_shed_conns( 0 ), m_admitted_requests( 0 ),
+    m_shed_requests( 0 ), m_pauses( 0 )
+{
+}
+
+bool admission::admit_connection( int conns )
+{
+    if ( conns >= m_conn_high )
+    {
+        m_shed_conns.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+    m_admitted_conns.fetch_add( 1, std::memory_order_relaxed );
+    return true;
+}
+
+bool admission::admit_request( int depth )
+{
+    if ( depth >= m_queue_high )
+    {
+        m_shed_requests.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+    m_admitted_requests.fetch_add( 1, std::memory_order_relaxed );
+    return true;
+}
+
+int admission::admit_requests( int depth, int n )
+{
+    int room = m_queue_high - depth;
+    int admitted = ( room <= 0 ) ? 0 : ( ( room < n ) ? room : n );
+    m_admitted_requests.fetch_add( admitted, std::memory_order_relaxed );
+    m_shed_requests.fetch_add( n - admitted, std::memory_order_relaxed );
+    return admitted;
+}
+
+void admission::reject_requests( int n )
+{
+    m_admitted_requests.fetch_sub( n, std::memory_order_relaxed );
+    m_shed_requests.fetch_add( n, std::memory_order_relaxed );
+}
+
+void admission::update( int conns, int depth )
+{
+    bool overloaded = ( conns >= m_conn_high ) || ( depth >= m_queue_high );
+    bool relieved = ( conns <= m_conn_low ) && ( depth <= m_queue_low );
+    bool paused = m_paused.load( std::memory_order_relaxed );
+    if ( ( paused && !relieved ) || ( !paused && !overloaded ) )
+    {
+        return;
+    }
+
+    /* 可能有多个 reactor 同时发现状态需要变化，加锁后重新判断，保证暂停和恢复严格交替 */
+    m_lock.lock();
+    paused = m_paused.load( std::memory_order_relaxed );
+    if ( m_closed )
+    {
+        /* 已经关闭，保持暂停 */
+    }
+    else if ( !paused && overloaded )
+    {
+        m_paused.store( true, std::memory_order_relaxed );
+        m_pauses.fetch_add( 1, std::memory_order_relaxed );
+        if ( m_handler )
+            m_handler( true );
+    }
+    else if ( paused && relieved )
+    {
+        m_paused.store( false, std::memory_order_relaxed );
+        if ( m_handler )
+            m_handler( false );
+    }
+    m_lock.unlock();
+}
+
+void admission::close()
+{
+    m_lock.lock();
+    if ( !m_closed )
+    {
+        m_closed = true;
+        if ( !m_paused.load( std::memory_order_relaxed ) )
+        {
+            m_paused.store( true, std::memory_order_relaxed );
+            if ( m_handler )
+                m_handler( true );
+        }
+    }
+    m_lock.unlock();
+}
+
+void admission::dump( FILE* out ) const
+{
+    fprintf( out, "admission: conns admitted %lu shed %lu, requests admitted %lu shed %lu, accept paused %lu times%s\n",
+        admitted_conns(), shed_conns(), admitted_requests(), shed_requests(), pauses(), paused() ? " (paused now)" : "" );
+}
@@ -0,0 +1,64 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdio.h>
+#include <atomic>
+
+#include "14-2_locker.h"
+
+
+/* 接纳控制。连接数和线程池队列深度各有一对高低水位：任何一项达到高水位就进入过载状态，暂停 accept，
+新连接留在内核的监听队列里；两项都回落到低水位以下才恢复。两个水位之间的滞回避免了在临界点附近反复切换。
+已经接受的连接超过高水位、或者请求到来时队列已满，就直接回复 503 并关闭，而不是静默地卡住 */
+class admission
+{
+public:
+    /* 进入或离开过载状态时调用，paused 为 true 表示应当暂停 accept。调用时持有内部的锁，
+    所以暂停和恢复的操作不会交错 */
+    typedef void ( *pause_handler )( bool paused );
+
+public:
+    admission( int conn_high, int conn_low, int queue_high, int queue_low, pause_handler handler );
+
+    /* 新连接能否接纳：conns 是当前的连接数，达到连接高水位时拒绝 */
+    bool admit_connection( int conns );
+    /* 一个解析好的请求能否放入线程池队列：depth 是当前的队列深度，达到队列高水位时拒绝 */
+    bool admit_request( int depth );
+    /* 一批 n 个请求中能放入队列的个数，被拒绝的是后面的一部分 */
+    int admit_requests( int depth, int n );
+    /* 已经接纳的请求最终没能入队，改记为拒绝 */
+    void reject_requests( int n );
+    /* 按当前负载更新过载状态，需要时调用 pause_handler。没有状态变化时只有几次原子读 */
+    void update( int conns, int depth );
+    bool paused() const { return m_paused.load( std::memory_order_relaxed ); }
+    /* 关闭时调用：进入暂停状态并且不再恢复，返回之后 pause_handler 不会再被调用 */
+    void close();
+
+    /* 接纳和拒绝的计数 */
+    unsigned long admitted_conns() const { return m_admitted_conns.load( std::memory_order_relaxed ); }
+    unsigned long shed_conns() const { return m_shed_conns.load( std::memory_order_relaxed ); }
+    unsigned long admitted_requests() const { return m_admitted_requests.load( std::memory_order_relaxed ); }
+    unsigned long shed_requests() const { return m_shed_requests.load( std::memory_order_relaxed ); }
+    unsigned long pauses() const { return m_pauses.load( std::memory_order_relaxed ); }
+    /* 打印接纳和拒绝的计数 */
+    void dump( FILE* out ) const;
+
+private:
+    int m_conn_high;
+    int m_conn_low;
+    int m_queue_high;
+    int m_queue_low;
+    pause_handler m_handler;
+    std::atomic< bool > m_paused;
+    bool m_closed;  // 由 m_lock 保护
+    locker m_lock;
+
+    /* 多个 reactor 线程同时计数 */
+    std::atomic< unsigned long > m_admitted_conns;
+    std::atomic< unsigned long > m_shed_conns;
+    std::atomic< unsigned long > m_admitted_requests;
+    std::atomic< unsigned long > m_shed_requests;
+    std::atomic< unsigned long > m_pauses;
+};
+
+#endif
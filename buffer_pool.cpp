@@ -0,0 +1,215 @@
+#include "buffer_pool.h"
+#include <stdint.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "placement.h"
+
+
+buffer_pool::buffer_pool( int node ): m_node( node )
+{
+    for ( int i = 0; i < CLASS_COUNT; ++i )
+    {
+        m_free[i] = NULL;
+        m_free_count[i] = 0;
+    }
+}
+
+buffer_pool::~buffer_pool()
+{
+    for ( size_t i = 0; i < m_slabs.size(); ++i )
+    {
+        munmap( m_slabs[i], SLAB_SIZE );
+    }
+}
+
+/* 返回能容纳 size 字节的最小分级 */
+int buffer_pool::size_class( size_t size )
+{
+    int cls = 0;
+    while ( ( ( size_t )1 << ( cls + MIN_CHUNK_SHIFT ) ) < size )
+    {
+        ++cls;
+    }
+    return cls;
+}
+
+/* 映射一个按 SLAB_SIZE 对齐的 slab：多映射一个 slab 的长度，再把对齐位置前后多出来的部分解除映射。
+切分写入之前先设置好内存策略 */
+char* buffer_pool::map_slab()
+{
+    char* raw = ( char* )mmap( NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( raw == MAP_FAILED )
+    {
+        return NULL;
+    }
+    char* memory = ( char* )( ( ( uintptr_t )raw + SLAB_SIZE - 1 ) & ~( uintptr_t )( SLAB_SIZE - 1 ) );
+    if ( memory > raw )
+    {
+        munmap( raw, memory - raw );
+    }
+    if ( raw + 2 * SLAB_SIZE > memory + SLAB_SIZE )
+    {
+        munmap( memory + SLAB_SIZE, raw + 2 * SLAB_SIZE - ( memory + SLAB_SIZE ) );
+    }
+    if ( m_node >= 0 )
+    {
+        bind_memory_to_node( memory, SLAB_SIZE, m_node );
+    }
+    return memory;
+}
+
+char* buffer_pool::acquire( size_t size, size_t* capacity )
+{
+    if ( size > MAX_CHUNK_SIZE )
+    {
+        return NULL;
+    }
+    int cls = size_class( size );
+    size_t chunk_size = ( size_t )1 << ( cls + MIN_CHUNK_SHIFT );
+
+    m_locks[ cls ].lock();
+    free_chunk* chunk = m_free[ cls ];
+    if ( chunk )
+    {
+        m_free[ cls ] = chunk->next;
+        --m_free_count[ cls ];
+        m_locks[ cls ].unlock();
+        *capacity = chunk_size;
+        return ( char* )chunk;
+    }
+    m_locks[ cls ].unlock();
+
+    /* 空闲链表为空，申请一个新的 slab，第一个块直接返回给调用者，其余的块切分后放入空闲链表 */
+    char* memory = map_slab();
+    if ( !memory )
+    {
+        return NULL;
+    }
+    m_slab_lock.lock();
+    m_slabs.push_back( memory );
+    m_slab_lock.unlock();
+
+    char* first = memory;
+    char* end = memory + SLAB_SIZE;
+    free_chunk* head = NULL;
+    free_chunk* tail = NULL;
+    size_t count = 0;
+    for ( char* p = first + chunk_size; p + chunk_size <= end; p += chunk_size )
+    {
+        free_chunk* c = ( free_chunk* )p;
+        c->next = head;
+        head = c;
+        if ( !tail )
+            tail = c;
+        ++count;
+    }
+    if ( head )
+    {
+        m_locks[ cls ].lock();
+        tail->next = m_free[ cls ];
+        m_free[ cls ] = head;
+        m_free_count[ cls ] += count;
+        m_locks[ cls ].unlock();
+    }
+
+    *capacity = chunk_size;
+    return first;
+}
+
+void buffer_pool::release( char* chunk, size_t capacity )
+{
+    int cls = size_class( capacity );
+    free_chunk* c = ( free_chunk* )chunk;
+    m_locks[ cls ].lock();
+    c->next = m_free[ cls ];
+    m_free[ cls ] = c;
+    ++m_free_count[ cls ];
+    m_locks[ cls ].unlock();
+}
+
+/* 数出空闲链表中每个 slab 的空闲块数，块数等于整个 slab 的块数说明这个 slab 没有块在使用。
+保留 keep_bytes 之后多出来的空闲 slab 从链表中摘出，放入 idle。调用者持有这一级的锁 */
+size_t buffer_pool::trim_class( int cls, size_t keep_bytes, std::vector< char* >& idle )
+{
+    size_t chunk_size = ( size_t )1 << ( cls + MIN_CHUNK_SHIFT );
+    size_t per_slab = SLAB_SIZE / chunk_size;
+    size_t free_bytes = m_free_count[ cls ] * chunk_size;
+    if ( free_bytes < keep_bytes + SLAB_SIZE )
+    {
+        return 0;
+    }
+
+    std::unordered_map< uintptr_t, size_t > counts;
+    for ( free_chunk* c = m_free[ cls ]; c; c = c->next )
+    {
+        ++counts[ ( uintptr_t )c & ~( uintptr_t )( SLAB_SIZE - 1 ) ];
+    }
+    std::unordered_set< uintptr_t > released;
+    for ( std::unordered_map< uintptr_t, size_t >::iterator it = counts.begin();
+        ( it != counts.end() ) && ( free_bytes >= keep_bytes + SLAB_SIZE ); ++it )
+    {
+        if ( it->second == per_slab )
+        {
+            released.insert( it->first );
+            free_bytes -= SLAB_SIZE;
+        }
+    }
+    if ( released.empty() )
+    {
+        return 0;
+    }
+
+    free_chunk** link = &m_free[ cls ];
+    while ( *link )
+    {
+        if ( released.count( ( uintptr_t )*link & ~( uintptr_t )( SLAB_SIZE - 1 ) ) )
+        {
+            *link = ( *link )->next;
+        }
+        else
+        {
+            link = &( *link )->next;
+        }
+    }
+    m_free_count[ cls ] -= released.size() * per_slab;
+    for ( std::unordered_set< uintptr_t >::iterator it = released.begin(); it != released.end(); ++it )
+    {
+        idle.push_back( ( char* )*it );
+    }
+    return released.size() * SLAB_SIZE;
+}
+
+bool buffer_pool::slab_in::operator()( char* slab ) const
+{
+    return std::binary_search( idle.begin(), idle.end(), slab );
+}
+
+size_t buffer_pool::trim( size_t keep_bytes )
+{
+    std::vector< char* > idle;
+    size_t bytes = 0;
+    for ( int cls = 0; cls < CLASS_COUNT; ++cls )
+    {
+        m_locks[ cls ].lock();
+        bytes += trim_class( cls, keep_bytes, idle );
+        m_locks[ cls ].unlock();
+    }
+    if ( idle.empty() )
+    {
+        return 0;
+    }
+
+    /* 已经不在任何空闲链表中，也没有块在使用，可以在锁外解除映射 */
+    std::sort( idle.begin(), idle.end() );
+    m_slab_lock.lock();
+    std::vector< char* >::iterator end = std::remove_if( m_slabs.begin(), m_slabs.end(), slab_in( idle ) );
+    m_slabs.erase( end, m_slabs.end() );
+    m_slab_lock.unlock();
+    for ( size_t i = 0; i < idle.size(); ++i )
+    {
+        munmap( idle[i], SLAB_SIZE );
+    }
+    return bytes;
+}
@@ -0,0 +1,66 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "14-2_locker.h"
+
+
+/* 按 2 的幂分级的内存块池，为连接的读写缓冲按需提供内存。每一级维护一个空闲链表，
+链表为空时一次从系统申请一整个 slab 再切分，归还的块留在池中供其他连接复用。
+连接数回落之后，空闲块全部归还了的 slab 由 trim 交还给系统，否则池子会一直停留在历史最高的占用上。
+指定了 NUMA 节点时 slab 在第一次访问之前就绑定到这个节点，之后不论哪个线程先写入，物理页都分配在这个节点上 */
+class buffer_pool
+{
+public:
+    /* 最小的块为 256 字节，最大的块为 64KB */
+    static const int MIN_CHUNK_SHIFT = 8;
+    static const int MAX_CHUNK_SHIFT = 16;
+    static const size_t MAX_CHUNK_SIZE = ( size_t )1 << MAX_CHUNK_SHIFT;
+    /* 每次向系统申请的 slab 大小，slab 按这个大小对齐，块所在的 slab 由地址直接算出 */
+    static const size_t SLAB_SIZE = 64 * 1024;
+
+public:
+    /* node 为 -1 时不指定节点，物理页按首次访问分配 */
+    explicit buffer_pool( int node = -1 );
+    ~buffer_pool();
+
+    /* 申请至少 size 字节的块，实际大小通过 capacity 返回；size 超过 MAX_CHUNK_SIZE 时返回 NULL */
+    char* acquire( size_t size, size_t* capacity );
+    /* 归还 acquire 得到的块，capacity 必须是 acquire 返回的实际大小 */
+    void release( char* chunk, size_t capacity );
+    /* 把所有块都空闲的 slab 交还给系统，每一级最多保留 keep_bytes 字节的空闲块以应付下一次突发。
+    需要遍历空闲链表，期间阻塞这一级的 acquire/release，应当周期性地、低频地调用。返回交还的字节数 */
+    size_t trim( size_t keep_bytes );
+
+private:
+    static int size_class( size_t size );
+    char* map_slab();
+    size_t trim_class( int cls, size_t keep_bytes, std::vector< char* >& idle );
+
+    /* remove_if 的谓词：slab 是否在排好序的 idle 中 */
+    struct slab_in
+    {
+        const std::vector< char* >& idle;
+        explicit slab_in( const std::vector< char* >& sorted ): idle( sorted ) {}
+        bool operator()( char* slab ) const;
+    };
+
+private:
+    static const int CLASS_COUNT = MAX_CHUNK_SHIFT - MIN_CHUNK_SHIFT + 1;
+
+    /* 空闲块的链表节点就放在空闲块本身的开头 */
+    struct free_chunk
+    {
+        free_chunk* next;
+    };
+    free_chunk* m_free[ CLASS_COUNT ];
+    size_t m_free_count[ CLASS_COUNT ];  // 每一级空闲链表的长度，由这一级的锁保护
+    locker m_locks[ CLASS_COUNT ];
+    int m_node;
+    std::vector< char* > m_slabs;  // 仍然映射着的 slab，析构时统一释放
+    locker m_slab_lock;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef CHASE_LEV_DEQUE_H
+#define CHASE_LEV_DEQUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+
+
+/* 固定容量的 Chase-Lev 工作窃取双端队列，元素是 T 类型的指针（内存序按 Lê 等人的 C11 版本）。
+只有所有者线程在底部 push/take，按后进先出取任务，刚放入的任务在缓存中还是热的；
+其他线程从顶部 steal，按先进先出取走最早的任务。所有者和窃取者只在只剩最后一个元素时才用 CAS 竞争 */
+template< typename T >
+class chase_lev_deque
+{
+public:
+    static const size_t CACHE_LINE = 64;
+
+public:
+    /* 容量向上取整到 2 的幂 */
+    explicit chase_lev_deque( size_t capacity )
+    {
+        m_capacity = 2;
+        while ( m_capacity < capacity )
+        {
+            m_capacity <<= 1;
+        }
+        m_mask = m_capacity - 1;
+        m_buffer = new std::atomic< T* >[ m_capacity ];
+        if ( !m_buffer )
+        {
+            throw std::exception();
+        }
+        for ( size_t i = 0; i < m_capacity; ++i )
+        {
+            m_buffer[i].store( NULL, std::memory_order_relaxed );
+        }
+        m_top.store( 0, std::memory_order_relaxed );
+        m_bottom.store( 0, std::memory_order_relaxed );
+    }
+
+    ~chase_lev_deque()
+    {
+        delete []m_buffer;
+    }
+
+    /* 只能由所有者调用，队列已满时返回 false */
+    bool push( T* data )
+    {
+        long b = m_bottom.load( std::memory_order_relaxed );
+        long t = m_top.load( std::memory_order_acquire );
+        if ( b - t >= ( long )m_capacity )
+        {
+            return false;
+        }
+        m_buffer[ b & m_mask ].store( data, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        m_bottom.store( b + 1, std::memory_order_relaxed );
+        return true;
+    }
+
+    /* 只能由所有者调用，从底部取出最近放入的元素，队列为空时返回 NULL */
+    T* take()
+    {
+        long b = m_bottom.load( std::memory_order_relaxed ) - 1;
+        m_bottom.store( b, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        long t = m_top.load( std::memory_order_relaxed );
+        if ( t > b )
+        {
+            /* 队列本来就是空的 */
+            m_bottom.store( b + 1, std::memory_order_relaxed );
+            return NULL;
+        }
+        T* data = m_buffer[ b & m_mask ].load( std::memory_order_relaxed );
+        if ( t == b )
+        {
+            /* 最后一个元素，和窃取者竞争 */
+            if ( !m_top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+            {
+                data = NULL;
+            }
+            m_bottom.store( b + 1, std::memory_order_relaxed );
+        }
+        return data;
+    }
+
+    /* 任何线程都可以调用，从顶部取出最早放入的元素。队列为空或者竞争失败时返回 NULL，
+    竞争失败时 *lost 被置为 true，调用者可以稍后重试 */
+    T* steal( bool* lost )
+    {
+        long t = m_top.load( std::memory_order_acquire );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        long b = m_bottom.load( std::memory_order_acquire );
+        if ( t >= b )
+        {
+            return NULL;
+        }
+        T* data = m_buffer[ t & m_mask ].load( std::memory_order_relaxed );
+        if ( !m_top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+        {
+            *lost = true;
+            return NULL;
+        }
+        return data;
+    }
+
+    /* 元素个数，并发修改时只是一个近似值 */
+    size_t size() const
+    {
+        long b = m_bottom.load( std::memory_order_relaxed );
+        long t = m_top.load( std::memory_order_relaxed );
+        return ( b > t ) ? ( size_t )( b - t ) : 0;
+    }
+
+private:
+    chase_lev_deque( const chase_lev_deque& );
+    chase_lev_deque& operator=( const chase_lev_deque& );
+
+private:
+    /* 窃取者修改 m_top，所有者修改 m_bottom，两者放在不同的缓存行中 */
+    std::atomic< long > m_top;
+    char m_pad0[ CACHE_LINE - sizeof( std::atomic< long > ) ];
+    std::atomic< long > m_bottom;
+    char m_pad1[ CACHE_LINE - sizeof( std::atomic< long > ) ];
+    std::atomic< T* >* m_buffer;
+    size_t m_capacity;
+    size_t m_mask;
+};
+
+#endif
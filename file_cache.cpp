@@ -0,0 +1,93 @@
+#include "file_cache.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "http_response.h"
+
+
+void file_cache_policy::destroy( file_cache_entry* entry )
+{
+    munmap( entry->address, entry->st.st_size );
+    delete entry;
+}
+
+file_cache::file_cache( size_t max_bytes, size_t max_file_size, int revalidate_interval ):
+    m_max_file_size( max_file_size ), m_revalidate_interval( revalidate_interval ), m_entries( max_bytes )
+{
+}
+
+/* 超过校验间隔时重新 stat 一次，文件被替换、修改或者权限变化都视为失效 */
+bool file_cache::is_fresh( file_cache_entry* entry, time_t now )
+{
+    if ( now - entry->checked < m_revalidate_interval )
+    {
+        return true;
+    }
+
+    struct stat st;
+    if ( stat( entry->path.c_str(), &st ) < 0 )
+    {
+        return false;
+    }
+    if ( ( st.st_ino != entry->st.st_ino ) || ( st.st_dev != entry->st.st_dev )
+        || ( st.st_size != entry->st.st_size ) || ( st.st_mtime != entry->st.st_mtime )
+        || ( st.st_mode != entry->st.st_mode ) )
+    {
+        return false;
+    }
+    entry->checked = now;
+    return true;
+}
+
+file_cache_entry* file_cache::lookup( const char* path )
+{
+    fresh_check check = { this, time( NULL ) };
+    return m_entries.lookup( path, check );
+}
+
+file_cache_entry* file_cache::insert( const char* path, const struct stat& st )
+{
+    if ( ( st.st_size <= 0 ) || ( ( size_t )st.st_size > m_max_file_size ) || ( ( size_t )st.st_size > m_entries.max_bytes() ) )
+    {
+        return NULL;
+    }
+
+    int fd = open( path, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return NULL;
+    }
+    /* 以 fstat 的结果为准，避免 stat 与 open 之间文件被替换导致映射和元数据不一致 */
+    struct stat cur;
+    if ( ( fstat( fd, &cur ) < 0 ) || ( cur.st_size != st.st_size ) )
+    {
+        close( fd );
+        return NULL;
+    }
+    /* MAP_POPULATE 预先建立页表，之后的命中不会再产生缺页 */
+    char* address = ( char* )mmap( 0, cur.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
+    close( fd );
+    if ( address == MAP_FAILED )
+    {
+        return NULL;
+    }
+
+    file_cache_entry* entry = new file_cache_entry;
+    entry->path = path;
+    entry->address = address;
+    entry->st = cur;
+    /* 头部只依赖文件的状态，在插入时渲染一次，之后每次命中只需要填入当前时间 */
+    char header[ 512 ];
+    int header_len = render_file_header( header, sizeof( header ), cur, ENCODING_IDENTITY, compressible_type( path ) );
+    if ( header_len > 0 )
+    {
+        entry->header.assign( header, header_len );
+    }
+    entry->checked = time( NULL );
+    return m_entries.insert( entry );
+}
+
+void file_cache::release( file_cache_entry* entry )
+{
+    m_entries.release( entry );
+}
@@ -0,0 +1,66 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+
+#include "lru_cache.h"
+
+
+/* 缓存中的一个文件。文件内容已经 mmap 到 address 处，多个连接通过引用计数共享同一个映射 */
+struct file_cache_entry
+{
+    std::string path;        // 文件的完整路径，也是缓存的键
+    char* address;           // 文件被 mmap 到内存中的起始位置
+    struct stat st;          // 插入或上次校验时文件的状态
+    std::string header;      // 预先渲染好的 200 应答头部，Date 字段留空
+    time_t checked;          // 上次用 stat 校验的时间
+    int refcount;            // 正在使用该映射的连接数，外加缓存自身持有的一个引用
+    bool linked;             // 是否仍在哈希表和 LRU 链表中
+    file_cache_entry* prev;  // LRU 链表，表头是最近使用的
+    file_cache_entry* next;
+};
+
+/* lru_cache 的策略：以路径为键，按文件大小计入预算，最后一个引用释放时 munmap */
+struct file_cache_policy
+{
+    static const std::string& key( const file_cache_entry* entry ) { return entry->path; }
+    static size_t bytes( const file_cache_entry* entry ) { return entry->st.st_size; }
+    static void destroy( file_cache_entry* entry );
+};
+
+
+/* 进程内共享的热点文件缓存。以 m_real_file 为键，按字节预算做 LRU 淘汰，
+命中时不需要任何系统调用，只在超过校验间隔后用一次 stat 比较 inode/mtime/size */
+class file_cache
+{
+public:
+    file_cache( size_t max_bytes = 64 * 1024 * 1024, size_t max_file_size = 1024 * 1024, int revalidate_interval = 1 );
+
+    /* 查找 path 对应的缓存项，命中则增加引用计数后返回，否则返回 NULL */
+    file_cache_entry* lookup( const char* path );
+    /* 把一个已经通过 stat 检查的文件映射并放入缓存，返回带引用的缓存项；文件不适合缓存时返回 NULL */
+    file_cache_entry* insert( const char* path, const struct stat& st );
+    /* 释放 lookup/insert 得到的引用，最后一个引用释放时才 munmap */
+    void release( file_cache_entry* entry );
+
+private:
+    bool is_fresh( file_cache_entry* entry, time_t now );
+
+    /* lookup 在锁内对命中的项调用的校验 */
+    struct fresh_check
+    {
+        file_cache* cache;
+        time_t now;
+        bool operator()( file_cache_entry* entry ) { return cache->is_fresh( entry, now ); }
+    };
+
+private:
+    size_t m_max_file_size;    // 超过该大小的文件不进入缓存
+    int m_revalidate_interval; // 两次 stat 校验之间的最小间隔，单位为秒
+    lru_cache< file_cache_entry, file_cache_policy > m_entries;  // 按映射的总字节数做 LRU 淘汰
+};
+
+#endif
@@ -1,8 +1,13 @@
 #include "http_conn.h"
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <limits.h>
+#include "http_scan.h"
+#include "http_response.h"
 
 /* 定义 HTTP 相应的一些状态信息 */
 const char* ok_200_title = "OK";
+const char* no_content_204_title = "No Content";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
@@ -11,11 +16,88 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* not_modified_304_title = "Not Modified";
+const char* partial_206_title = "Partial Content";
+const char* error_416_title = "Range Not Satisfiable";
+const char* error_416_form = "None of the requested ranges can be satisfied by the requested file.\n";
+const char* ok_200_form = "<html><body></body></html>";
+const char* error_503_title = "Service Unavailable";
+const char* error_503_form = "The server is temporarily overloaded, please retry later.\n";
 
 /* 网站的根目录 */
 const char* doc_root = "/var/www/html";
 
-int setnonblocking( itn fd )
+/* 解析 If-Modified-Since/If-Range 中的 HTTP-date，只接受 RFC 7231 推荐的 IMF-fixdate 格式 */
+static bool parse_http_date( const str_view* value, time_t* t )
+{
+    char buf[ 64 ];
+    if ( value->len >= ( int )sizeof( buf ) )
+    {
+        return false;
+    }
+    memcpy( buf, value->data, value->len );
+    buf[ value->len ] = '\0';
+    struct tm tm;
+    memset( &tm, 0, sizeof( tm ) );
+    const char* end = strptime( buf, "%a, %d %b %Y %H:%M:%S GMT", &tm );
+    if ( !end || ( *end != '\0' ) )
+    {
+        return false;
+    }
+    *t = timegm( &tm );
+    return true;
+}
+
+/* If-None-Match 的字段值是 "*" 或者逗号分隔的 ETag 列表，按弱比较（忽略 W/ 前缀）查找 etag */
+static bool etag_list_matches( const str_view* value, const char* etag, int etag_len )
+{
+    const char* p = value->data;
+    const char* end = value->data + value->len;
+    while ( p < end )
+    {
+        while ( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) || ( *p == ',' ) ) )
+            ++p;
+        const char* item = p;
+        while ( ( p < end ) && ( *p != ',' ) )
+            ++p;
+        const char* item_end = p;
+        while ( ( item_end > item ) && ( ( item_end[-1] == ' ' ) || ( item_end[-1] == '\t' ) ) )
+            --item_end;
+        if ( ( item_end - item == 1 ) && ( *item == '*' ) )
+        {
+            return true;
+        }
+        if ( ( item_end - item > 2 ) && ( item[0] == 'W' ) && ( item[1] == '/' ) )
+        {
+            item += 2;
+        }
+        if ( ( item_end - item == etag_len ) && ( memcmp( item, etag, etag_len ) == 0 ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 从 p 开始解析一个非负十进制数，p 随之后移。没有数字或者溢出时返回 false */
+static bool parse_offset( const char*& p, const char* end, off_t* value )
+{
+    const char* begin = p;
+    off_t v = 0;
+    while ( ( p < end ) && ( *p >= '0' ) && ( *p <= '9' ) )
+    {
+        if ( v > ( ( off_t )0x7fffffffffffffffLL - 9 ) / 10 )
+        {
+            return false;
+        }
+        v = v * 10 + ( *p - '0' );
+        ++p;
+    }
+    *value = v;
+    return p > begin;
+}
+
+int setnonblocking( int fd )
 {
     int old_operation = fcntl( fd, F_GETFL );
     int new_operation = old_operation | O_NONBLOCK;
@@ -23,15 +105,18 @@ int setnonblocking( itn fd )
     return old_operation;
 }
 
-void addfd( int epollfd, int fd ,bool one_shot )
+/* set_nonblocking 为 false 时调用者保证 fd 已经是非阻塞的（例如由 accept4 的 SOCK_NONBLOCK 得到），省去两次 fcntl */
+void addfd( int epollfd, int fd ,bool one_shot, bool set_nonblocking )
 {
     epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLIN | EPOLLET | EPOLLRDHUP; // EPOLLRDHUP 在2.6.17 以后的内核版本中才有
     if ( one_shot )
         event.events |= EPOLLONESHOT;
+    /* 先设置非阻塞再注册：注册之后事件可能马上在另一个 reactor 线程上触发，那时读写就必须是非阻塞的 */
+    if ( set_nonblocking )
+        setnonblocking( fd );
     epoll_ctl( epollfd, EPOLL_CTL_ADD, fd ,&event );
-    setnonblocking( fd );
 }
 
 void removefd( int epollfd, int fd )
@@ -40,7 +125,7 @@ void removefd( int epollfd, int fd )
     close( fd ); // 负责关闭文件描述符，并从内核事件表中移除该 fd 
 }
 
-boid modfd( int epollfd, int fd, int ev )
+void modfd( int epollfd, int fd, int ev )
 {
     epoll_event event;
     event.data.fd = fd;
@@ -48,34 +133,234 @@ boid modfd( int epollfd, int fd, int ev )
     epoll_ctl( epollfd, EPOLL_CTL_MOD, fd, &event );
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic< int > http_conn::m_user_count( 0 );
+std::atomic< int > http_conn::m_in_flight_count( 0 );
+http_conn::body_handler http_conn::m_body_handler = NULL;
+file_cache* http_conn::m_file_cache = NULL;
+variant_cache* http_conn::m_variant_cache = NULL;
+buffer_pool* http_conn::m_buffer_pool = NULL;
+std::vector< std::string > http_conn::m_interactive_paths;
+http_conn::static_response http_conn::m_static_responses[ CLOSED_CONNECTION ][ 2 ];
+http_conn::static_response http_conn::m_unavailable_response;
+
+/* 把错误页面和空文件的应答按 close/keep-alive 两种连接方式各渲染一份，之后发送时只需要拷贝并填入当前时间 */
+void http_conn::init_static_responses()
+{
+    struct
+    {
+        HTTP_CODE code;
+        int status;
+        const char* title;
+        const char* form;
+    } fixed[] = {
+        { BAD_REQUEST, 400, error_400_title, error_400_form },
+        { FORBIDEDEN_REQUEST, 403, error_403_title, error_403_form },
+        { NO_RESOURCE, 404, error_404_title, error_404_form },
+        { INTERNAL_ERROR, 500, error_500_title, error_500_form },
+        { FILE_REQUEST, 200, ok_200_title, ok_200_form }
+    };
+    for ( unsigned i = 0; i < sizeof( fixed ) / sizeof( fixed[0] ); ++i )
+    {
+        for ( int linger = 0; linger < 2; ++linger )
+        {
+            char buf[ 512 ];
+            int date_offset = snprintf( buf, sizeof( buf ), "HTTP/1.1 %d %s\r\nDate: ", fixed[i].status, fixed[i].title );
+            int header_len = snprintf( buf + date_offset, sizeof( buf ) - date_offset, "%*s\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n",
+                HTTP_DATE_LEN, "", ( int )strlen( fixed[i].form ), linger ? "keep-alive" : "close" ) + date_offset;
+            static_response& r = m_static_responses[ fixed[i].code ][ linger ];
+            r.data.assign( buf, header_len );
+            r.data += fixed[i].form;
+            r.header_len = header_len;
+            r.date_offset = date_offset;
+        }
+    }
+
+    /* 503 在 reactor 线程中直接发送，不经过写缓冲，所以连同 Date 在内整个应答都预先编码好 */
+    char buf[ 512 ];
+    int date_offset = snprintf( buf, sizeof( buf ), "HTTP/1.1 503 %s\r\nDate: ", error_503_title );
+    int header_len = snprintf( buf + date_offset, sizeof( buf ) - date_offset,
+        "%*s\r\nRetry-After: 1\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+        HTTP_DATE_LEN, "", ( int )strlen( error_503_form ) ) + date_offset;
+    m_unavailable_response.data.assign( buf, header_len );
+    m_unavailable_response.data += error_503_form;
+    m_unavailable_response.header_len = header_len;
+    m_unavailable_response.date_offset = date_offset;
+}
+
+/* 应答很短，一次非阻塞 send 就能放进新连接空荡的发送缓冲；发送失败也无所谓，调用者接着就会关闭连接 */
+void http_conn::send_unavailable( int sockfd )
+{
+    const static_response& r = m_unavailable_response;
+    char buf[ 512 ];
+    int len = ( int )r.data.size();
+    if ( len > ( int )sizeof( buf ) )
+    {
+        return;
+    }
+    memcpy( buf, r.data.data(), len );
+    http_date( buf + r.date_offset );
+    send( sockfd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL );
+}
+
+void http_conn::begin_request()
+{
+    if ( !m_in_flight )
+    {
+        m_in_flight = true;
+        m_in_flight_count++;
+    }
+}
+
+/* 必须在重新注册 EPOLLIN 之前调用：注册之后连接可能马上被 reactor 再次交给线程池 */
+void http_conn::end_request()
+{
+    if ( m_in_flight )
+    {
+        m_in_flight = false;
+        m_in_flight_count--;
+    }
+}
+
+void http_conn::shed()
+{
+    send_unavailable( m_sockfd );
+    close_conn();
+}
+
+/* 请求行还没有被解析，这里只在 m_request_start 到 m_read_idx 之间按空格切出方法和 URL，不修改缓冲。
+已经被 parse_line 处理过的行尾可能是 '\0'，同样当作行的结束 */
+int http_conn::priority() const
+{
+    if ( !m_read_buf || ( m_read_idx <= m_request_start ) )
+    {
+        return 2;
+    }
+    const char* p = m_read_buf + m_request_start;
+    const char* end = m_read_buf + m_read_idx;
+    const char* method = p;
+    while ( ( p < end ) && ( *p != ' ' ) && ( *p != '\r' ) && ( *p != '\n' ) && ( *p != '\0' ) )
+    {
+        ++p;
+    }
+    size_t method_len = p - method;
+    while ( ( p < end ) && ( *p == ' ' ) )
+    {
+        ++p;
+    }
+    const char* url = p;
+    while ( ( p < end ) && ( *p != ' ' ) && ( *p != '\r' ) && ( *p != '\n' ) && ( *p != '\0' ) )
+    {
+        ++p;
+    }
+    size_t url_len = p - url;
+    for ( size_t i = 0; i < m_interactive_paths.size(); ++i )
+    {
+        const std::string& prefix = m_interactive_paths[i];
+        if ( ( url_len >= prefix.size() ) && ( memcmp( url, prefix.data(), prefix.size() ) == 0 ) )
+        {
+            return 0;
+        }
+    }
+    bool get = ( ( method_len == 3 ) && ( strncasecmp( method, "GET", 3 ) == 0 ) )
+        || ( ( method_len == 4 ) && ( strncasecmp( method, "HEAD", 4 ) == 0 ) );
+    return ( get && m_kept_alive ) ? 1 : 2;
+}
+
+http_conn::http_conn(): m_enqueue_ns( 0 ), m_priority( 0 ), m_deadline_ns( 0 ), m_pool( NULL ), m_read_buf( NULL ), m_read_size( 0 ), m_write_buf( NULL ), m_write_size( 0 ),
+    m_real_file( NULL ), m_real_file_size( 0 )
+{
+}
+
+http_conn::~http_conn()
+{
+    release_buffers();
+}
 
 
 void http_conn::close_conn( bool real_close )
 {
     if ( real_close && ( m_sockfd != -1 ) )
     {
-        removefd( m_epollfd, m_sockfd );
+        /* 文件描述符最后才关闭：关闭之后同一个描述符可能立刻被另一个 reactor 线程 accept 到，
+        并重新初始化这个 http_conn 对象 */
+        int sockfd = m_sockfd;
         m_sockfd = -1;
+        abort_body();
+        unmap();
+        release_buffers();
+        end_request();
         m_user_count--;  /* 关闭一个连接时，将客户总量减 1 */
+        removefd( m_epollfd, sockfd );
+    }
+}
+
+void http_conn::linger_close()
+{
+    m_lingering = true;
+    begin_request();
+    release_buffers();
+    shutdown( m_sockfd, SHUT_WR );
+    modfd( m_epollfd, m_sockfd, EPOLLIN );
+}
+
+bool http_conn::discard_input()
+{
+    char buf[ 4096 ];
+    while ( true )
+    {
+        ssize_t n = recv( m_sockfd, buf, sizeof( buf ), 0 );
+        if ( n > 0 )
+        {
+            continue;
+        }
+        if ( ( n < 0 ) && ( errno == EAGAIN ) )
+        {
+            modfd( m_epollfd, m_sockfd, EPOLLIN );
+            return true;
+        }
+        return false;
     }
 }
 
-void http_conn::init( int sockfd , const sockaddr_in& addr )
+void http_conn::init( int sockfd , const sockaddr_in& addr, int epollfd, buffer_pool* pool )
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_pool = pool ? pool : m_buffer_pool;
+    m_file_address = 0;
+    m_file_entry = 0;
+    m_variant = 0;
+    m_file_fd = -1;
+    m_body_count = 0;
     /* 如下两行是为了避免 TIME_WAIT 状态，仅用于调试，实际使用时应该去掉 */
     // int reuse = 1;
     // setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-    addfd( m_epollfd, m_sockfd, true );  // EPOLLONESHOT 需要每次都重新注册，主要是为了线程安全
+    m_in_flight = false;
+    m_lingering = false;
+    m_kept_alive = false;
     m_user_count++;
-
     init();
+
+    /* 注册之后连接的事件可能马上在它所属的 reactor 线程上触发，所以先初始化完再注册 */
+    addfd( m_epollfd, m_sockfd, true, false );  // EPOLLONESHOT 需要每次都重新注册，主要是为了线程安全
 }
 
+/* 缓冲中的有效数据完全由 m_read_idx/m_checked_idx/m_write_idx 界定，解析时行尾的 '\0' 由 parse_line 自己写入，
+所以复位连接只需要重置这些下标，不需要把缓冲清零 */
 void http_conn::init()
+{
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    m_scan_colon = -1;
+    m_line_colon = -1;
+    init_request();
+    init_response();
+}
+
+/* 为下一个请求重置解析状态。读缓冲中 m_checked_idx 之后的字节属于客户端流水线发来的后续请求，必须保留 */
+void http_conn::init_request()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
@@ -85,64 +370,217 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
+    m_header_mask = 0;
+    m_chunked = false;
+    m_body_open = false;
+    m_body_left = 0;
+    m_range_count = 0;
+    m_encoding = ENCODING_IDENTITY;
+    m_vary = false;
+    m_request_start = m_checked_idx;
+}
+
+/* 一批应答发送完毕之后重置写缓冲和待发送的内存块 */
+void http_conn::init_response()
+{
     m_write_idx = 0;
-    memset( m_read_buf,' \0', READ_BUFFER_SIZE );
-    memset( m_write_buf, '\0', WRITE_BUFFER_SIZE );
-    memset( m_real_file, '\0', FILENAME_LEN );
+    m_response_linger = false;
+    reset_iovec();
+    /* 应答发完后写缓冲和文件名缓冲都已经空闲，还给内存池 */
+    release_buffer( m_write_buf, m_write_size );
+    release_buffer( m_real_file, m_real_file_size );
+}
+
+/* 从内存池中申请至少 size 字节的缓冲，原来的内容（前 used 个字节）会被复制过去 */
+bool http_conn::grow_buffer( char*& buf, size_t& capacity, size_t size, size_t used )
+{
+    size_t new_capacity = 0;
+    char* new_buf = m_pool->acquire( size, &new_capacity );
+    if ( !new_buf )
+    {
+        return false;
+    }
+    if ( buf )
+    {
+        memcpy( new_buf, buf, used );
+        m_pool->release( buf, capacity );
+    }
+    buf = new_buf;
+    capacity = new_capacity;
+    return true;
+}
+
+void http_conn::release_buffer( char*& buf, size_t& capacity )
+{
+    if ( buf )
+    {
+        m_pool->release( buf, capacity );
+        buf = NULL;
+        capacity = 0;
+    }
+}
+
+void http_conn::release_buffers()
+{
+    release_buffer( m_read_buf, m_read_size );
+    release_buffer( m_write_buf, m_write_size );
+    release_buffer( m_real_file, m_real_file_size );
+}
+
+/* 读缓冲满了时换一个两倍大小的块。请求头部超过 MAX_READ_BUFFER_SIZE 时失败 */
+bool http_conn::grow_read_buf()
+{
+    size_t size = m_read_size ? m_read_size * 2 : READ_BUFFER_SIZE;
+    if ( size > MAX_READ_BUFFER_SIZE )
+    {
+        return false;
+    }
+    char* old_buf = m_read_buf;
+    if ( !grow_buffer( m_read_buf, m_read_size, size, m_read_idx ) )
+    {
+        return false;
+    }
+    move_read_pointers( m_read_buf - old_buf );
+    return true;
+}
+
+/* 写缓冲至少要能再放下 size 字节。已经加入 m_iv 的头部指向旧的写缓冲，要随之移动 */
+bool http_conn::grow_write_buf( size_t size )
+{
+    size_t need = m_write_idx + size;
+    if ( need > MAX_WRITE_BUFFER_SIZE )
+    {
+        return false;
+    }
+    if ( m_write_buf && ( need <= m_write_size ) )
+    {
+        return true;
+    }
+    char* old_buf = m_write_buf;
+    size_t old_size = m_write_size;
+    if ( !grow_buffer( m_write_buf, m_write_size, need < WRITE_BUFFER_SIZE ? WRITE_BUFFER_SIZE : need, m_write_idx ) )
+    {
+        return false;
+    }
+    for ( int i = 0; i < m_iv_count; ++i )
+    {
+        char* base = ( char* )m_iv[i].iov_base;
+        if ( old_buf && ( base >= old_buf ) && ( base < old_buf + old_size ) )
+        {
+            m_iv[i].iov_base = m_write_buf + ( base - old_buf );
+        }
+    }
+    return true;
+}
+
+/* 读缓冲被移动之后，修正解析过程中记录下来的指向读缓冲内部的指针 */
+void http_conn::move_read_pointers( ptrdiff_t offset )
+{
+    if ( m_url )
+        m_url += offset;
+    if ( m_version )
+        m_version += offset;
+    if ( m_host )
+        m_host += offset;
+    for ( int i = 0; i < HDR_COUNT; ++i )
+    {
+        if ( m_header_mask & ( 1u << i ) )
+            m_headers[i].data += offset;
+    }
+}
+
+/* 把还没有处理完的请求（可能只解析了一半）移动到读缓冲的开头，并修正指向读缓冲内部的指针 */
+void http_conn::compact_read_buf()
+{
+    int offset = m_request_start;
+    if ( offset == 0 )
+    {
+        return;
+    }
+    memmove( m_read_buf, m_read_buf + offset, m_read_idx - offset );
+    m_read_idx -= offset;
+    m_checked_idx -= offset;
+    m_start_line -= offset;
+    m_request_start = 0;
+    if ( m_scan_colon >= 0 )
+        m_scan_colon -= offset;
+    m_line_colon = -1;
+    move_read_pointers( -offset );
 }
 
 
-/* 从状态机：其分析请参考 8-3 */
+/* 从状态机：其分析请参考 8-3。行尾由 scan_line 向量化地查找，扫描进度保存在 m_checked_idx 和 m_scan_colon 中，
+行不完整（LINE_OPEN）时下一次读到数据后从上次停下的位置继续，不会重新扫描已经看过的字节 */
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for ( ; m_checked_idx < m_read_idx; ++m_checked_idx )
+    if ( m_checked_idx >= m_read_idx )
+    {
+        return LINE_OPEN;
+    }
+
+    const char* colon = ( m_scan_colon >= 0 ) ? m_read_buf + m_scan_colon : NULL;
+    const char* end = scan_line( m_read_buf + m_checked_idx, m_read_buf + m_read_idx, &colon );
+    if ( colon )
+    {
+        m_scan_colon = colon - m_read_buf;
+    }
+    m_checked_idx = end - m_read_buf;
+    if ( m_checked_idx == m_read_idx )
+    {
+        return LINE_OPEN;
+    }
+
+    if( *end == '\r' )
     {
-        temp = m_read_buf[ m_checked_idx ];
-        if( temp == '\r' )
+        if ( ( m_checked_idx + 1 ) == m_read_idx )
         {
-            if ( ( m_checked_idx + 1 ) == m_read_idx )
-            {
-                return LINE_OPEN;
-            }
-            else if ( m_read_buf[ m_checked_idx + 1 ] == '\n' )
-            {
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            return LINE_OPEN;
         }
-        else if( temp == \'\n' )
+        else if ( m_read_buf[ m_checked_idx + 1 ] == '\n' )
         {
-            if ( (m_checked_idx > 1 ) && ( m_read_buf[m_checked_idx - 1] == '\r' ) )
-            {
-                m_read_buf[ m_checked_idx - 1] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_read_buf[ m_checked_idx++ ] = '\0';
+            m_read_buf[ m_checked_idx++ ] = '\0';
+            finish_line();
+            return LINE_OK;
         }
+        return LINE_BAD;
+    }
+
+    /* 单独的 '\n'：只有前一个字节是上次停在缓冲末尾的 '\r' 时才是合法的行尾 */
+    if ( (m_checked_idx > 1 ) && ( m_read_buf[m_checked_idx - 1] == '\r' ) )
+    {
+        m_read_buf[ m_checked_idx - 1] = '\0';
+        m_read_buf[ m_checked_idx++ ] = '\0';
+        finish_line();
+        return LINE_OK;
     }
-    return LINE_OPEN;
+    return LINE_BAD;
+}
+
+/* 一行扫描完毕，把扫描时记下的冒号位置交给头部解析，并为下一行重置扫描状态 */
+void http_conn::finish_line()
+{
+    m_line_colon = m_scan_colon;
+    m_scan_colon = -1;
 }
 
 /* 循环读取客户数据，直到无数据可读或者对方关闭连接 */
 bool http_conn::read()
 {
-    if ( m_read_idx >= READ_BUFFER_SIZE )
-    {
-        return false;
-    }
-    
     int bytes_read = 0;
+    int start_idx = m_read_idx;
     while ( true )
     {
-        bytes_read = recv( m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0 );
-        if ( bytes_read == 1 )
+        /* 读缓冲按需从内存池申请，放满了就换更大的块。到了上限时只是暂停读取：正在接收消息体时
+        parse_content 会把已有的部分交给处理函数；客户端流水线发来的请求比缓冲多时，已经收全的请求应答之后
+        会腾出空间。剩下的数据留在内核中，重新注册的 EPOLLIN 会再次触发。这次一个字节也没有读进来，
+        说明一个请求的头部就放满了缓冲 */
+        if ( ( m_read_idx >= ( int )m_read_size ) && !grow_read_buf() )
+        {
+            return ( m_check_state == CHECK_STATE_CONTENT ) || ( m_read_idx > start_idx );
+        }
+        bytes_read = recv( m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0 );
+        if ( bytes_read == -1 )
         {
             if ( errno == EAGAIN || errno == EWOULDBLOCK )
             {
@@ -174,6 +612,18 @@ http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
     {
         m_method = GET;
     }
+    else if ( strcasecmp( mtehod, "HEAD" ) == 0 )
+    {
+        m_method = HEAD;
+    }
+    else if ( strcasecmp( mtehod, "POST" ) == 0 )
+    {
+        m_method = POST;
+    }
+    else if ( strcasecmp( mtehod, "PUT" ) == 0 )
+    {
+        m_method = PUT;
+    }
     else
     {
         return BAD_REQUEST; // 其他的方法不支持 
@@ -213,110 +663,332 @@ http_conn::HTTP_CODE http_conn::parse_headers( char* text )
     /* 遇到空行，表示头部字段解析完毕 */
     if ( text[0] == '\0' )
     {
-        /* 如果 HTTP 请求有消息体，则还需要读取 m_content_length 字节的消息体，状态机转移到 check_state_content 状态 */
-        if ( m_content_length != 0 )
+        /* 如果 HTTP 请求有消息体（Content-Length 或者 chunked 编码），状态机转移到 check_state_content 状态，
+        消息体随后由 parse_content 边读边交给 m_body_handler */
+        const str_view* te = header( HDR_TRANSFER_ENCODING );
+        m_chunked = te && ( te->len >= 7 ) && ( strncasecmp( te->data + te->len - 7, "chunked", 7 ) == 0 );
+        if ( m_content_length < 0 )
+        {
+            return BAD_REQUEST;
+        }
+        if ( m_chunked || ( m_content_length != 0 ) )
         {
             m_check_state = CHECK_STATE_CONTENT;
+            m_body_start = m_checked_idx;
+            m_body_left = m_chunked ? 0 : m_content_length;
+            m_chunk_state = CHUNK_SIZE;
+            m_body_open = ( m_body_handler != NULL ) && ( ( m_method == POST ) || ( m_method == PUT ) );
+            send_continue();
             return NO_REQUEST;
         }
 
         /* 否则说明我们已经得到了一个完整的 HTTP 请求 */
         return GET_REQUSET;
     }
-    /* 处理 Connection 头部字段 */
-    else if ( strncasecmp( text, "Connection:", 11 ) == 0 )
+
+    /* 扫描行尾时已经找到了冒号，没有冒号的行不是合法的头部，忽略之 */
+    if ( m_line_colon < 0 )
     {
-        text += 11;
-        text += strspn( text, " \t" );
-        if ( strcasecmp( text, "keep-alive" ) == 0 )
-        {
-            m_linger = true;
-        } 
+        return NO_REQUEST;
     }
-    /* 处理 Content-Length 头部字段 */
-    else if( strncasecmp( text, "Content-Length:" , 15 ) == 0 )
+    int name_len = m_line_colon - ( text - m_read_buf );
+    char* value = m_read_buf + m_line_colon + 1;
+    value += strspn( value, " \t" );
+    /* parse_line 把行尾的 "\r\n" 改写成了 "\0\0"，行在 m_checked_idx - 2 处结束，再去掉字段值末尾的空白 */
+    char* value_end = m_read_buf + m_checked_idx - 2;
+    while ( ( value_end > value ) && ( ( value_end[-1] == ' ' ) || ( value_end[-1] == '\t' ) ) )
     {
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol( text );
+        --value_end;
     }
-    /* 处理 Host 头部字段 */
-    else if ( strncasecmp( text, "Host:", 5 ) == 0 )
+
+    /* 用完美哈希识别字段名，识别出的字段值以 str_view 的形式零拷贝地记录下来，供后续处理直接使用 */
+    HEADER_NAME name = header_lookup( text, name_len );
+    if ( name == HDR_UNKNOWN )
     {
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
+        return NO_REQUEST;
     }
-    else 
+    m_headers[ name ].data = value;
+    m_headers[ name ].len = value_end - value;
+    m_header_mask |= 1u << name;
+
+    switch ( name )
     {
-        printf( "opp! unknow header %s\n", text );
+        /* 处理 Connection 头部字段 */
+        case HDR_CONNECTION:
+        {
+            if ( ( m_headers[ name ].len == 10 ) && ( strncasecmp( value, "keep-alive", 10 ) == 0 ) )
+            {
+                m_linger = true;
+            } 
+            break;
+        }
+        /* 处理 Content-Length 头部字段 */
+        case HDR_CONTENT_LENGTH:
+        {
+            /* 只接受一串十进制数字。格式错误或者溢出时记为 -1，头部结束时以 BAD_REQUEST 拒绝，
+            否则消息体的边界算错，后面流水线中的请求都会错位 */
+            char* end = NULL;
+            long long length = -1;
+            if ( ( value < value_end ) && ( *value >= '0' ) && ( *value <= '9' ) )
+            {
+                errno = 0;
+                length = strtoll( value, &end, 10 );
+                if ( ( end != value_end ) || ( errno == ERANGE ) || ( length > LONG_MAX ) )
+                {
+                    length = -1;
+                }
+            }
+            m_content_length = ( long )length;
+            break;
+        }
+        /* 处理 Host 头部字段 */
+        case HDR_HOST:
+        {
+            m_host = value;
+            break;
+        }
+        default:
+            break;
     }
 
     return NO_REQUEST;
 }
 
 
-/* 我们没有真正解析 HTTP 请求的消息体，只是判断它是否被完整地写入了 */
-http_conn::HTTP_CODE http_conn::parse_content( char* text )
+/* 客户端发送了 "Expect: 100-continue" 时，先回复 100 Continue，它才会开始发送消息体。发送缓冲满了就不再等待，
+客户端在超时之后也会自行发送消息体 */
+void http_conn::send_continue()
 {
-    if ( m_read_idx >= ( m_content_length + m_checked_idx ) )
+    const str_view* expect = header( HDR_EXPECT );
+    if ( expect && ( expect->len == 12 ) && ( strncasecmp( expect->data, "100-continue", 12 ) == 0 ) )
     {
-        text[ m_content_length ] = '\0';
-        return GET_REQUSET;
+        static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send( m_sockfd, continue_line, sizeof( continue_line ) - 1, MSG_DONTWAIT );
     }
-    return NO_REQUEST; 
 }
 
-/* 主状态机 */
-http_conn::HTTP_CODE http_conn::process_read() {
-    LINE_STATUS line_status = LINE_OK;
-    HTTP_CODE ret = NO_REQUEST;
-    char* text = 0;
-    
-    while( ( ( m_check_state == CHECK_STATE_CONTENT) && ( line_status == LINE_OK) ) ||
-        ( ( line_status == parse_line() ) == LINE_OK ) )
+/* 把一段已经解码的消息体交给处理函数。只有 POST/PUT 且设置了 m_body_handler 时才会交付，其他情况直接丢弃 */
+bool http_conn::feed_body( const char* data, int len )
+{
+    if ( !m_body_open || ( len == 0 ) )
     {
-        text = get_line();  // 从自己包装好的函数里读取请求里的行
-        m_start_line = m_checked_idx;
-        printf( "got 1 http line: %s\n", text );
+        return true;
+    }
+    return m_body_handler( this, BODY_DATA, data, len );
+}
 
-        switch ( m_check_state )
+/* 已经交给处理函数的消息体不再需要保留，把它从读缓冲中移除，这样无论消息体有多大，读缓冲中都只有请求头部和
+最近一次读到的数据。m_start_line 之后是尚未解析完的 chunk 行，必须保留 */
+void http_conn::discard_body()
+{
+    int offset = m_start_line - m_body_start;
+    if ( offset <= 0 )
+    {
+        return;
+    }
+    memmove( m_read_buf + m_body_start, m_read_buf + m_start_line, m_read_idx - m_start_line );
+    m_read_idx -= offset;
+    m_checked_idx -= offset;
+    m_start_line -= offset;
+    if ( m_scan_colon >= 0 )
+        m_scan_colon -= offset;
+}
+
+/* 流式地消费消息体：每次只处理读缓冲中已有的部分，交给处理函数后立即丢弃，消息体不需要整个放进读缓冲。
+消息体结束时返回 GET_REQUSET，还需要更多数据时返回 NO_REQUEST */
+http_conn::HTTP_CODE http_conn::parse_content()
+{
+    HTTP_CODE ret = m_chunked ? parse_chunked() : parse_identity();
+    if ( ret == NO_REQUEST )
+    {
+        discard_body();
+    }
+    else if ( ret != GET_REQUSET )
+    {
+        /* 消息体中剩余的字节已经无法可靠地跳过，应答后关闭连接 */
+        m_linger = false;
+    }
+    return ret;
+}
+
+/* 由 Content-Length 指定长度的消息体 */
+http_conn::HTTP_CODE http_conn::parse_identity()
+{
+    int len = m_read_idx - m_checked_idx;
+    if ( len > m_body_left )
+    {
+        len = m_body_left;  // 消息体之后可能紧跟着流水线中的下一个请求
+    }
+    if ( !feed_body( m_read_buf + m_checked_idx, len ) )
+    {
+        return INTERNAL_ERROR;
+    }
+    m_checked_idx += len;
+    m_start_line = m_checked_idx;
+    m_body_left -= len;
+    return ( m_body_left == 0 ) ? GET_REQUSET : NO_REQUEST;
+}
+
+/* chunked 编码的消息体：依次解析 chunk 大小行、chunk 数据及其后的 CRLF，直到大小为 0 的 chunk 和 trailer 结束。
+chunk 行和 trailer 行复用 parse_line，行不完整时状态保存在 m_chunk_state 中，下次从断点继续 */
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    while ( true )
+    {
+        switch ( m_chunk_state )
         {
-            case: CHECK_STATE_REQUESTLINE:
+            case CHUNK_SIZE:
             {
-                ret = parse_request_line( text );
-                if ( ret == BAD_REQUEST )
+                LINE_STATUS status = parse_line();
+                if ( status != LINE_OK )
                 {
-                    return BAD_REQUEST;
+                    return ( status == LINE_OPEN ) ? NO_REQUEST : BAD_REQUEST;
                 }
+                char* line = get_line();
+                m_start_line = m_checked_idx;
+                char* end = 0;
+                long long size = strtoll( line, &end, 16 );
+                /* chunk 大小之后只允许出现空白或者以 ';' 开头的扩展 */
+                if ( ( end == line ) || ( size < 0 ) || ( ( *end != '\0' ) && ( *end != ';' ) && ( *end != ' ' ) && ( *end != '\t' ) ) )
+                {
+                    return BAD_REQUEST;
+                }
+                m_body_left = size;
+                m_chunk_state = ( size == 0 ) ? CHUNK_TRAILER : CHUNK_DATA;
                 break;
             }
-            case: CHECK_STATE_HEADER:
+            case CHUNK_DATA:
             {
-                ret = parse_headers( text );
-                if ( ret == BAD_REQUEST )
+                int len = m_read_idx - m_checked_idx;
+                if ( len > m_body_left )
+                {
+                    len = m_body_left;
+                }
+                if ( !feed_body( m_read_buf + m_checked_idx, len ) )
+                {
+                    return INTERNAL_ERROR;
+                }
+                m_checked_idx += len;
+                m_start_line = m_checked_idx;
+                m_body_left -= len;
+                if ( m_body_left > 0 )
+                {
+                    return NO_REQUEST;
+                }
+                m_chunk_state = CHUNK_DATA_END;
+                break;
+            }
+            case CHUNK_DATA_END:
+            {
+                LINE_STATUS status = parse_line();
+                if ( status != LINE_OK )
+                {
+                    return ( status == LINE_OPEN ) ? NO_REQUEST : BAD_REQUEST;
+                }
+                /* chunk 数据之后必须紧跟 CRLF */
+                if ( get_line()[0] != '\0' )
                 {
                     return BAD_REQUEST;
                 }
-                else if ( ret == GET_REQUSET )
+                m_start_line = m_checked_idx;
+                m_chunk_state = CHUNK_SIZE;
+                break;
+            }
+            case CHUNK_TRAILER:
+            {
+                LINE_STATUS status = parse_line();
+                if ( status != LINE_OK )
                 {
-                    return do_request(); // 发现是 get 请求的话，直接执行请求了
+                    return ( status == LINE_OPEN ) ? NO_REQUEST : BAD_REQUEST;
+                }
+                char* line = get_line();
+                m_start_line = m_checked_idx;
+                /* trailer 中的头部字段被忽略，遇到空行时消息体结束 */
+                if ( line[0] == '\0' )
+                {
+                    return GET_REQUSET;
+                }
+                break;
+            }
+            default:
+            {
+                return INTERNAL_ERROR;
+            }
+        }
+    }
+}
+
+/* 通知处理函数消息体已经完整结束 */
+bool http_conn::end_body()
+{
+    if ( !m_body_open )
+    {
+        return true;
+    }
+    m_body_open = false;
+    return m_body_handler( this, BODY_END, NULL, 0 );
+}
+
+/* 连接在消息体传输过程中断开，通知处理函数放弃已经收到的部分 */
+void http_conn::abort_body()
+{
+    if ( m_body_open )
+    {
+        m_body_open = false;
+        m_body_handler( this, BODY_ABORT, NULL, 0 );
+    }
+}
+
+/* 主状态机 */
+http_conn::HTTP_CODE http_conn::process_read() {
+    LINE_STATUS line_status = LINE_OK;
+    HTTP_CODE ret = NO_REQUEST;
+    char* text = 0;
+    
+    while( ( ( m_check_state == CHECK_STATE_CONTENT) && ( line_status == LINE_OK) ) ||
+        ( ( line_status = parse_line() ) == LINE_OK ) )
+    {
+        /* 消息体由 parse_content 自己按行或者按长度切分，不经过下面的逐行处理 */
+        if ( m_check_state == CHECK_STATE_CONTENT )
+        {
+            ret = parse_content();
+            if ( ret == GET_REQUSET )
+            {
+                return do_request();
+            }
+            return ret;
+        }
+
+        text = get_line();  // 从自己包装好的函数里读取请求里的行
+        m_start_line = m_checked_idx;
+
+        switch ( m_check_state )
+        {
+            case CHECK_STATE_REQUESTLINE:
+            {
+                ret = parse_request_line( text );
+                if ( ret == BAD_REQUEST )
+                {
+                    return BAD_REQUEST;
                 }
                 break;
             }
-            case CHECK_STATE_CONTENT:
+            case CHECK_STATE_HEADER:
             {
-                ret = parse_content( text );
-                if ( ret == GET_REQUSET )
+                ret = parse_headers( text );
+                if ( ret == BAD_REQUEST )
                 {
-                    return do_request();
+                    return BAD_REQUEST;
+                }
+                else if ( ret == GET_REQUSET )
+                {
+                    return do_request(); // 发现是 get 请求的话，直接执行请求了
                 }
-                line_status = LINE_OPEN;
                 break;
             }
             default:
                 {
-                    return INTERNAL_ERRNR;
+                    return INTERNAL_ERROR;
                     break;
                 }
         }
@@ -326,12 +998,114 @@ http_conn::HTTP_CODE http_conn::process_read() {
 }
 
 /* 当得到一个完整、正确的 HTTP 请求时，我们就分析目标文件的属性。如果目标文件存在、对所有用户可读，且不是目录，则使用 mmap 将其映到
-地址 m_file_addrsess 处，并告诉调用者获取文件成功 */
+地址 m_file_addrsess 处，并告诉调用者获取文件成功。客户端接受压缩时，优先发送预先压缩好的 .gz 文件，其次是压缩版本缓存 */
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    /* POST/PUT 的消息体已经流式地交给了 m_body_handler，这里只需要通知它消息体结束 */
+    if ( ( m_method == POST ) || ( m_method == PUT ) )
+    {
+        return end_body() ? NO_CONTENT : INTERNAL_ERROR;
+    }
+
+    if ( !m_real_file && !grow_buffer( m_real_file, m_real_file_size, FILENAME_LEN, 0 ) )
+    {
+        return INTERNAL_ERROR;
+    }
     strcpy( m_real_file, doc_root );
     int len = strlen( doc_root );
     strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
+    m_real_file[ FILENAME_LEN - 1 ] = '\0';  // m_url 过长时 strncpy 不会补 '\0'，缓冲区也不再预先清零
+
+    /* 只有文本类的文件才值得压缩，对它们的应答都要带上 Vary，提醒中间的缓存按 Accept-Encoding 区分版本 */
+    int accepted = 0;
+    m_vary = compressible_type( m_url );
+    if ( m_vary )
+    {
+        accepted = accepted_encodings();
+    }
+
+    /* 先选定编码再处理条件请求：If-None-Match 和 If-Range 要和最终发送的版本的 ETag 比较。
+    HEAD 请求走同样的协商过程，它的头部和 ETag 与同一个 GET 请求的相同 */
+    HTTP_CODE ret = stat_file();
+    if ( ( ret != FILE_REQUEST ) || ( accepted == 0 ) || ( m_file_stat.st_size == 0 ) )
+    {
+        return ( ret == FILE_REQUEST ) ? finish_file() : ret;
+    }
+
+    /* 压缩版本缓存命中时不需要任何系统调用 */
+    CONTENT_ENCODING encoding = ( accepted & ( 1 << ENCODING_GZIP ) ) ? ENCODING_GZIP : ENCODING_DEFLATE;
+    variant_entry* variant = m_variant_cache ? m_variant_cache->lookup( m_real_file, encoding, m_file_stat ) : NULL;
+    if ( !variant && ( encoding == ENCODING_GZIP ) )
+    {
+        /* 目录下有预先压缩好的同名 .gz 文件时直接发送它，它同样可以走文件缓存、sendfile 和 Range */
+        len = strlen( m_real_file );
+        struct stat gz_stat;
+        if ( ( len + 3 < FILENAME_LEN ) && ( strcpy( m_real_file + len, ".gz" ), stat( m_real_file, &gz_stat ) == 0 )
+            && S_ISREG( gz_stat.st_mode ) && ( gz_stat.st_mode & S_IROTH ) )
+        {
+            release_file();
+            m_encoding = ENCODING_GZIP;
+            return open_file();
+        }
+        m_real_file[ len ] = '\0';
+    }
+    /* 未命中时要映射原文件的内容来压缩，HEAD 请求也一样。用 sendfile 发送的大文件不做实时压缩，
+    这只取决于文件大小，与请求方法和 Range 无关 */
+    if ( !variant && m_variant_cache && ( m_file_stat.st_size < SENDFILE_THRESHOLD ) )
+    {
+        ret = map_file();
+        if ( ret != FILE_REQUEST )
+        {
+            return ret;
+        }
+        variant = m_variant_cache->insert( m_real_file, encoding, m_file_stat, m_file_address );
+    }
+    if ( !variant )
+    {
+        return finish_file();
+    }
+    if ( !variant->data )
+    {
+        /* 压缩之后没有变小，仍然发送原文件 */
+        m_variant_cache->release( variant );
+        return finish_file();
+    }
+
+    /* 用压缩版本替换原文件作为应答体，之后的条件请求和 Range 都针对压缩后的内容 */
+    release_file();
+    m_variant = variant;
+    m_encoding = encoding;
+    m_file_address = variant->data;
+    m_file_stat.st_size = variant->size;
+    ret = check_conditions();
+    if ( ret != FILE_REQUEST )
+    {
+        release_file();
+    }
+    return ret;
+}
+
+/* 打开 m_real_file：检查文件属性，处理条件请求，并准备好应答体（文件缓存、sendfile 或者 mmap） */
+http_conn::HTTP_CODE http_conn::open_file()
+{
+    HTTP_CODE ret = stat_file();
+    return ( ret == FILE_REQUEST ) ? finish_file() : ret;
+}
+
+/* 取得 m_real_file 的状态并检查它能否发送。先查文件缓存，命中时直接使用缓存的映射和文件状态，不产生任何系统调用。
+HEAD 请求不需要文件内容，直接 stat */
+http_conn::HTTP_CODE http_conn::stat_file()
+{
+    if ( m_file_cache && ( m_method != HEAD ) )
+    {
+        m_file_entry = m_file_cache->lookup( m_real_file );
+        if ( m_file_entry )
+        {
+            m_file_stat = m_file_entry->st;
+            m_file_address = m_file_entry->address;
+            return FILE_REQUEST;
+        }
+    }
 
     if ( stat( m_real_file, &m_file_stat ) < 0 )
     {
@@ -347,41 +1121,321 @@ http_conn::HTTP_CODE http_conn::do_request()
     {
         return BAD_REQUEST;
     }
+    return FILE_REQUEST;
+}
+
+/* 按 m_encoding 处理条件请求，然后准备好应答体。304、416 以及 HEAD 请求只需要文件的状态，空文件则没有内容可以映射，
+已经映射过的（文件缓存命中或者为了压缩）不再重复 */
+http_conn::HTTP_CODE http_conn::finish_file()
+{
+    HTTP_CODE ret = check_conditions();
+    if ( ret != FILE_REQUEST )
+    {
+        release_file();
+        return ret;
+    }
+    if ( m_file_address || ( m_method == HEAD ) || ( m_file_stat.st_size == 0 ) )
+    {
+        return ret;
+    }
+    return map_file();
+}
+
+/* 准备好 m_real_file 的内容 */
+http_conn::HTTP_CODE http_conn::map_file()
+{
+    /* 大文件不做映射，保持文件打开，由 write 用 sendfile 直接从页缓存发送，内存占用与文件大小无关。
+    多个区间的应答要把文件片段和分隔头部交错发送，这时仍然使用 mmap，只有被请求的片段会被读入内存 */
+    if ( ( m_file_stat.st_size >= SENDFILE_THRESHOLD ) && ( m_range_count <= 1 ) )
+    {
+        m_file_fd = open( m_real_file, O_RDONLY );
+        if ( m_file_fd < 0 )
+        {
+            return INTERNAL_ERROR;
+        }
+        posix_fadvise( m_file_fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+        return FILE_REQUEST;
+    }
+
+    /* 未命中时尝试放入缓存，文件过大或者为空时退回到逐请求 mmap */
+    if ( m_file_cache )
+    {
+        m_file_entry = m_file_cache->insert( m_real_file, m_file_stat );
+        if ( m_file_entry )
+        {
+            m_file_stat = m_file_entry->st;
+            m_file_address = m_file_entry->address;
+            return FILE_REQUEST;
+        }
+    }
 
     int fd = open( m_real_file, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return INTERNAL_ERROR;
+    }
     m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
     close ( fd );
+    if ( m_file_address == MAP_FAILED )
+    {
+        m_file_address = 0;
+        return INTERNAL_ERROR;
+    }
     return FILE_REQUEST;
 }
 
-/* 对内存映射区执行 munmap 操作 */
-void http_conn::unmap()
+/* 解析 Accept-Encoding，返回客户端接受的编码的位掩码（1 << CONTENT_ENCODING）。q=0 表示明确拒绝 */
+int http_conn::accepted_encodings()
 {
-    if ( m_file_address )
+    const str_view* value = header( HDR_ACCEPT_ENCODING );
+    if ( !value )
+    {
+        return 0;
+    }
+    int accepted = 0;
+    const char* p = value->data;
+    const char* end = value->data + value->len;
+    while ( p < end )
+    {
+        while ( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) || ( *p == ',' ) ) )
+            ++p;
+        const char* name = p;
+        while ( ( p < end ) && ( *p != ',' ) && ( *p != ';' ) && ( *p != ' ' ) && ( *p != '\t' ) )
+            ++p;
+        int name_len = p - name;
+        /* 参数中只关心 q 值是否为 0 */
+        bool refused = false;
+        while ( ( p < end ) && ( *p != ',' ) )
+        {
+            if ( ( ( *p == 'q' ) || ( *p == 'Q' ) ) && ( p + 1 < end ) && ( p[1] == '=' ) )
+            {
+                refused = ( atof( p + 2 ) == 0.0 );
+            }
+            ++p;
+        }
+        if ( refused )
+        {
+            continue;
+        }
+        if ( ( name_len == 4 ) && ( strncasecmp( name, "gzip", 4 ) == 0 ) )
+            accepted |= 1 << ENCODING_GZIP;
+        else if ( ( name_len == 7 ) && ( strncasecmp( name, "deflate", 7 ) == 0 ) )
+            accepted |= 1 << ENCODING_DEFLATE;
+        else if ( ( name_len == 1 ) && ( *name == '*' ) )
+            accepted |= 1 << ENCODING_GZIP;
+    }
+    return accepted;
+}
+
+/* 处理条件请求和 Range 请求：If-None-Match 优先于 If-Modified-Since，匹配时返回 NOT_MODIFIED；
+否则解析 Range，结果记录在 m_ranges 中 */
+http_conn::HTTP_CODE http_conn::check_conditions()
+{
+    m_range_count = 0;
+    char etag[ 64 ];
+    int etag_len = format_etag( m_file_stat, m_encoding, etag, sizeof( etag ) );
+
+    const str_view* inm = header( HDR_IF_NONE_MATCH );
+    if ( inm )
+    {
+        if ( etag_list_matches( inm, etag, etag_len ) )
+        {
+            return NOT_MODIFIED;
+        }
+    }
+    else
+    {
+        const str_view* ims = header( HDR_IF_MODIFIED_SINCE );
+        time_t since;
+        if ( ims && parse_http_date( ims, &since ) && ( m_file_stat.st_mtime <= since ) )
+        {
+            return NOT_MODIFIED;
+        }
+    }
+
+    /* Range 只对 GET 有意义，If-Range 不匹配说明客户端手里的片段已经过期，要发送整个文件 */
+    if ( ( m_method != GET ) || !header( HDR_RANGE ) || !if_range_matches( etag ) )
+    {
+        return FILE_REQUEST;
+    }
+    return parse_range();
+}
+
+/* If-Range 的值是 ETag（强比较）或者 HTTP-date（必须与 Last-Modified 完全相同） */
+bool http_conn::if_range_matches( const char* etag )
+{
+    const str_view* if_range = header( HDR_IF_RANGE );
+    if ( !if_range )
+    {
+        return true;
+    }
+    if ( ( if_range->len > 0 ) && ( ( if_range->data[0] == '"' ) || ( if_range->data[0] == 'W' ) ) )
+    {
+        return ( if_range->len == ( int )strlen( etag ) ) && ( memcmp( if_range->data, etag, if_range->len ) == 0 );
+    }
+    time_t date;
+    return parse_http_date( if_range, &date ) && ( date == m_file_stat.st_mtime );
+}
+
+/* 解析 "Range: bytes=0-99,200-,-50"。语法错误或者区间过多时忽略 Range（m_range_count 为 0），
+所有区间都超出文件末尾时返回 RANGE_NOT_SATISFIABLE */
+http_conn::HTTP_CODE http_conn::parse_range()
+{
+    const str_view* range = header( HDR_RANGE );
+    const char* p = range->data;
+    const char* end = range->data + range->len;
+    off_t size = m_file_stat.st_size;
+    if ( ( range->len < 6 ) || ( strncasecmp( p, "bytes=", 6 ) != 0 ) )
+    {
+        return FILE_REQUEST;
+    }
+    p += 6;
+
+    int count = 0;
+    while ( p < end )
+    {
+        while ( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) || ( *p == ',' ) ) )
+            ++p;
+        if ( p == end )
+        {
+            break;
+        }
+        off_t first = 0;
+        off_t last = size - 1;
+        if ( *p == '-' )
+        {
+            /* 后缀区间：文件最后 n 个字节 */
+            off_t suffix = 0;
+            ++p;
+            if ( !parse_offset( p, end, &suffix ) )
+            {
+                m_range_count = 0;
+                return FILE_REQUEST;
+            }
+            /* "-0" 不包含任何字节，当作无法满足的区间 */
+            first = ( suffix == 0 ) ? size : ( ( suffix < size ) ? size - suffix : 0 );
+        }
+        else
+        {
+            if ( !parse_offset( p, end, &first ) || ( p == end ) || ( *p++ != '-' ) )
+            {
+                m_range_count = 0;
+                return FILE_REQUEST;
+            }
+            off_t requested_last = 0;
+            if ( parse_offset( p, end, &requested_last ) )
+            {
+                if ( requested_last < first )
+                {
+                    m_range_count = 0;
+                    return FILE_REQUEST;
+                }
+                if ( requested_last < last )
+                {
+                    last = requested_last;
+                }
+            }
+        }
+        while ( ( p < end ) && ( ( *p == ' ' ) || ( *p == '\t' ) ) )
+            ++p;
+        if ( ( p < end ) && ( *p != ',' ) )
+        {
+            m_range_count = 0;
+            return FILE_REQUEST;
+        }
+        if ( ++count > MAX_RANGES )
+        {
+            m_range_count = 0;
+            return FILE_REQUEST;
+        }
+        /* 起点超出文件末尾的区间无法满足，跳过 */
+        if ( first >= size )
+        {
+            continue;
+        }
+        m_ranges[ m_range_count ].first = first;
+        m_ranges[ m_range_count ].last = last;
+        ++m_range_count;
+    }
+
+    if ( count == 0 )
+    {
+        return FILE_REQUEST;
+    }
+    return ( m_range_count == 0 ) ? RANGE_NOT_SATISFIABLE : FILE_REQUEST;
+}
+
+/* 释放当前请求的目标文件：关闭 sendfile 模式下打开的文件，释放缓存引用或者 munmap */
+void http_conn::release_file()
+{
+    if ( m_file_fd != -1 )
+    {
+        close( m_file_fd );
+        m_file_fd = -1;
+    }
+    if ( m_variant )
+    {
+        m_variant_cache->release( m_variant );
+        m_variant = 0;
+        m_file_address = 0;
+    }
+    else if ( m_file_entry )
+    {
+        m_file_cache->release( m_file_entry );
+        m_file_entry = 0;
+        m_file_address = 0;
+    }
+    else if ( m_file_address )
     {
         munmap( m_file_address, m_file_stat.st_size );
         m_file_address = 0;
     }
 }
 
+/* 对内存映射区执行 munmap 操作，来自文件缓存的映射只释放引用，sendfile 模式则关闭文件 */
+void http_conn::unmap()
+{
+    for ( int i = 0; i < m_body_count; ++i )
+    {
+        if ( m_bodies[i].variant )
+        {
+            m_variant_cache->release( m_bodies[i].variant );
+        }
+        else if ( m_bodies[i].entry )
+        {
+            m_file_cache->release( m_bodies[i].entry );
+        }
+        else
+        {
+            munmap( m_bodies[i].address, m_bodies[i].size );
+        }
+    }
+    m_body_count = 0;
+    release_file();
+}
+
 /* 写 HTTP 响应， 返回 false 则代表出错或者写完断开连接， true 表示服务器继续监听当前 sockfd */
 bool http_conn::write() {
     int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
-    if ( bytes_to_send == 0 )
+    if ( ( m_bytes_to_send == 0 ) && ( m_file_send_left == 0 ) )
     {
+        end_request();
         modfd( m_epollfd, m_sockfd, EPOLLIN );  // 发送完了，那么我们直接准备接收下一个请求
-        init();  // 重置跟一次连接有关的信息
+        init_response();  // 重置跟这一批应答有关的信息
         return true;
     }
 
-    while ( 1 )
+    while ( m_iv_idx < m_iv_count )
     {
-        temp = writev( m_sockfd , m_iv, m_iv_count );
+        /* 后面还有 sendfile 要发送的文件体时带上 MSG_MORE，让头部和文件数据合并成满的 TCP 段 */
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = m_iv + m_iv_idx;
+        msg.msg_iovlen = m_iv_count - m_iv_idx;
+        temp = sendmsg( m_sockfd, &msg, ( m_file_send_left > 0 ) ? MSG_MORE : 0 );
         if ( temp <= -1 )
         {
-            /* 如果 TCP 写缓冲没有空间，则等待下一轮 EPOLLIN 事件。虽然在此期间，服务器无法接收到同一客户的
+            /* 如果 TCP 写缓冲没有空间，则等待下一轮 EPOLLOUT 事件。虽然在此期间，服务器无法接收到同一客户的
             下一个请求，但这可以保证连接的完整性 */
             if ( errno == EAGAIN )
             {
@@ -392,53 +1446,175 @@ bool http_conn::write() {
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if ( bytes_to_send <= bytes_have_send )
+        m_bytes_to_send -= temp;
+        m_bytes_have_send += temp;
+        advance_iovec( temp );
+    }
+
+    if ( m_file_send_left > 0 )
+    {
+        return write_file();
+    }
+    return write_done();
+}
+
+/* 把已经发送的 bytes 字节从 m_iv 中扣除：完整发完的块直接跳过，只发了一部分的块把起始位置后移，
+这样下一次 writev 恰好从第一个未发送的字节开始，不会重复发送，也不会漏发 */
+void http_conn::advance_iovec( size_t bytes )
+{
+    while ( ( bytes > 0 ) && ( m_iv_idx < m_iv_count ) )
+    {
+        struct iovec& iv = m_iv[ m_iv_idx ];
+        if ( bytes >= iv.iov_len )
         {
-            /* 发送 HTTP 响应成功，根据 HTTP 请求中的 connection 字段决定是否立即关闭连接 */
-            unmap();
-            if( m_linger )
+            bytes -= iv.iov_len;
+            iv.iov_len = 0;
+            ++m_iv_idx;
+        }
+        else
+        {
+            iv.iov_base = ( char* )iv.iov_base + bytes;
+            iv.iov_len -= bytes;
+            bytes = 0;
+        }
+    }
+    /* 跳过长度为 0 的块，保证 m_iv_idx == m_iv_count 等价于内存部分已经全部发完 */
+    while ( ( m_iv_idx < m_iv_count ) && ( m_iv[ m_iv_idx ].iov_len == 0 ) )
+    {
+        ++m_iv_idx;
+    }
+}
+
+/* sendfile 模式下在内存块全部发完之后，从 m_file_offset 处继续发送文件。
+遇到 EAGAIN 时进度保存在成员中，下一轮 EPOLLOUT 从断点继续 */
+bool http_conn::write_file()
+{
+    int temp = 0;
+    while ( m_file_send_left > 0 )
+    {
+        temp = sendfile( m_sockfd, m_file_fd, &m_file_offset, m_file_send_left );
+        if ( temp <= -1 )
+        {
+            if ( errno == EAGAIN )
             {
-                init();
-                modfd( m_epollfd, m_sockfd, EPOLLIN );
+                modfd( m_epollfd, m_sockfd, EPOLLOUT );
                 return true;
             }
-            else
-            {
-                modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return false;
-            }
+            unmap();
+            return false;
+        }
+        if ( temp == 0 )
+        {
+            /* 文件在发送过程中被截断了，已经无法发送完整的应答 */
+            unmap();
+            return false;
         }
+        m_file_send_left -= temp;
+        m_bytes_have_send += temp;
     }
+
+    return write_done();
+}
+
+/* 在待发送的内存块列表末尾追加一块，与上一块在内存中相连时直接合并（流水线中连续的错误应答都在写缓冲里） */
+bool http_conn::add_iovec( const void* base, size_t len )
+{
+    if ( len == 0 )
+    {
+        return true;
+    }
+    if ( ( m_iv_count > 0 ) && ( ( char* )m_iv[ m_iv_count - 1 ].iov_base + m_iv[ m_iv_count - 1 ].iov_len == base ) )
+    {
+        m_iv[ m_iv_count - 1 ].iov_len += len;
+        m_bytes_to_send += len;
+        return true;
+    }
+    if ( m_iv_count >= MAX_IOVEC )
+    {
+        return false;
+    }
+    m_iv[ m_iv_count ].iov_base = ( void* )base;
+    m_iv[ m_iv_count ].iov_len = len;
+    ++m_iv_count;
+    m_bytes_to_send += len;
+    return true;
+}
+
+/* 发送 HTTP 响应成功，根据最后一个被应答请求的 connection 字段决定是否立即关闭连接 */
+bool http_conn::write_done()
+{
+    unmap();
+    if( m_response_linger )
+    {
+        m_kept_alive = true;
+        init_response();
+        compact_read_buf();
+        if ( m_read_idx == 0 )
+        {
+            /* 没有缓存任何请求数据，连接进入空闲状态，读缓冲还给内存池 */
+            release_buffer( m_read_buf, m_read_size );
+        }
+        /* 读缓冲中还有流水线请求没有处理时不重新注册 EPOLLIN（对方可能不会再发数据，ET 模式下不会再有事件），
+        由调用者通过 has_pending_request 发现并把连接重新交给线程池 */
+        if ( has_pending_request() )
+        {
+            return true;
+        }
+        end_request();
+        modfd( m_epollfd, m_sockfd, EPOLLIN );
+        return true;
+    }
+    else
+    {
+        modfd( m_epollfd, m_sockfd, EPOLLIN );
+        return false;
+    }
+}
+
+/* 清空待发送的内存块列表和发送进度 */
+void http_conn::reset_iovec()
+{
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_bytes_to_send = 0;
+    m_bytes_have_send = 0;
+    m_file_send_left = 0;
 }
 
 /* 往写缓冲中写入待发送的数据 */
 bool http_conn::add_response( const char* format, ...)
 {
-    if ( m_write_idx >= WRITE_BUFFER_SIZE )
+    if ( !grow_write_buf( 2 ) )
     {
-        return false; // 如果要发送的值大于缓冲区大小，直接返回错误
+        return false; // 写缓冲已经增长到上限，直接返回错误
     }
 
     va_list arg_list;
     va_start( arg_list, format );
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE-1-m_write_idx, format, arg_list );
-    if ( len >= ( WRITE_BUFFER_SIZE -1 - m_write_idx ) ) // 大于说明缓冲区大小不够！
+    int len = vsnprintf( m_write_buf + m_write_idx, m_write_size - 1 - m_write_idx, format, arg_list );
+    va_end( arg_list );
+    if ( len >= ( int )( m_write_size - 1 - m_write_idx ) ) // 大于说明缓冲区大小不够，扩大写缓冲后重新格式化
     {
-        return false;
+        if ( !grow_write_buf( len + 1 ) )
+        {
+            return false;
+        }
+        va_start( arg_list, format );
+        len = vsnprintf( m_write_buf + m_write_idx, m_write_size - 1 - m_write_idx, format, arg_list );
+        va_end( arg_list );
     }
     m_write_idx += len;
-    va_end( arg_list );
     return true;
 }
 
 bool http_conn::add_status_line( int status, const char* title )
 {
-    return add_response( "%s %d %s\r\n", "HTTP/1.1", status , title);
+    char date[ HTTP_DATE_LEN ];
+    http_date( date );
+    return add_response( "%s %d %s\r\nDate: %.*s\r\n", "HTTP/1.1", status , title, HTTP_DATE_LEN, date );
 }
 
-bool http_conn::add_headers( int content_len )
+bool http_conn::add_headers( off_t content_len )
 {
     if ( !add_content_length( content_len )  )  // 自己加的
         return false;
@@ -449,36 +1625,196 @@ bool http_conn::add_headers( int content_len )
     return true;
 }
 
-bool http_conn::add_content_length( int content_len )
+bool http_conn::add_content_length( off_t content_len )
+{
+    return add_response("Content-Length: %lld\r\n", ( long long )content_len );
+}
+
+/* 文件应答的校验信息，客户端据此发起条件请求 */
+bool http_conn::add_validators()
 {
-    return add_response("Content-Length: %d\r\n", content_len );
+    char etag[ 64 ];
+    char date[ 64 ];
+    format_etag( m_file_stat, m_encoding, etag, sizeof( etag ) );
+    format_http_date( m_file_stat.st_mtime, date, sizeof( date ) );
+    if ( m_vary && !add_response( "Vary: Accept-Encoding\r\n" ) )
+    {
+        return false;
+    }
+    return add_response( "ETag: %s\r\nLast-Modified: %s\r\n", etag, date );
+}
+
+/* 应答体经过压缩时说明编码方式 */
+bool http_conn::add_encoding()
+{
+    if ( m_encoding == ENCODING_IDENTITY )
+    {
+        return true;
+    }
+    return add_response( "Content-Encoding: %s\r\n", encoding_names[ m_encoding ] );
 }
 
 bool http_conn::add_linger()
 {
-    return add_response( "Connection: %s\r\n", (m_linger == true ) ? "keep-alive" : "close" );
+    static const char keep_alive[] = "Connection: keep-alive\r\n";
+    static const char close[] = "Connection: close\r\n";
+    return m_linger ? add_text( keep_alive, sizeof( keep_alive ) - 1 ) : add_text( close, sizeof( close ) - 1 );
 }
 
 bool http_conn::add_blank_line()
 {
-    return add_response( "%s", "\r\n" );
+    return add_text( "\r\n", 2 );
+}
+
+/* 直接拷贝一段不需要格式化的文本到写缓冲 */
+bool http_conn::add_text( const char* text, int len )
+{
+    if ( !grow_write_buf( len ) )
+    {
+        return false;
+    }
+    memcpy( m_write_buf + m_write_idx, text, len );
+    m_write_idx += len;
+    return true;
+}
+
+/* 拷贝一段预先渲染好的应答，并在 date_offset 处填入当前时间 */
+bool http_conn::add_prerendered( const char* text, int len, int date_offset )
+{
+    int start = m_write_idx;
+    if ( !add_text( text, len ) )
+    {
+        return false;
+    }
+    http_date( m_write_buf + start + date_offset );
+    return true;
+}
+
+/* 发送预先渲染好的固定应答，HEAD 请求只发送其中的头部 */
+bool http_conn::add_static_response( HTTP_CODE code )
+{
+    const static_response& r = m_static_responses[ code ][ m_linger ? 1 : 0 ];
+    return add_prerendered( r.data.data(), ( m_method == HEAD ) ? r.header_len : r.data.size(), r.date_offset );
 }
 
 bool http_conn::add_content( const char* content )
 {
+    /* HEAD 请求的应答只有头部，Content-Length 仍然是完整应答的长度 */
+    if ( m_method == HEAD )
+    {
+        return true;
+    }
     return add_response( "%s", content );
 }
 
+/* 把文件 [offset, offset + len) 这一段加入应答：sendfile 模式只记录起点和长度，否则直接引用映射中的这段内存 */
+bool http_conn::add_file_slice( off_t offset, off_t len )
+{
+    if ( m_file_fd != -1 )
+    {
+        /* 文件体由 write_file 用 sendfile 发送 */
+        m_file_offset = offset;
+        m_file_send_left = len;
+        return true;
+    }
+    return add_iovec( m_file_address + offset, len );
+}
+
+/* 映射交给这一批应答统一管理，发送完成后由 unmap 释放。sendfile 模式下文件在 write_done 中关闭 */
+void http_conn::keep_file_body()
+{
+    if ( ( m_file_fd != -1 ) || !m_file_address )
+    {
+        return;
+    }
+    m_bodies[ m_body_count ].address = m_file_address;
+    m_bodies[ m_body_count ].size = m_file_stat.st_size;
+    m_bodies[ m_body_count ].entry = m_file_entry;
+    m_bodies[ m_body_count ].variant = m_variant;
+    ++m_body_count;
+    m_file_address = 0;
+    m_file_entry = 0;
+    m_variant = 0;
+}
+
+/* 206 应答。单个区间直接发送文件的这一段；多个区间组成 multipart/byteranges，每段的分隔头部先写进写缓冲，
+算出总长度后再写应答头部，最后按 头部、分隔头部、文件片段…… 的顺序组装内存块 */
+bool http_conn::add_ranges()
+{
+    long long size = m_file_stat.st_size;
+    int response_start = m_write_idx;
+    if ( m_range_count == 1 )
+    {
+        off_t first = m_ranges[0].first;
+        off_t len = m_ranges[0].last - first + 1;
+        if ( !add_status_line( 206, partial_206_title ) || !add_validators() || !add_encoding()
+            || !add_response( "Content-Range: bytes %lld-%lld/%lld\r\n", ( long long )first, ( long long )m_ranges[0].last, size )
+            || !add_headers( len ) )
+        {
+            return false;
+        }
+        if ( !add_iovec( m_write_buf + response_start, m_write_idx - response_start ) || !add_file_slice( first, len ) )
+        {
+            return false;
+        }
+        keep_file_body();
+        return true;
+    }
+
+    /* 分隔符只需要在本进程发出的应答中不与文件内容冲突的概率足够小，用递增的序号即可 */
+    static unsigned long boundary_seq = 0;
+    unsigned long boundary = __sync_add_and_fetch( &boundary_seq, 1 );
+    int part_start[ MAX_RANGES + 1 ];
+    off_t body_len = 0;
+    for ( int i = 0; i < m_range_count; ++i )
+    {
+        part_start[i] = m_write_idx;
+        if ( !add_response( "\r\n--%020lu\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n", boundary,
+            ( long long )m_ranges[i].first, ( long long )m_ranges[i].last, size ) )
+        {
+            return false;
+        }
+        body_len += m_ranges[i].last - m_ranges[i].first + 1;
+    }
+    part_start[ m_range_count ] = m_write_idx;
+    if ( !add_response( "\r\n--%020lu--\r\n", boundary ) )
+    {
+        return false;
+    }
+    int head_start = m_write_idx;
+    body_len += head_start - response_start;
+    if ( !add_status_line( 206, partial_206_title ) || !add_validators() || !add_encoding()
+        || !add_response( "Content-Type: multipart/byteranges; boundary=%020lu\r\n", boundary )
+        || !add_headers( body_len ) )
+    {
+        return false;
+    }
+
+    /* 写缓冲可能在上面的 add_response 中换过位置，所以内存块放到最后统一按下标组装 */
+    add_iovec( m_write_buf + head_start, m_write_idx - head_start );
+    for ( int i = 0; i < m_range_count; ++i )
+    {
+        add_iovec( m_write_buf + part_start[i], part_start[ i + 1 ] - part_start[i] );
+        add_iovec( m_file_address + m_ranges[i].first, m_ranges[i].last - m_ranges[i].first + 1 );
+    }
+    if ( !add_iovec( m_write_buf + part_start[ m_range_count ], head_start - part_start[ m_range_count ] ) )
+    {
+        return false;
+    }
+    keep_file_body();
+    return true;
+}
+
 /* 根据服务器处理 HTTP 请求，决定返回给客户端的内容 */
 bool http_conn::process_write( HTTP_CODE ret )
 {
+    /* 流水线中的多个应答依次追加到写缓冲中，本次应答的头部从 response_start 开始 */
+    int response_start = m_write_idx;
     switch ( ret )
     {
         case INTERNAL_ERROR:
         {
-            add_status_line(500, error_500_title );
-            add_headers( strlen( error_500_form ) );
-            if ( !add_content( error_500_form ) )
+            if ( !add_static_response( INTERNAL_ERROR ) )
             {
                 return false;
             }
@@ -486,19 +1822,15 @@ bool http_conn::process_write( HTTP_CODE ret )
         }
         case BAD_REQUEST:
         {
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if( !add_content( error_400_form ) )
+            if ( !add_static_response( BAD_REQUEST ) )
             {
                 return false;
-                break;
             }
+            break;
         }
-        case NO_REQUEST:
+        case NO_RESOURCE:
         {
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( !add_content( error_404_form ) )
+            if ( !add_static_response( NO_RESOURCE ) )
             {
                 return false;
             }
@@ -506,9 +1838,7 @@ bool http_conn::process_write( HTTP_CODE ret )
         }
         case FORBIDEDEN_REQUEST:
         {
-            add_status_line( 403, error_403_title );
-            add_headers( strlen( error_403_form ) );
-            if ( !add_content( error_403_form ) )
+            if ( !add_static_response( FORBIDEDEN_REQUEST ) )
             {
                 return false;
             }
@@ -516,26 +1846,92 @@ bool http_conn::process_write( HTTP_CODE ret )
         }
         case FILE_REQUEST:
         {
-            add_status_line( 200, error_200_title );
+            /* 内存块或者写缓冲放不下多区间应答时，按协议允许的做法忽略 Range，发送整个文件 */
+            if ( ( m_range_count > 1 ) && ( ( m_iv_count + 2 * m_range_count + 2 > MAX_IOVEC )
+                || ( m_write_idx + ( m_range_count + 2 ) * RANGE_PART_RESERVE > MAX_WRITE_BUFFER_SIZE ) ) )
+            {
+                m_range_count = 0;
+            }
+            if ( m_range_count > 0 )
+            {
+                return add_ranges();
+            }
             if ( m_file_stat.st_size != 0 ) // 有文件要传输回去的话，不在这里传输，只是做好设置？
             {
-                add_headers( m_file_stat.st_size );
-                m_iv[ 0 ].iov_base = m_write_buf;
-                m_iv[ 0 ].iov_len = m_write_idx;
-                m_iv[ 1 ].iov_base = m_file_address;
-                m_iv[ 1 ].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
+                /* 缓存中的文件和压缩版本都带有预先渲染好的头部，只需要填入当前时间；.gz 文件的缓存项
+                是按未压缩的文件渲染的，不能直接使用 */
+                const std::string* header = m_variant ? &m_variant->header
+                    : ( ( m_file_entry && ( m_encoding == ENCODING_IDENTITY ) ) ? &m_file_entry->header : NULL );
+                if ( header && !header->empty() )
+                {
+                    if ( !add_prerendered( header->data(), header->size(), FILE_HEADER_DATE_OFFSET ) )
+                    {
+                        return false;
+                    }
+                }
+                else if ( !add_status_line( 200, ok_200_title ) || !add_response( "Accept-Ranges: bytes\r\n" )
+                    || !add_validators() || !add_encoding() || !add_content_length( m_file_stat.st_size ) )
+                {
+                    return false;
+                }
+                if ( !add_linger() || !add_blank_line() )
+                {
+                    return false;
+                }
+                if ( !add_iovec( m_write_buf + response_start, m_write_idx - response_start ) )
+                {
+                    return false;
+                }
+                if ( m_method == HEAD )
+                {
+                    /* HEAD 也可能命中了压缩版本缓存（用它的头部），应答里没有消息体，引用在这里就要释放，
+                    否则会留给流水线中的下一个请求 */
+                    release_file();
+                    return true;
+                }
+                if ( !add_file_slice( 0, m_file_stat.st_size ) )
+                {
+                    return false;
+                }
+                keep_file_body();
                 return true;  
             }
             else 
             {
-                const char* ok_string = "<html><body></body></html>";
-                add_headers( strlen( ok_string ) );
-                if ( !add_content( ok_string ) )
+                if ( !add_static_response( FILE_REQUEST ) )
                 {
                     return false;
                 }
             }
+            break;
+        }
+        case NOT_MODIFIED:
+        {
+            /* 304 应答没有消息体，只带上校验信息让客户端刷新缓存 */
+            if ( !add_status_line( 304, not_modified_304_title ) || !add_validators() || !add_linger() || !add_blank_line() )
+            {
+                return false;
+            }
+            break;
+        }
+        case RANGE_NOT_SATISFIABLE:
+        {
+            if ( !add_status_line( 416, error_416_title )
+                || !add_response( "Content-Range: bytes */%lld\r\n", ( long long )m_file_stat.st_size )
+                || !add_headers( strlen( error_416_form ) ) || !add_content( error_416_form ) )
+            {
+                return false;
+            }
+            break;
+        }
+        case NO_CONTENT:
+        {
+            /* 消息体已经交给处理函数，204 应答既没有消息体也不带 Content-Length */
+            if ( !add_status_line( 204, no_content_204_title ) || !add_linger() || !add_blank_line() )
+            {
+                return false;
+            }
+            break;
         }
         default:
         {
@@ -543,28 +1939,62 @@ bool http_conn::process_write( HTTP_CODE ret )
         }
     }
 
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0]_iov_len = m_write_idx;
-    m_iv_count = 1;
-    return true;
+    return add_iovec( m_write_buf + response_start, m_write_idx - response_start );
 } 
 
 /* 由线程池中的工作线程调用，这是处理 HTTP 请求的入口函数 */
 void http_conn::process()
 {
     HTTP_CODE read_ret = process_read();
+    if ( ( read_ret == NO_REQUEST ) && ( m_check_state != CHECK_STATE_CONTENT )
+        && ( m_read_idx - m_request_start >= MAX_READ_BUFFER_SIZE ) )
+    {
+        /* 读缓冲已经到上限，仍然没有收全一个请求的头部 */
+        close_conn();
+        return;
+    }
     if ( read_ret == NO_REQUEST )
     {
+        /* 请求还没有收全，连接回到等待输入的状态，不算作处理中 */
+        end_request();
         modfd( m_epollfd , m_sockfd , EPOLLIN );
         return;
     }
 
-    bool write_ret = process_write( read_ret );
-    if ( !write_ret )
+    /* 客户端可能把多个请求流水线式地一次发过来，依次解析并应答，所有应答合并成一次 writev 发送 */
+    while ( true )
     {
-        close_conn();
+        if ( read_ret == BAD_REQUEST )
+        {
+            m_linger = false;  // 请求格式错误时后面的字节已经无法可靠地解析，应答后关闭连接
+        }
+        bool write_ret = process_write( read_ret );
+        if ( !write_ret )
+        {
+            close_conn();
+            return;
+        }
+        m_response_linger = m_linger;
+        init_request();  // 下一个请求从 m_checked_idx 开始
+
+        /* 连接将在本次应答后关闭，文件体要用 sendfile 在最后发送，或者放不下下一个应答时，先把已有的应答发出去 */
+        if ( !m_response_linger || ( m_file_fd != -1 ) || !can_pipeline() )
+        {
+            break;
+        }
+        read_ret = process_read();
+        if ( read_ret == NO_REQUEST )
+        {
+            break;
+        }
     }
 
     modfd( m_epollfd, m_sockfd, EPOLLOUT ); // 通知可以写，由主处理逻辑去进行写操作
-    
+}
+
+/* 写缓冲、内存块和文件体的槽位是否还够再追加一个应答 */
+bool http_conn::can_pipeline() const
+{
+    return ( m_body_count < MAX_PIPELINE ) && ( m_iv_count + 2 <= MAX_IOVEC )
+        && ( m_write_idx + RESPONSE_RESERVE <= MAX_WRITE_BUFFER_SIZE );
 }
\ No newline at end of file
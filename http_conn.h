@@ -19,18 +19,39 @@
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <string>
+#include <vector>
+#include <atomic>
 #include "14-2_locker.h"
+#include "file_cache.h"
+#include "variant_cache.h"
+#include "buffer_pool.h"
+#include "http_header.h"
 
 
 class http_conn {
 public:
     /* 文件名的最大长度 */
     static const int FILENAME_LEN = 200;
-    /* 读缓冲区的大小 */
+    /* 读缓冲区的初始大小，放不下时按两倍增长，最大为 MAX_READ_BUFFER_SIZE */
     static const int READ_BUFFER_SIZE = 2048;
-    /* 读缓冲区的大小 */
+    static const int MAX_READ_BUFFER_SIZE = 64 * 1024;
+    /* 写缓冲区的初始大小和最大大小 */
     static const int WRITE_BUFFER_SIZE = 1024;
-    /* HTTP 请求方法，但我们仅支持 GET */
+    static const int MAX_WRITE_BUFFER_SIZE = 64 * 1024;
+    /* 目标文件不小于该大小时不再 mmap，而是保持文件打开并用 sendfile 发送 */
+    static const int SENDFILE_THRESHOLD = 1024 * 1024;
+    /* 一次应答最多由多少个内存块组成 */
+    static const int MAX_IOVEC = 64;
+    /* 一批流水线应答中最多包含多少个 mmap 的文件体 */
+    static const int MAX_PIPELINE = 16;
+    /* 写缓冲中至少还剩这么多空间时才继续解析下一个流水线请求，保证它的应答头部和错误页面能放得下 */
+    static const int RESPONSE_RESERVE = 512;
+    /* 一个 Range 请求最多包含多少个区间，超过时忽略 Range 发送整个文件 */
+    static const int MAX_RANGES = 16;
+    /* multipart/byteranges 应答中每个区间的分隔行和头部最多占用的写缓冲大小 */
+    static const int RANGE_PART_RESERVE = 128;
+    /* HTTP 请求方法，我们支持 GET、HEAD、POST 和 PUT */
     enum METHOD {
         GET = 0, POST, HEAD, PUT, DELETE,
         TRACE, OPTIONS, CONNECT, PATCH
@@ -45,32 +66,90 @@ public:
     enum HTTP_CODE {
         NO_REQUEST = 0, GET_REQUSET, BAD_REQUEST,
         NO_RESOURCE, FORBIDEDEN_REQUEST, FILE_REQUEST,
-        INTERNAL_ERROR, CLOSED_CONNECTION
+        INTERNAL_ERROR, CLOSED_CONNECTION, NO_CONTENT,
+        NOT_MODIFIED, RANGE_NOT_SATISFIABLE
     };
     /* 行的读取状态 */
     enum LINE_STATUS {
         LINE_OK = 0, LINE_BAD, LINE_OPEN
     };
+    /* 解析 chunked 编码的消息体时所处的状态 */
+    enum CHUNK_STATE {
+        CHUNK_SIZE = 0, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER
+    };
+    /* 交给消息体处理函数的事件：一段消息体数据、消息体结束、连接在消息体传输过程中断开 */
+    enum BODY_EVENT {
+        BODY_DATA = 0, BODY_END, BODY_ABORT
+    };
+    /* POST/PUT 消息体的处理函数，消息体被解码后分段交付，不需要整个放进读缓冲。
+    返回 false 表示处理失败，请求以 500 结束 */
+    typedef bool ( *body_handler )( http_conn* conn, BODY_EVENT event, const char* data, int len );
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn();
+    ~http_conn();
 
 public:
-    /* 初始化新的连接 */
-    void init( int sockfd, const sockaddr_in& addr );
+    /* 初始化新的连接。sockfd 必须已经是非阻塞的，由 accept4 的 SOCK_NONBLOCK 设置。
+    pool 是这个连接的读写缓冲使用的内存池，通常属于它所在的 reactor 的 NUMA 节点，为空时使用 m_buffer_pool */
+    void init( int sockfd, const sockaddr_in& addr, int epollfd, buffer_pool* pool = NULL );
     /* 关闭连接 */
     void close_conn( bool real_close = true );
+    /* 由 reactor 在把连接交给线程池之前调用。从这时起，直到应答发完、连接重新等待新的请求或者被关闭，
+    都算作一个处理中的请求，优雅关闭时要等它们完成 */
+    void begin_request();
+    bool in_flight() const { return m_in_flight; }
+    /* 排空期间关闭连接时使用。读缓冲或内核中可能还有没读的请求，这时直接 close 会发出 RST，让内核丢弃发送缓冲中
+    对方还没有收到的应答。这里先关闭写的一方，连接仍然算作处理中，之后的输入由 discard_input 读出丢弃，
+    对方收完应答关闭连接时再由 reactor 调用 close_conn */
+    void linger_close();
+    bool lingering() const { return m_lingering; }
+    /* 读出并丢弃内核中的输入，对方关闭了连接或者出错时返回 false */
+    bool discard_input();
+    /* 过载时拒绝这个连接：回复 503 后关闭。只能由持有连接的线程调用：事件已触发、尚未交给线程池的 reactor 线程，
+    或者从线程池中取出它的工作线程（请求排队超过期限时） */
+    void shed();
+    /* 由 reactor 在交给线程池之前调用，决定请求进入哪个优先级通道（见 scheduler.h 的 priority_lanes）：
+    路径以 m_interactive_paths 中某一项开头的请求为 0，已经应答过请求的连接上的后续 GET/HEAD 请求为 1，
+    新连接上的请求和 POST/PUT 为 2。只看读缓冲中当前请求的请求行，请求行还没有收全时按能看到的部分判断 */
+    int priority() const;
+    /* 在一个尚未初始化成 http_conn 的 socket 上尽力发送预先渲染好的 503 应答，不关闭 socket */
+    static void send_unavailable( int sockfd );
     /* 处理客户请求 */
     void process();
     /* 非阻塞读操作 */
     bool read();
     /* 非阻塞写操作 */
     bool write();
+    /* 上一批应答已经发完，而读缓冲中还有尚未处理的流水线请求。write 返回 true 之后需要据此把连接重新交给线程池 */
+    bool has_pending_request() const
+    {
+        return ( m_bytes_to_send == 0 ) && ( m_file_send_left == 0 ) && ( m_read_idx > m_checked_idx );
+    }
+    /* 供消息体处理函数使用的请求信息 */
+    METHOD get_method() const { return m_method; }
+    const char* get_url() const { return m_url; }
+    /* 当前请求中某个头部的字段值，请求中没有该头部时返回 NULL */
+    const str_view* header( HEADER_NAME name ) const
+    {
+        return ( m_header_mask & ( 1u << name ) ) ? &m_headers[ name ] : NULL;
+    }
 
 private:
     /* 初始化连接 */
     void init();
+    /* 请求处理完毕，连接回到空闲状态 */
+    void end_request();
+    void init_request();
+    void init_response();
+    void compact_read_buf();
+    bool grow_buffer( char*& buf, size_t& capacity, size_t size, size_t used );
+    void release_buffer( char*& buf, size_t& capacity );
+    void release_buffers();
+    bool grow_read_buf();
+    bool grow_write_buf( size_t size );
+    void move_read_pointers( ptrdiff_t offset );
+    bool can_pipeline() const;
     /* 解析 HTTP 请求 */
     HTTP_CODE process_read();
     /* 填充 HTTP 应答 */
@@ -79,42 +158,122 @@ private:
     /* 下面这一组函数被 process_read 调用以分析 HTTP 请求 */
     HTTP_CODE parse_request_line( char* text );
     HTTP_CODE parse_headers( char* text );
-    HTTP_CODE parse_content( char* text );
+    HTTP_CODE parse_content();
+    HTTP_CODE parse_identity();
+    HTTP_CODE parse_chunked();
+    void send_continue();
+    bool feed_body( const char* data, int len );
+    void discard_body();
+    bool end_body();
+    void abort_body();
     HTTP_CODE do_request();
+    HTTP_CODE open_file();
+    HTTP_CODE stat_file();
+    HTTP_CODE finish_file();
+    HTTP_CODE map_file();
+    int accepted_encodings();
+    HTTP_CODE check_conditions();
+    HTTP_CODE parse_range();
+    bool if_range_matches( const char* etag );
+    void release_file();
     char* get_line() { return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
+    void finish_line();
 
     /* 下面这一组函数被 process_write 调用以填充 HTTP 应答 */
     void unmap();
+    bool add_file_slice( off_t offset, off_t len );
+    void keep_file_body();
+    bool add_ranges();
+    bool write_file();
+    bool write_done();
+    void reset_iovec();
+    bool add_iovec( const void* base, size_t len );
+    void advance_iovec( size_t bytes );
     bool add_response( const char* format, ... ); //?
     bool add_content( const char* content );
     bool add_status_line( int status, const char* title );
-    bool add_headers( int content_length );
-    bool add_content_length( int content_length );
+    bool add_headers( off_t content_length );
+    bool add_content_length( off_t content_length );
+    bool add_validators();
+    bool add_encoding();
     bool add_linger();
     bool add_blank_line();
+    bool add_text( const char* text, int len );
+    bool add_prerendered( const char* text, int len, int date_offset );
+    bool add_static_response( HTTP_CODE code );
 
 public: 
-    /* 所有 socket 上的事件都被注册到一个 epoll 内核事件表中，所以将 epoll 文件描述符设置为静态的 */
-    static int m_epollfd;
-    /* 统计用户数量 */
-    static int m_user_count;
+    /* 在启动时预先渲染固定应答，必须在处理第一个请求之前调用 */
+    static void init_static_responses();
+
+    /* 统计用户数量，连接在多个 reactor 线程和工作线程中建立和关闭 */
+    static std::atomic< int > m_user_count;
+    /* 处理中的请求数，见 begin_request */
+    static std::atomic< int > m_in_flight_count;
+    /* 所有连接共享的热点文件缓存，为空时每个请求都直接 mmap 目标文件 */
+    static file_cache* m_file_cache;
+    /* 所有连接共享的压缩版本缓存，为空时不做实时压缩，只发送预先压缩好的 .gz 文件 */
+    static variant_cache* m_variant_cache;
+    /* POST/PUT 消息体的处理函数，为空时消息体被读取后直接丢弃 */
+    static body_handler m_body_handler;
+    /* 所有连接的读写缓冲都从这个内存池中按需申请，连接空闲时归还 */
+    static buffer_pool* m_buffer_pool;
+    /* 交互式请求的路径前缀，例如健康检查，在启动时设置 */
+    static std::vector< std::string > m_interactive_paths;
+
+    /* 交给线程池的时刻，由线程池记录，用来统计排队时间 */
+    long long m_enqueue_ns;
+    /* 线程池中的优先级通道和处理期限（CLOCK_MONOTONIC 纳秒，0 表示没有期限），由 reactor 在交给线程池之前设置 */
+    int m_priority;
+    long long m_deadline_ns;
+
+private:
+    /* 预先渲染好的固定应答：完整的应答文本、其中头部的长度（HEAD 请求只发送头部）以及 Date 字段值的位置 */
+    struct static_response
+    {
+        std::string data;
+        int header_len;
+        int date_offset;
+    };
+    /* 按 HTTP_CODE 和是否保持连接索引，只有错误页面和空文件的应答有内容 */
+    static static_response m_static_responses[ CLOSED_CONNECTION ][ 2 ];
+    /* 过载时的 503 应答，总是关闭连接 */
+    static static_response m_unavailable_response;
 
 private:
     /* 该 HTTP 连接的 socket 和对方的 socket 地址*/
     int m_sockfd;
     sockaddr_in m_address;
+    /* 连接所属的 reactor 的 epoll 内核事件表，连接上的事件都注册在这里 */
+    int m_epollfd;
+    /* 是否有请求正在处理中，同一时刻只有持有连接的一个线程修改它 */
+    bool m_in_flight;
+    /* 已经由 linger_close 关闭了写的一方，等待对方关闭连接 */
+    bool m_lingering;
+    /* 连接上已经有应答发完并保持了连接，之后的请求是 keep-alive 的后续请求 */
+    bool m_kept_alive;
+    /* 读写缓冲使用的内存池。连接关闭时缓冲都已归还，下一次 init 可以换成别的内存池 */
+    buffer_pool* m_pool;
 
-    /* 读缓冲区 */
-    char m_read_buf[ READ_BUFFER_SIZE ];
+    /* 读缓冲区及其当前容量，没有待处理的请求数据时为空 */
+    char* m_read_buf;
+    size_t m_read_size;
     /* 表示读缓冲中已经读入的客户数据的最后一个字节的下一个位置 */
     int m_read_idx;
     /* 当前正在分析的字符在读缓冲区中的位置 */
     int m_checked_idx;
     /* 当前正在解析的行的起始位置 */
     int m_start_line;
-    /* 写缓冲区 */
-    char m_write_buf[ WRITE_BUFFER_SIZE ];
+    /* 正在扫描的行中第一个 ':' 的位置，-1 表示还没有找到，行不完整时保留到下一次继续扫描 */
+    int m_scan_colon;
+    /* 刚刚解析完成的那一行中第一个 ':' 的位置，-1 表示该行没有冒号 */
+    int m_line_colon;
+    /* 当前请求在读缓冲中的起始位置，在它之前的请求都已经解析完毕 */
+    int m_request_start;
+    /* 写缓冲区及其当前容量，只在组装和发送应答期间持有 */
+    char* m_write_buf;
+    size_t m_write_size;
     /* 写缓冲区中待发送的字节数 */
     int m_write_idx;
 
@@ -124,26 +283,78 @@ private:
     METHOD m_method;
 
     /* 客户请求的目标文件的完整路径，其内容等于 doc_root+m_url,doc_root 是网站根目录 */
-    char m_real_file[ FILENAME_LEN ];
+    char* m_real_file;
+    size_t m_real_file_size;
     /* 客户请求的目标文件的文件名 */
     char *m_url;
     /* HTTP 协议版本号，我们仅支持 HTTP/1.1 */
     char* m_version;
     /* 主机名 */
     char* m_host;
+    /* 识别出的请求头部的字段值，指向读缓冲内部。m_header_mask 中对应的位为 1 时该项才有效，
+    这样复位请求时只需要清零掩码 */
+    str_view m_headers[ HDR_COUNT ];
+    unsigned m_header_mask;
     /* HTTP 请求的消息体的长度 */
-    int m_content_length;
+    long m_content_length;
+    /* 消息体是否使用 chunked 编码 */
+    bool m_chunked;
+    /* chunked 消息体的解析状态 */
+    CHUNK_STATE m_chunk_state;
+    /* 消息体在读缓冲中的起始位置，已经交付的消息体会被移除，之后的数据前移到这里 */
+    int m_body_start;
+    /* 整个消息体（Content-Length）或者当前 chunk 还剩多少字节没有收到 */
+    long long m_body_left;
+    /* 是否已经开始向 m_body_handler 交付消息体且尚未结束 */
+    bool m_body_open;
     /* HTTP 请求是否要求保持连接 */
     bool m_linger;
+    /* 当前这一批应答中最后一个请求是否要求保持连接，决定发送完毕后是否关闭连接 */
+    bool m_response_linger;
 
     /* 客户请求的目标文件被 mmap 到内存中的起始位置 */
     char* m_file_address;
+    /* 如果目标文件来自文件缓存，则指向对应的缓存项，m_file_address 由缓存负责释放 */
+    file_cache_entry* m_file_entry;
+    /* 如果应答体是压缩版本缓存中的内容，则指向对应的缓存项，此时 m_file_address 指向压缩后的内容 */
+    variant_entry* m_variant;
+    /* 应答体的内容编码，以及应答是否需要带上 Vary: Accept-Encoding */
+    CONTENT_ENCODING m_encoding;
+    bool m_vary;
+    /* sendfile 模式下保持打开的目标文件，-1 表示应答体在 m_file_address 中 */
+    int m_file_fd;
+    /* sendfile 模式下下一次发送的文件偏移，以及文件还剩多少字节没有发送 */
+    off_t m_file_offset;
+    off_t m_file_send_left;
     /* 目标文件的状态，通过它我们可以判断文件是否存在、是否为目录，是否可读、并获取文件大小等信息 */
     struct stat m_file_stat;
+    /* 流水线的一批应答中每个文件体占用的映射，发送完成后由 unmap 统一释放 */
+    struct file_body
+    {
+        char* address;
+        off_t size;
+        file_cache_entry* entry;
+        variant_entry* variant;
+    };
+    file_body m_bodies[ MAX_PIPELINE ];
+    int m_body_count;
+    /* Range 请求中可以满足的区间（闭区间），m_range_count 为 0 表示发送整个文件 */
+    struct byte_range
+    {
+        off_t first;
+        off_t last;
+    };
+    byte_range m_ranges[ MAX_RANGES ];
+    int m_range_count;
 
-    /* 我们将采用 writev 来执行写操作，所以定义下面两个成员，其中 m_iv_count 表示被写内存块的数量 */
-    struct iovec m_iv[2];
+    /* 我们将采用 writev 来执行写操作，所以定义下面这组成员，其中 m_iv_count 表示被写内存块的数量，
+    m_iv_idx 是第一个还没有发送完的内存块，短写之后 advance_iovec 会把它和对应块的起始位置向后推进 */
+    struct iovec m_iv[ MAX_IOVEC ];
     int m_iv_count;
+    int m_iv_idx;
+    /* 本次应答还剩多少内存块字节没有发送，以及已经发送了多少字节（包括 sendfile 发送的部分） */
+    size_t m_bytes_to_send;
+    size_t m_bytes_have_send;
 };
 
 
@@ -0,0 +1,77 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <strings.h>
+
+
+/* 指向读缓冲内部的一段字符串，不拷贝，也不要求以 '\0' 结尾 */
+struct str_view
+{
+    const char* data;
+    int len;
+};
+
+/* 服务器能识别的请求头部：标识符和小写的字段名 */
+#define HTTP_HEADER_LIST( X ) \
+    X( HDR_ACCEPT, "accept" ) \
+    X( HDR_ACCEPT_ENCODING, "accept-encoding" ) \
+    X( HDR_ACCEPT_LANGUAGE, "accept-language" ) \
+    X( HDR_AUTHORIZATION, "authorization" ) \
+    X( HDR_CACHE_CONTROL, "cache-control" ) \
+    X( HDR_CONNECTION, "connection" ) \
+    X( HDR_CONTENT_LENGTH, "content-length" ) \
+    X( HDR_CONTENT_TYPE, "content-type" ) \
+    X( HDR_COOKIE, "cookie" ) \
+    X( HDR_EXPECT, "expect" ) \
+    X( HDR_HOST, "host" ) \
+    X( HDR_IF_MATCH, "if-match" ) \
+    X( HDR_IF_MODIFIED_SINCE, "if-modified-since" ) \
+    X( HDR_IF_NONE_MATCH, "if-none-match" ) \
+    X( HDR_IF_RANGE, "if-range" ) \
+    X( HDR_RANGE, "range" ) \
+    X( HDR_REFERER, "referer" ) \
+    X( HDR_TRANSFER_ENCODING, "transfer-encoding" ) \
+    X( HDR_UPGRADE, "upgrade" ) \
+    X( HDR_USER_AGENT, "user-agent" )
+
+#define HTTP_HEADER_ENUM( id, name ) id,
+enum HEADER_NAME
+{
+    HTTP_HEADER_LIST( HTTP_HEADER_ENUM )
+    HDR_COUNT,
+    HDR_UNKNOWN = HDR_COUNT
+};
+#undef HTTP_HEADER_ENUM
+
+constexpr unsigned header_lower( char c )
+{
+    return ( unsigned char )( ( ( c >= 'A' ) && ( c <= 'Z' ) ) ? ( c + ( 'a' - 'A' ) ) : c );
+}
+
+/* 字段名的哈希：由长度、首字符和尾字符（均不区分大小写）拼成，O(1) 计算。它对上面的字段名集合是完美哈希，
+header_lookup 中把每个字段名的哈希值作为 case 标签，一旦新增的字段名发生冲突，重复的 case 标签会直接导致编译失败 */
+constexpr unsigned header_key( const char* name, int len )
+{
+    return ( ( unsigned )len << 16 ) | ( header_lower( name[0] ) << 8 ) | header_lower( name[ len - 1 ] );
+}
+
+/* 根据字段名查找头部标识，哈希命中后再做一次不区分大小写的完整比较 */
+inline HEADER_NAME header_lookup( const char* name, int len )
+{
+    if ( len <= 0 )
+    {
+        return HDR_UNKNOWN;
+    }
+#define HTTP_HEADER_CASE( id, str ) \
+    case header_key( str, sizeof( str ) - 1 ): \
+        return ( strncasecmp( name, str, len ) == 0 ) ? id : HDR_UNKNOWN;
+    switch ( header_key( name, len ) )
+    {
+        HTTP_HEADER_LIST( HTTP_HEADER_CASE )
+        default:
+            return HDR_UNKNOWN;
+    }
+#undef HTTP_HEADER_CASE
+}
+
+#endif
@@ -0,0 +1,193 @@
+/* 对运行中的服务器做端到端的压力测试：单线程用 epoll 维持 -c 个 keep-alive 连接，每个连接收到完整的应答后
+立即发送下一个请求，直到一共完成 -n 个请求。最后输出吞吐量、非 200 应答数和每个请求往返时间的分位数。
+编译运行：g++ -O2 -o http_load_bench http_load_bench.cpp && ./http_load_bench -c 64 -n 200000 -P 12345 /index.html */
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static const int MAX_EVENTS = 256;
+
+struct client
+{
+    int fd;
+    std::string received;  // 还没有解析完的应答数据
+    double sent_at;        // 当前请求的发送时刻
+};
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 从 received 的开头取出一个完整的应答，返回状态码；不完整时返回 0 */
+static int take_response( std::string& received )
+{
+    size_t end = received.find( "\r\n\r\n" );
+    if ( ( end == std::string::npos ) || ( received.size() < 12 ) )
+    {
+        return 0;
+    }
+    size_t length = 0;
+    size_t field = received.find( "Content-Length: " );
+    if ( ( field != std::string::npos ) && ( field < end ) )
+    {
+        length = strtoul( received.c_str() + field + 16, NULL, 10 );
+    }
+    if ( received.size() < end + 4 + length )
+    {
+        return 0;
+    }
+    int status = atoi( received.c_str() + 9 );
+    received.erase( 0, end + 4 + length );
+    return status;
+}
+
+static bool send_request( client& c, const std::string& request )
+{
+    c.sent_at = now_sec();
+    return send( c.fd, request.data(), request.size(), MSG_NOSIGNAL ) == ( ssize_t )request.size();
+}
+
+int main( int argc, char* argv[] )
+{
+    int connections = 64;
+    long requests = 100000;
+    const char* ip = "127.0.0.1";
+    int port = 12345;
+    int opt = 0;
+    while ( ( opt = getopt( argc, argv, "c:n:h:P:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'c': connections = atoi( optarg ); break;
+            case 'n': requests = atol( optarg ); break;
+            case 'h': ip = optarg; break;
+            case 'P': port = atoi( optarg ); break;
+            default:
+                printf( "usage: %s [-c connections] [-n requests] [-h ip] [-P port] [path]\n", argv[0] );
+                return 1;
+        }
+    }
+    const char* path = ( optind < argc ) ? argv[ optind ] : "/index.html";
+    if ( ( connections <= 0 ) || ( requests <= 0 ) )
+    {
+        return 1;
+    }
+    std::string request = std::string( "GET " ) + path + " HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+
+    struct sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+    inet_pton( AF_INET, ip, &address.sin_addr );
+
+    int epollfd = epoll_create( 5 );
+    std::vector< client > clients( connections );
+    std::vector< float > latencies;
+    latencies.reserve( requests );
+    long issued = 0;
+    long completed = 0;
+    long failed = 0;
+    int open = 0;
+    for ( int i = 0; i < connections; ++i )
+    {
+        clients[i].fd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+        if ( ( connect( clients[i].fd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 ) && ( errno != EINPROGRESS ) )
+        {
+            perror( "connect" );
+            return 1;
+        }
+        epoll_event event;
+        event.data.u32 = i;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        epoll_ctl( epollfd, EPOLL_CTL_ADD, clients[i].fd, &event );
+        ++open;
+    }
+    /* 非阻塞 connect 在本机上很快完成，等一下再发送第一批请求 */
+    usleep( 100000 );
+
+    double begin = now_sec();
+    for ( int i = 0; ( i < connections ) && ( issued < requests ); ++i, ++issued )
+    {
+        send_request( clients[i], request );
+    }
+    epoll_event events[ MAX_EVENTS ];
+    char buf[ 65536 ];
+    while ( ( completed < requests ) && ( open > 0 ) )
+    {
+        int number = epoll_wait( epollfd, events, MAX_EVENTS, 5000 );
+        if ( number <= 0 )
+        {
+            printf( "no response for 5 s, %ld requests outstanding\n", issued - completed );
+            break;
+        }
+        for ( int i = 0; i < number; ++i )
+        {
+            client& c = clients[ events[i].data.u32 ];
+            ssize_t n;
+            while ( ( n = recv( c.fd, buf, sizeof( buf ), 0 ) ) > 0 )
+            {
+                c.received.append( buf, n );
+            }
+            int status;
+            while ( ( status = take_response( c.received ) ) != 0 )
+            {
+                latencies.push_back( ( float )( now_sec() - c.sent_at ) );
+                ++completed;
+                if ( status != 200 )
+                {
+                    ++failed;
+                }
+                if ( issued < requests )
+                {
+                    send_request( c, request );
+                    ++issued;
+                }
+            }
+            /* 服务器关闭了连接，这个连接上未完成的请求不再计入 */
+            if ( ( n == 0 ) || ( ( n < 0 ) && ( errno != EAGAIN ) ) )
+            {
+                epoll_ctl( epollfd, EPOLL_CTL_DEL, c.fd, 0 );
+                close( c.fd );
+                c.fd = -1;
+                --open;
+            }
+        }
+    }
+    double elapsed = now_sec() - begin;
+
+    std::sort( latencies.begin(), latencies.end() );
+    printf( "%d connections, %ld requests in %.2f s: %.0f requests/s, %ld non-200\n", connections, completed, elapsed,
+        completed / elapsed, failed );
+    if ( !latencies.empty() )
+    {
+        const double points[] = { 50, 90, 99, 99.9 };
+        for ( unsigned i = 0; i < sizeof( points ) / sizeof( points[0] ); ++i )
+        {
+            size_t index = ( size_t )( points[i] / 100 * ( latencies.size() - 1 ) );
+            printf( "  p%-5g %8.1f us\n", points[i], latencies[ index ] * 1e6 );
+        }
+    }
+    for ( int i = 0; i < connections; ++i )
+    {
+        if ( clients[i].fd != -1 )
+        {
+            close( clients[i].fd );
+        }
+    }
+    close( epollfd );
+    return ( completed == requests ) && ( failed == 0 ) ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#include "http_response.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <atomic>
+
+
+const char* encoding_names[] = { "identity", "gzip", "deflate" };
+
+/* 缓存的 Date 字符串用顺序锁保护：写者在改写前后各把序号加一，读者拷贝前后序号相同且为偶数才说明没有读到
+写了一半的内容。字符串按 8 字节一组存成原子变量，读写都不需要加锁 */
+static const int DATE_WORDS = ( HTTP_DATE_LEN + 7 ) / 8;
+static std::atomic< unsigned > date_seq( 0 );
+static std::atomic< unsigned long long > date_words[ DATE_WORDS ];
+
+void http_date( char* buf )
+{
+    unsigned long long words[ DATE_WORDS ];
+    unsigned seq = 0;
+    do
+    {
+        seq = date_seq.load( std::memory_order_acquire );
+        if ( seq == 0 )
+        {
+            /* 事件循环还没有开始刷新 */
+            char date[ 64 ];
+            format_http_date( time( NULL ), date, sizeof( date ) );
+            memcpy( buf, date, HTTP_DATE_LEN );
+            return;
+        }
+        for ( int i = 0; i < DATE_WORDS; ++i )
+        {
+            words[i] = date_words[i].load( std::memory_order_relaxed );
+        }
+        std::atomic_thread_fence( std::memory_order_acquire );
+    } while ( ( seq & 1 ) || ( seq != date_seq.load( std::memory_order_relaxed ) ) );
+    memcpy( buf, words, HTTP_DATE_LEN );
+}
+
+void http_date_tick( time_t now )
+{
+    char date[ DATE_WORDS * 8 ] = "";
+    format_http_date( now, date, sizeof( date ) );
+    unsigned long long words[ DATE_WORDS ];
+    memcpy( words, date, sizeof( words ) );
+
+    unsigned seq = date_seq.load( std::memory_order_relaxed );
+    date_seq.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    for ( int i = 0; i < DATE_WORDS; ++i )
+    {
+        date_words[i].store( words[i], std::memory_order_relaxed );
+    }
+    date_seq.store( seq + 2, std::memory_order_release );
+}
+
+void format_http_date( time_t t, char* buf, int size )
+{
+    struct tm tm;
+    gmtime_r( &t, &tm );
+    strftime( buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm );
+}
+
+int format_etag( const struct stat& st, CONTENT_ENCODING encoding, char* buf, int size )
+{
+    unsigned long long mtime = ( unsigned long long )st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    if ( encoding != ENCODING_IDENTITY )
+    {
+        return snprintf( buf, size, "\"%llx-%llx-%llx-%s\"", ( unsigned long long )st.st_ino,
+            ( unsigned long long )st.st_size, mtime, encoding_names[ encoding ] );
+    }
+    return snprintf( buf, size, "\"%llx-%llx-%llx\"", ( unsigned long long )st.st_ino,
+        ( unsigned long long )st.st_size, mtime );
+}
+
+bool compressible_type( const char* path )
+{
+    static const char* types[] = { ".html", ".htm", ".css", ".js", ".json", ".txt", ".xml", ".svg", ".csv", ".md", NULL };
+    const char* ext = strrchr( path, '.' );
+    if ( !ext || strchr( ext, '/' ) )
+    {
+        return false;
+    }
+    for ( int i = 0; types[i]; ++i )
+    {
+        if ( strcasecmp( ext, types[i] ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 字段的顺序与 http_conn 逐项格式化文件应答时相同 */
+int render_file_header( char* buf, int size, const struct stat& st, CONTENT_ENCODING encoding, bool vary )
+{
+    char etag[ 64 ];
+    char modified[ 64 ];
+    format_etag( st, encoding, etag, sizeof( etag ) );
+    format_http_date( st.st_mtime, modified, sizeof( modified ) );
+    char content_encoding[ 64 ] = "";
+    if ( encoding != ENCODING_IDENTITY )
+    {
+        snprintf( content_encoding, sizeof( content_encoding ), "Content-Encoding: %s\r\n", encoding_names[ encoding ] );
+    }
+
+    int len = snprintf( buf, size, "%s%*s\r\nAccept-Ranges: bytes\r\n%sETag: %s\r\nLast-Modified: %s\r\n%sContent-Length: %lld\r\n",
+        "HTTP/1.1 200 OK\r\nDate: ", HTTP_DATE_LEN, "", vary ? "Vary: Accept-Encoding\r\n" : "", etag, modified, content_encoding,
+        ( long long )st.st_size );
+    if ( ( len < 0 ) || ( len >= size ) )
+    {
+        return -1;
+    }
+    return len;
+}
@@ -0,0 +1,34 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "variant_cache.h"
+
+
+/* HTTP-date 固定为 29 个字符，例如 "Sun, 06 Nov 1994 08:49:37 GMT" */
+const int HTTP_DATE_LEN = 29;
+/* 预先渲染的文件应答头部以 "HTTP/1.1 200 OK\r\nDate: " 开头，Date 的字段值从这个位置开始 */
+const int FILE_HEADER_DATE_OFFSET = 23;
+
+/* 内容编码在 Content-Encoding 头部和 ETag 中使用的名字 */
+extern const char* encoding_names[];
+
+/* 当前时间的 HTTP-date，写入 buf 的 HTTP_DATE_LEN 个字节（不写 '\0'）。读取的是 http_date_tick 缓存的字符串，
+不加锁也不做格式化；还没有调用过 http_date_tick 时退回到直接格式化 */
+void http_date( char* buf );
+/* 由事件循环每秒调用一次，刷新进程内共享的 Date 字符串。同一时刻只能有一个线程调用 */
+void http_date_tick( time_t now );
+/* 把时间格式化成 HTTP-date */
+void format_http_date( time_t t, char* buf, int size );
+/* 由 inode、大小和修改时间（纳秒）组成的强 ETag，压缩版本带上编码名。返回写入的长度 */
+int format_etag( const struct stat& st, CONTENT_ENCODING encoding, char* buf, int size );
+/* 按扩展名判断文件是否是值得压缩的文本类型 */
+bool compressible_type( const char* path );
+/* 渲染文件应答从状态行到 Content-Length 的全部头部（不含 Connection 和结尾的空行），Date 字段留空，
+发送时再填入当前时间。st.st_size 是应答体的长度。返回写入的长度，缓冲区不够时返回 -1 */
+int render_file_header( char* buf, int size, const struct stat& st, CONTENT_ENCODING encoding, bool vary );
+
+#endif
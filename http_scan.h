@@ -0,0 +1,79 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+
+/* HTTP 请求的行扫描器：一次比较 32 字节（AVX2）或 16 字节（SSE2），在 [begin, end) 中找到第一个 '\r' 或 '\n'，
+找不到时返回 end。*colon 为空时顺便记录行尾之前第一个 ':' 的位置，供头部解析直接切分字段名和字段值 */
+inline const char* scan_line( const char* begin, const char* end, const char** colon )
+{
+    const char* p = begin;
+
+#if defined( __AVX2__ )
+    const __m256i cr32 = _mm256_set1_epi8( '\r' );
+    const __m256i lf32 = _mm256_set1_epi8( '\n' );
+    const __m256i co32 = _mm256_set1_epi8( ':' );
+    for ( ; p + 32 <= end; p += 32 )
+    {
+        __m256i chunk = _mm256_loadu_si256( ( const __m256i* )p );
+        unsigned eol = ( unsigned )_mm256_movemask_epi8(
+            _mm256_or_si256( _mm256_cmpeq_epi8( chunk, cr32 ), _mm256_cmpeq_epi8( chunk, lf32 ) ) );
+        if ( !*colon )
+        {
+            unsigned co = ( unsigned )_mm256_movemask_epi8( _mm256_cmpeq_epi8( chunk, co32 ) );
+            /* 只关心行尾之前的冒号 */
+            if ( eol )
+                co &= ( eol & ( 0u - eol ) ) - 1;
+            if ( co )
+                *colon = p + __builtin_ctz( co );
+        }
+        if ( eol )
+        {
+            return p + __builtin_ctz( eol );
+        }
+    }
+#endif
+
+#if defined( __SSE2__ )
+    const __m128i cr16 = _mm_set1_epi8( '\r' );
+    const __m128i lf16 = _mm_set1_epi8( '\n' );
+    const __m128i co16 = _mm_set1_epi8( ':' );
+    for ( ; p + 16 <= end; p += 16 )
+    {
+        __m128i chunk = _mm_loadu_si128( ( const __m128i* )p );
+        unsigned eol = ( unsigned )_mm_movemask_epi8(
+            _mm_or_si128( _mm_cmpeq_epi8( chunk, cr16 ), _mm_cmpeq_epi8( chunk, lf16 ) ) );
+        if ( !*colon )
+        {
+            unsigned co = ( unsigned )_mm_movemask_epi8( _mm_cmpeq_epi8( chunk, co16 ) );
+            if ( eol )
+                co &= ( eol & ( 0u - eol ) ) - 1;
+            if ( co )
+                *colon = p + __builtin_ctz( co );
+        }
+        if ( eol )
+        {
+            return p + __builtin_ctz( eol );
+        }
+    }
+#endif
+
+    /* 不足一个向量宽度的尾部，以及不支持 SIMD 的平台，逐字节扫描 */
+    for ( ; p < end; ++p )
+    {
+        if ( ( *p == '\r' ) || ( *p == '\n' ) )
+        {
+            return p;
+        }
+        if ( ( *p == ':' ) && !*colon )
+        {
+            *colon = p;
+        }
+    }
+    return end;
+}
+
+#endif
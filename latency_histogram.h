@@ -0,0 +1,169 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdio.h>
+#include <atomic>
+
+
+/* HDR 风格的对数-线性直方图，记录以纳秒为单位的时长。小于 SUB_COUNT 的值各占一个桶，之后每个 2 的幂区间
+再等分成 SUB_COUNT 个桶，所以任何值的相对误差都不超过 1/SUB_COUNT，而桶数只随量程的对数增长。
+只能有一个线程记录（工作线程各自记录自己的直方图），其他线程随时可以读取，读取时合并成 latency_snapshot */
+class latency_histogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    /* 最大可区分的值约为 2^36 纳秒（68 秒），更大的值都记在最后一个桶中 */
+    static const int MAX_SHIFT = 36 - SUB_BITS - 1;
+    static const int BUCKETS = ( MAX_SHIFT + 2 ) * SUB_COUNT;
+
+public:
+    latency_histogram()
+    {
+        for ( int i = 0; i < BUCKETS; ++i )
+        {
+            m_counts[i].store( 0, std::memory_order_relaxed );
+        }
+        m_sum.store( 0, std::memory_order_relaxed );
+        m_max.store( 0, std::memory_order_relaxed );
+    }
+
+    /* 只有一个写者，读-改-写不需要原子指令，relaxed 的 load/store 保证读者不会读到撕裂的值 */
+    void record( unsigned long long value )
+    {
+        std::atomic< unsigned long >& count = m_counts[ bucket( value ) ];
+        count.store( count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        m_sum.store( m_sum.load( std::memory_order_relaxed ) + value, std::memory_order_relaxed );
+        if ( value > m_max.load( std::memory_order_relaxed ) )
+        {
+            m_max.store( value, std::memory_order_relaxed );
+        }
+    }
+
+    static int bucket( unsigned long long value )
+    {
+        if ( value < ( unsigned long long )SUB_COUNT )
+        {
+            return ( int )value;
+        }
+        int shift = 63 - __builtin_clzll( value ) - SUB_BITS;
+        if ( shift > MAX_SHIFT )
+        {
+            return BUCKETS - 1;
+        }
+        return ( shift + 1 ) * SUB_COUNT + ( int )( ( value >> shift ) - SUB_COUNT );
+    }
+
+    /* 桶中最大的值 */
+    static unsigned long long bucket_limit( int index )
+    {
+        if ( index < SUB_COUNT )
+        {
+            return ( unsigned long long )index;
+        }
+        int shift = index / SUB_COUNT - 1;
+        unsigned long long low = ( unsigned long long )( SUB_COUNT + index % SUB_COUNT ) << shift;
+        return low + ( 1ULL << shift ) - 1;
+    }
+
+private:
+    latency_histogram( const latency_histogram& );
+    latency_histogram& operator=( const latency_histogram& );
+
+    friend class latency_snapshot;
+    std::atomic< unsigned long > m_counts[ BUCKETS ];
+    std::atomic< unsigned long long > m_sum;
+    std::atomic< unsigned long long > m_max;
+};
+
+
+/* 若干个直方图在某一时刻的合并结果。两次快照相减得到这段时间内的分布 */
+class latency_snapshot
+{
+public:
+    latency_snapshot() { clear(); }
+
+    void clear()
+    {
+        for ( int i = 0; i < latency_histogram::BUCKETS; ++i )
+        {
+            m_counts[i] = 0;
+        }
+        m_total = 0;
+        m_sum = 0;
+        m_max = 0;
+    }
+
+    /* 累加一个正在记录的直方图，读到的是各个桶在读取那一刻的值 */
+    void add( const latency_histogram& h )
+    {
+        for ( int i = 0; i < latency_histogram::BUCKETS; ++i )
+        {
+            unsigned long n = h.m_counts[i].load( std::memory_order_relaxed );
+            m_counts[i] += n;
+            m_total += n;
+        }
+        m_sum += h.m_sum.load( std::memory_order_relaxed );
+        unsigned long long max = h.m_max.load( std::memory_order_relaxed );
+        if ( max > m_max )
+        {
+            m_max = max;
+        }
+    }
+
+    /* 减去更早的一次快照。最大值无法相减，保留的是从开始到现在的最大值 */
+    void subtract( const latency_snapshot& older )
+    {
+        m_total = 0;
+        for ( int i = 0; i < latency_histogram::BUCKETS; ++i )
+        {
+            m_counts[i] -= older.m_counts[i];
+            m_total += m_counts[i];
+        }
+        m_sum -= older.m_sum;
+    }
+
+    unsigned long count() const { return m_total; }
+    unsigned long long max() const { return m_max; }
+    unsigned long long mean() const { return m_total ? m_sum / m_total : 0; }
+
+    /* 第 percent 百分位所在的桶的上界，没有记录时返回 0 */
+    unsigned long long percentile( double percent ) const
+    {
+        if ( m_total == 0 )
+        {
+            return 0;
+        }
+        unsigned long rank = ( unsigned long )( m_total * percent / 100.0 );
+        if ( rank < 1 )
+        {
+            rank = 1;
+        }
+        unsigned long seen = 0;
+        for ( int i = 0; i < latency_histogram::BUCKETS; ++i )
+        {
+            seen += m_counts[i];
+            if ( seen >= rank )
+            {
+                return latency_histogram::bucket_limit( i );
+            }
+        }
+        return m_max;
+    }
+
+    /* 打印一行：次数、平均值和常用的百分位，单位为微秒 */
+    void print( FILE* out, const char* name ) const
+    {
+        fprintf( out, "%s: count %lu mean %.1f p50 %.1f p90 %.1f p99 %.1f p999 %.1f max %.1f us\n", name, m_total,
+            mean() / 1000.0, percentile( 50 ) / 1000.0, percentile( 90 ) / 1000.0, percentile( 99 ) / 1000.0,
+            percentile( 99.9 ) / 1000.0, m_max / 1000.0 );
+    }
+
+private:
+    unsigned long m_counts[ latency_histogram::BUCKETS ];
+    unsigned long m_total;
+    unsigned long long m_sum;
+    unsigned long long m_max;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+
+#include "14-2_locker.h"
+
+
+/* file_cache 和 variant_cache 共用的带引用计数的 LRU 表。缓存项类型 T 要有公有成员 int refcount、bool linked
+和 T* prev、T* next；策略类 P 提供三个静态函数：key( entry ) 返回缓存项的键，bytes( entry ) 返回它计入字节预算的大小，
+destroy( entry ) 在最后一个引用释放时回收它。
+缓存自身持有每个在表中的项的一个引用，连接通过 lookup/insert 再各自持有一个。超出预算或失效时只是把项摘出表，
+仍被引用的项要等最后一个 release 才回收，所以正在发送的内容不会被释放 */
+template< typename T, typename P >
+class lru_cache
+{
+public:
+    explicit lru_cache( size_t max_bytes );
+    ~lru_cache();
+
+    /* 查找 key，命中时先用 check( entry ) 判断是否仍然有效（在锁内调用），有效则移到表头、增加引用计数后返回；
+    未命中或者已经失效时返回 NULL，失效的项被摘除 */
+    template< typename C >
+    T* lookup( const std::string& key, C& check );
+    /* 放入一个新建的项，同键的旧项被摘除，随后按预算淘汰。返回的项带有调用者的引用 */
+    T* insert( T* entry );
+    /* 释放 lookup/insert 得到的引用 */
+    void release( T* entry );
+
+    size_t max_bytes() const { return m_max_bytes; }
+
+private:
+    /* 以下函数的调用者必须持有 m_lock */
+    void unlink( T* entry );
+    void put( T* entry );
+    void touch( T* entry );
+    void evict();
+
+private:
+    size_t m_max_bytes;  // 缓存项的总字节数上限
+    size_t m_bytes;      // 当前表中缓存项的总字节数
+    std::unordered_map< std::string, T* > m_table;
+    T* m_head;           // 最近使用
+    T* m_tail;           // 最久未使用，淘汰从这里开始
+    locker m_lock;
+};
+
+template< typename T, typename P >
+lru_cache< T, P >::lru_cache( size_t max_bytes ):
+    m_max_bytes( max_bytes ), m_bytes( 0 ), m_head( NULL ), m_tail( NULL )
+{
+}
+
+template< typename T, typename P >
+lru_cache< T, P >::~lru_cache()
+{
+    m_lock.lock();
+    while ( m_tail )
+    {
+        unlink( m_tail );
+    }
+    m_lock.unlock();
+}
+
+/* 将缓存项从哈希表和 LRU 链表中摘除，并释放缓存自身持有的引用 */
+template< typename T, typename P >
+void lru_cache< T, P >::unlink( T* entry )
+{
+    if ( !entry->linked )
+    {
+        return;
+    }
+    m_table.erase( P::key( entry ) );
+    if ( entry->prev )
+        entry->prev->next = entry->next;
+    else
+        m_head = entry->next;
+    if ( entry->next )
+        entry->next->prev = entry->prev;
+    else
+        m_tail = entry->prev;
+    entry->prev = entry->next = NULL;
+    entry->linked = false;
+    m_bytes -= P::bytes( entry );
+
+    if ( --entry->refcount == 0 )
+    {
+        P::destroy( entry );
+    }
+}
+
+/* 插入到 LRU 链表头部 */
+template< typename T, typename P >
+void lru_cache< T, P >::put( T* entry )
+{
+    entry->prev = NULL;
+    entry->next = m_head;
+    if ( m_head )
+        m_head->prev = entry;
+    m_head = entry;
+    if ( !m_tail )
+        m_tail = entry;
+    entry->linked = true;
+    m_table[ P::key( entry ) ] = entry;
+    m_bytes += P::bytes( entry );
+}
+
+template< typename T, typename P >
+void lru_cache< T, P >::touch( T* entry )
+{
+    if ( entry == m_head )
+    {
+        return;
+    }
+    entry->prev->next = entry->next;
+    if ( entry->next )
+        entry->next->prev = entry->prev;
+    else
+        m_tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = m_head;
+    m_head->prev = entry;
+    m_head = entry;
+}
+
+/* 超出字节预算时从链表尾部淘汰，刚放入的表头一项总是保留 */
+template< typename T, typename P >
+void lru_cache< T, P >::evict()
+{
+    while ( ( m_bytes > m_max_bytes ) && m_tail && ( m_tail != m_head ) )
+    {
+        unlink( m_tail );
+    }
+}
+
+template< typename T, typename P >
+template< typename C >
+T* lru_cache< T, P >::lookup( const std::string& key, C& check )
+{
+    m_lock.lock();
+    typename std::unordered_map< std::string, T* >::iterator it = m_table.find( key );
+    if ( it == m_table.end() )
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+
+    T* entry = it->second;
+    if ( !check( entry ) )
+    {
+        unlink( entry );
+        m_lock.unlock();
+        return NULL;
+    }
+    touch( entry );
+    entry->refcount++;
+    m_lock.unlock();
+    return entry;
+}
+
+template< typename T, typename P >
+T* lru_cache< T, P >::insert( T* entry )
+{
+    entry->refcount = 2;  // 一个属于缓存，一个属于调用者
+    entry->linked = false;
+    entry->prev = entry->next = NULL;
+
+    m_lock.lock();
+    /* 其他线程可能已经插入了同一个键，以新的为准 */
+    typename std::unordered_map< std::string, T* >::iterator it = m_table.find( P::key( entry ) );
+    if ( it != m_table.end() )
+    {
+        unlink( it->second );
+    }
+    put( entry );
+    evict();
+    m_lock.unlock();
+    return entry;
+}
+
+template< typename T, typename P >
+void lru_cache< T, P >::release( T* entry )
+{
+    m_lock.lock();
+    if ( --entry->refcount == 0 )
+    {
+        P::destroy( entry );
+    }
+    m_lock.unlock();
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+
+
+/* 有界的多生产者多消费者无锁环形队列（Dmitry Vyukov 的算法），元素是 T 类型的指针。
+每个槽位带一个序号：序号等于入队位置时槽位可写，等于入队位置加一时槽位可读。生产者和消费者各自用一次 CAS
+抢占位置，之后只访问自己抢到的槽位，入队和出队都不需要分配内存。队头和队尾的下标各占一条缓存行，
+避免生产者和消费者互相使对方的缓存行失效 */
+template< typename T >
+class mpmc_queue
+{
+public:
+    static const size_t CACHE_LINE = 64;
+
+public:
+    /* 容量向上取整到 2 的幂 */
+    explicit mpmc_queue( size_t capacity )
+    {
+        m_capacity = 2;
+        while ( m_capacity < capacity )
+        {
+            m_capacity <<= 1;
+        }
+        m_mask = m_capacity - 1;
+        m_cells = new cell[ m_capacity ];
+        if ( !m_cells )
+        {
+            throw std::exception();
+        }
+        for ( size_t i = 0; i < m_capacity; ++i )
+        {
+            m_cells[i].sequence.store( i, std::memory_order_relaxed );
+            m_cells[i].data = NULL;
+        }
+        m_enqueue_pos.store( 0, std::memory_order_relaxed );
+        m_dequeue_pos.store( 0, std::memory_order_relaxed );
+    }
+
+    ~mpmc_queue()
+    {
+        delete []m_cells;
+    }
+
+    /* 队列已满时返回 false */
+    bool push( T* data )
+    {
+        cell* c;
+        size_t pos = m_enqueue_pos.load( std::memory_order_relaxed );
+        while ( true )
+        {
+            c = &m_cells[ pos & m_mask ];
+            size_t seq = c->sequence.load( std::memory_order_acquire );
+            intptr_t diff = ( intptr_t )seq - ( intptr_t )pos;
+            if ( diff == 0 )
+            {
+                if ( m_enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    break;
+                }
+            }
+            else if ( diff < 0 )
+            {
+                /* 这个槽位还没有被上一轮的消费者取走 */
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue_pos.load( std::memory_order_relaxed );
+            }
+        }
+        c->data = data;
+        c->sequence.store( pos + 1, std::memory_order_release );
+        return true;
+    }
+
+    /* 一次放入 data 开头的若干个元素：只用一次 CAS 占住一段连续的槽位。返回放入的个数，队列剩余空间不足时
+    只放入前面的一部分 */
+    size_t push_bulk( T* const* data, size_t n )
+    {
+        size_t count = 0;
+        size_t pos = m_enqueue_pos.load( std::memory_order_relaxed );
+        while ( n > 0 )
+        {
+            /* 从 pos 开始数出连续可写的槽位 */
+            count = 0;
+            intptr_t diff = 0;
+            while ( count < n )
+            {
+                size_t seq = m_cells[ ( pos + count ) & m_mask ].sequence.load( std::memory_order_acquire );
+                diff = ( intptr_t )seq - ( intptr_t )( pos + count );
+                if ( diff != 0 )
+                {
+                    break;
+                }
+                ++count;
+            }
+            if ( count == 0 )
+            {
+                if ( diff < 0 )
+                {
+                    return 0;
+                }
+                /* 其他生产者已经占用了 pos，重新读取 */
+                pos = m_enqueue_pos.load( std::memory_order_relaxed );
+                continue;
+            }
+            if ( m_enqueue_pos.compare_exchange_weak( pos, pos + count, std::memory_order_relaxed ) )
+            {
+                break;
+            }
+        }
+        for ( size_t i = 0; i < count; ++i )
+        {
+            cell* c = &m_cells[ ( pos + i ) & m_mask ];
+            c->data = data[i];
+            c->sequence.store( pos + i + 1, std::memory_order_release );
+        }
+        return count;
+    }
+
+    /* 队列为空时返回 false */
+    bool pop( T*& data )
+    {
+        cell* c;
+        size_t pos = m_dequeue_pos.load( std::memory_order_relaxed );
+        while ( true )
+        {
+            c = &m_cells[ pos & m_mask ];
+            size_t seq = c->sequence.load( std::memory_order_acquire );
+            intptr_t diff = ( intptr_t )seq - ( intptr_t )( pos + 1 );
+            if ( diff == 0 )
+            {
+                if ( m_dequeue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                {
+                    break;
+                }
+            }
+            else if ( diff < 0 )
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_dequeue_pos.load( std::memory_order_relaxed );
+            }
+        }
+        data = c->data;
+        /* 槽位留给下一轮同一位置的生产者 */
+        c->sequence.store( pos + m_mask + 1, std::memory_order_release );
+        return true;
+    }
+
+    /* 队列中的元素个数，并发修改时只是一个近似值 */
+    size_t size() const
+    {
+        size_t tail = m_enqueue_pos.load( std::memory_order_relaxed );
+        size_t head = m_dequeue_pos.load( std::memory_order_relaxed );
+        return ( tail > head ) ? tail - head : 0;
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    mpmc_queue( const mpmc_queue& );
+    mpmc_queue& operator=( const mpmc_queue& );
+
+private:
+    struct cell
+    {
+        std::atomic< size_t > sequence;
+        T* data;
+    };
+
+    /* 只读的字段和两个下标分开放在不同的缓存行中 */
+    char m_pad0[ CACHE_LINE ];
+    cell* m_cells;
+    size_t m_capacity;
+    size_t m_mask;
+    char m_pad1[ CACHE_LINE - sizeof( cell* ) - 2 * sizeof( size_t ) ];
+    std::atomic< size_t > m_enqueue_pos;
+    char m_pad2[ CACHE_LINE - sizeof( std::atomic< size_t > ) ];
+    std::atomic< size_t > m_dequeue_pos;
+    char m_pad3[ CACHE_LINE - sizeof( std::atomic< size_t > ) ];
+};
+
+#endif
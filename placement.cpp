@@ -0,0 +1,128 @@
+#include "placement.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+
+int parse_cpu_list( const char* arg, int* cpus, int max )
+{
+    int count = 0;
+    const char* p = arg;
+    while ( *p )
+    {
+        char* end = NULL;
+        long first = strtol( p, &end, 10 );
+        if ( ( end == p ) || ( first < 0 ) || ( first >= MAX_CPUS ) )
+        {
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if ( *p == '-' )
+        {
+            ++p;
+            last = strtol( p, &end, 10 );
+            if ( ( end == p ) || ( last < first ) || ( last >= MAX_CPUS ) )
+            {
+                return -1;
+            }
+            p = end;
+        }
+        for ( long cpu = first; cpu <= last; ++cpu )
+        {
+            if ( count >= max )
+            {
+                return -1;
+            }
+            cpus[ count++ ] = ( int )cpu;
+        }
+        if ( *p == ',' )
+        {
+            ++p;
+        }
+        else if ( *p )
+        {
+            return -1;
+        }
+    }
+    return ( count > 0 ) ? count : -1;
+}
+
+bool pin_current_thread( int cpu )
+{
+    if ( ( cpu < 0 ) || ( cpu >= CPU_SETSIZE ) )
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+}
+
+/* CPU 的目录下有一个名为 nodeN 的链接指向它所在的节点 */
+int cpu_node( int cpu )
+{
+    char path[ 64 ];
+    snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d", cpu );
+    DIR* dir = opendir( path );
+    if ( !dir )
+    {
+        return 0;
+    }
+    int node = 0;
+    struct dirent* entry;
+    while ( ( entry = readdir( dir ) ) != NULL )
+    {
+        int n = 0;
+        if ( ( sscanf( entry->d_name, "node%d", &n ) == 1 ) && ( n >= 0 ) && ( n < MAX_NODES ) )
+        {
+            node = n;
+            break;
+        }
+    }
+    closedir( dir );
+    return node;
+}
+
+int home_worker( int cpu, const int* worker_cpus, int cpu_count, int workers, int ( *node_of )( int cpu ) )
+{
+    if ( ( cpu < 0 ) || ( cpu_count <= 0 ) )
+    {
+        return -1;
+    }
+    int node = node_of( cpu );
+    int same_node = -1;
+    for ( int i = 0; i < workers; ++i )
+    {
+        int worker_cpu = worker_cpus[ i % cpu_count ];
+        if ( worker_cpu == cpu )
+        {
+            return i;
+        }
+        if ( ( same_node < 0 ) && ( node_of( worker_cpu ) == node ) )
+        {
+            same_node = i;
+        }
+    }
+    return same_node;
+}
+
+/* glibc 没有包装 mbind，直接用系统调用，不依赖 libnuma。MPOL_PREFERRED 在节点内存不足时退回到其他节点，
+不会因此分配失败。内核只读取 maxnode - 1 位，所以要多传一位 */
+bool bind_memory_to_node( void* addr, size_t len, int node )
+{
+    if ( ( node < 0 ) || ( node >= MAX_NODES ) )
+    {
+        return false;
+    }
+    unsigned long mask[ MAX_NODES / ( 8 * sizeof( unsigned long ) ) ] = { 0 };
+    mask[ node / ( 8 * sizeof( unsigned long ) ) ] |= 1UL << ( node % ( 8 * sizeof( unsigned long ) ) );
+    return syscall( SYS_mbind, addr, len, MPOL_PREFERRED, mask, ( unsigned long )MAX_NODES + 1, 0 ) == 0;
+}
@@ -0,0 +1,32 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+/* 线程的 CPU 亲和性和 NUMA 节点。线程绑定在固定的核上之后，它处理的连接的数据留在这个核的缓存中。
+Linux 默认按首次访问分配物理页，而连接的缓冲可能由任何一个工作线程第一次写入，所以要求落在某个节点上的内存
+用 bind_memory_to_node 预先设置内存策略 */
+
+/* 最多支持的 CPU 数和 NUMA 节点数。CPU 编号要能放进 cpu_set_t，不能超过 CPU_SETSIZE */
+static const int MAX_CPUS = 1024;
+static const int MAX_NODES = 64;
+
+/* 解析 "0-3,8,10-11" 形式的 CPU 列表，按出现的顺序存入 cpus，最多 max 个。返回 CPU 数，格式错误时返回 -1 */
+int parse_cpu_list( const char* arg, int* cpus, int max );
+
+/* 把调用线程绑定到一个 CPU 上，成功时返回 true */
+bool pin_current_thread( int cpu );
+
+/* CPU 所在的 NUMA 节点，从 /sys/devices/system/cpu/cpuN/ 读取，没有 NUMA 信息时返回 0 */
+int cpu_node( int cpu );
+
+/* 为绑定在 cpu 上的 reactor 挑选 home 工作线程：第 i 个工作线程绑定在 worker_cpus[ i % cpu_count ] 上，
+优先选绑定在同一个核上的，其次是同一个 NUMA 节点上的第一个，节点由 node_of 查询。cpu 为 -1、工作线程没有绑定
+或者没有合适的时返回 -1 */
+int home_worker( int cpu, const int* worker_cpus, int cpu_count, int workers, int ( *node_of )( int cpu ) );
+
+/* 让 [addr, addr + len) 之后缺页分配的物理页优先落在 node 上，不论由哪个线程第一次访问。addr 必须按页对齐，
+在还没有被访问过的内存上调用。内核不支持 NUMA 时返回 false，内存仍然可用 */
+bool bind_memory_to_node( void* addr, size_t len, int node );
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+
+#include "mpmc_queue.h"
+#include "chase_lev_deque.h"
+
+
+/* threadpoll 的任务调度策略。一个策略类提供如下接口，工作线程编号为 0 到 workers - 1：
+    scheduler( int workers, int capacity );
+    int push( T* task, int self, int home );
+                                        // 放入一个任务，self 是调用者所在的工作线程编号，外部线程为 -1；
+                                        // home 是外部线程希望优先交给的工作线程，没有时为 -1；
+                                        // 返回最适合处理它的工作线程编号，队列已满时返回 -1
+    size_t push_batch( T* const* tasks, size_t n, int self, int home, int* target );
+                                        // 按顺序放入一批任务，返回放入的个数（总是前面的一部分），
+                                        // *target 是第一个任务所在的工作线程编号
+    bool pop( int worker, T*& task );   // 工作线程取任务，没有任务时返回 false
+    size_t size() const;                // 等待处理的任务数，只是一个近似值
+    void set_running( int worker, bool running );
+                                        // 线程池在工作线程启动之前和退出之后调用，弹性模式下有的编号上没有线程
+*/
+
+
+/* 所有工作线程共享一个无锁环形队列，任务按到达顺序处理 */
+template< typename T >
+class shared_queue
+{
+public:
+    shared_queue( int /* workers */, int capacity ): m_capacity( capacity ), m_queue( capacity ) {}
+
+    /* 任务总在共享队列中，返回的编号只决定先唤醒哪个线程 */
+    int push( T* task, int self, int home )
+    {
+        /* 环形队列的容量是 2 的幂，可能大于 capacity，所以超过上限的部分仍然要拒绝 */
+        if ( ( m_queue.size() >= m_capacity ) || !m_queue.push( task ) )
+        {
+            return -1;
+        }
+        return preferred( self, home );
+    }
+
+    size_t push_batch( T* const* tasks, size_t n, int self, int home, int* target )
+    {
+        size_t used = m_queue.size();
+        size_t room = ( used < m_capacity ) ? m_capacity - used : 0;
+        *target = preferred( self, home );
+        return m_queue.push_bulk( tasks, ( n < room ) ? n : room );
+    }
+
+    bool pop( int /* worker */, T*& task )
+    {
+        return m_queue.pop( task );
+    }
+
+    size_t size() const { return m_queue.size(); }
+
+    /* 任务不属于某个线程，哪个线程在运行都一样 */
+    void set_running( int /* worker */, bool /* running */ ) {}
+
+private:
+    static int preferred( int self, int home )
+    {
+        return ( self >= 0 ) ? self : ( ( home >= 0 ) ? home : 0 );
+    }
+
+private:
+    size_t m_capacity;
+    mpmc_queue< T > m_queue;
+};
+
+
+/* 工作窃取：每个工作线程有一个收件箱和一个 Chase-Lev 双端队列。外部线程（reactor）把任务放进它的 home 线程的收件箱，
+没有 home 时按各自的轮转顺序选择收件箱，工作线程自己提交的任务直接放进自己的双端队列，尽量留在提交它的核上处理。
+外部线程只把任务放进有线程在运行的收件箱，弹性模式下还没有启动或者已经退出的编号都被跳过。
+工作线程先取自己双端队列中的任务，再把收件箱中的一批任务搬进双端队列，都没有时才随机挑选其他线程，
+从它的双端队列顶部或者收件箱中窃取。共享队列上所有线程争用同一对下标，这里绝大多数操作只触及本线程的数据 */
+template< typename T >
+class work_stealing
+{
+public:
+    /* 每次从收件箱搬进双端队列的最大任务数，也是双端队列的容量 */
+    static const int BATCH = 32;
+
+public:
+    work_stealing( int workers, int capacity ): m_workers( workers ), m_slots( NULL )
+    {
+        int per_worker = capacity / workers;
+        if ( per_worker < BATCH )
+        {
+            per_worker = BATCH;
+        }
+        m_slots = new slot*[ workers ];
+        for ( int i = 0; i < workers; ++i )
+        {
+            m_slots[i] = new slot( per_worker );
+        }
+    }
+
+    ~work_stealing()
+    {
+        for ( int i = 0; i < m_workers; ++i )
+        {
+            delete m_slots[i];
+        }
+        delete []m_slots;
+    }
+
+    int push( T* task, int self, int home )
+    {
+        if ( ( self >= 0 ) && m_slots[ self ]->deque.push( task ) )
+        {
+            return self;
+        }
+        unsigned start = first_inbox( self, home );
+        for ( int i = 0; i < m_workers; ++i )
+        {
+            int target = ( int )( ( start + i ) % m_workers );
+            if ( is_running( target ) && m_slots[ target ]->inbox.push( task ) )
+            {
+                return target;
+            }
+        }
+        return -1;
+    }
+
+    /* 外部线程提交的一批任务尽量放进同一个收件箱，放不下的依次放进后面的收件箱 */
+    size_t push_batch( T* const* tasks, size_t n, int self, int home, int* target )
+    {
+        size_t done = 0;
+        *target = -1;
+        if ( self >= 0 )
+        {
+            while ( ( done < n ) && m_slots[ self ]->deque.push( tasks[ done ] ) )
+            {
+                ++done;
+            }
+            if ( done > 0 )
+            {
+                *target = self;
+            }
+        }
+        unsigned start = first_inbox( self, home );
+        for ( int i = 0; ( i < m_workers ) && ( done < n ); ++i )
+        {
+            int worker = ( int )( ( start + i ) % m_workers );
+            if ( !is_running( worker ) )
+            {
+                continue;
+            }
+            size_t pushed = m_slots[ worker ]->inbox.push_bulk( tasks + done, n - done );
+            if ( ( pushed > 0 ) && ( *target < 0 ) )
+            {
+                *target = worker;
+            }
+            done += pushed;
+        }
+        return done;
+    }
+
+    bool pop( int worker, T*& task )
+    {
+        slot* own = m_slots[ worker ];
+        task = own->deque.take();
+        if ( task )
+        {
+            return true;
+        }
+        if ( own->inbox.pop( task ) )
+        {
+            /* 再搬一批进双端队列，其他空闲线程可以从中窃取。双端队列刚才是空的，而且只有本线程往里放，
+            所以不会超过 BATCH 的容量 */
+            T* more;
+            for ( int i = 1; i < BATCH && own->inbox.pop( more ); ++i )
+            {
+                own->deque.push( more );
+            }
+            return true;
+        }
+        return steal( worker, task );
+    }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for ( int i = 0; i < m_workers; ++i )
+        {
+            total += m_slots[i]->inbox.size() + m_slots[i]->deque.size();
+        }
+        return total;
+    }
+
+    /* 退出之前已经放进这个线程的收件箱的任务由其他线程窃取：生产者唤醒的总是还在睡眠的线程，
+    它醒来后自己的队列是空的，就会去窃取 */
+    void set_running( int worker, bool running )
+    {
+        m_slots[ worker ]->running.store( running, std::memory_order_seq_cst );
+    }
+
+private:
+    bool is_running( int worker ) const
+    {
+        return m_slots[ worker ]->running.load( std::memory_order_seq_cst );
+    }
+
+    /* 每个外部线程有自己的轮转位置，多个 reactor 不会争用同一个计数器 */
+    static unsigned next_cursor()
+    {
+        static thread_local unsigned cursor = 0;
+        return cursor++;
+    }
+
+    /* 第一个尝试的收件箱：工作线程用自己的，外部线程用 home 线程的，放不下时依次尝试后面的。
+    home 线程没有在运行时按轮转顺序选择，任务分散到正在运行的线程上 */
+    unsigned first_inbox( int self, int home ) const
+    {
+        if ( self >= 0 )
+        {
+            return ( unsigned )self;
+        }
+        return ( ( home >= 0 ) && ( home < m_workers ) && is_running( home ) ) ? ( unsigned )home : next_cursor();
+    }
+
+    /* 从一个随机位置开始依次尝试其他线程。竞争失败说明对方还有任务，再扫一遍 */
+    bool steal( int worker, T*& task )
+    {
+        static thread_local unsigned seed = 0;
+        if ( seed == 0 )
+        {
+            seed = ( unsigned )worker * 2654435761u + 1;
+        }
+        for ( int round = 0; round < 2; ++round )
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            bool lost = false;
+            for ( int i = 0; i < m_workers; ++i )
+            {
+                int victim = ( int )( ( seed + i ) % m_workers );
+                if ( victim == worker )
+                {
+                    continue;
+                }
+                slot* s = m_slots[ victim ];
+                task = s->deque.steal( &lost );
+                if ( task || s->inbox.pop( task ) )
+                {
+                    return true;
+                }
+            }
+            if ( !lost )
+            {
+                break;
+            }
+        }
+        return false;
+    }
+
+private:
+    work_stealing( const work_stealing& );
+    work_stealing& operator=( const work_stealing& );
+
+    /* 每个工作线程的数据单独分配，不和其他线程的数据共享缓存行 */
+    struct slot
+    {
+        explicit slot( int capacity ): inbox( capacity ), deque( BATCH ), running( false ) {}
+        mpmc_queue< T > inbox;
+        chase_lev_deque< T > deque;
+        std::atomic< bool > running;
+    };
+
+    int m_workers;
+    slot** m_slots;
+};
+
+
+/* 优先级通道：每个通道一个无锁环形队列，任务按 T::m_priority 放进对应的通道（0 最优先，超出范围的归入最后一个）。
+工作线程按平滑加权轮转（每次给各通道的计数加上权重，取计数最大的通道，再减去权重总和）决定先看哪个通道，
+那个通道为空时按优先级依次看其他通道，所以忙的时候各通道按权重分享工作线程，低优先级的通道也不会饿死，
+闲的时候谁有任务就处理谁。一批昂贵的请求只能占用它那个通道的份额，健康检查之类的请求不必排在它们后面 */
+template< typename T >
+class priority_lanes
+{
+public:
+    static const int LANES = 3;
+
+public:
+    priority_lanes( int workers, int capacity ): m_capacity( capacity ), m_cursors( NULL )
+    {
+        for ( int i = 0; i < LANES; ++i )
+        {
+            m_lanes[i] = new mpmc_queue< T >( capacity );
+        }
+        m_cursors = new cursor[ workers ];
+        for ( int i = 0; i < workers; ++i )
+        {
+            for ( int j = 0; j < LANES; ++j )
+            {
+                m_cursors[i].current[j] = 0;
+            }
+        }
+    }
+
+    ~priority_lanes()
+    {
+        for ( int i = 0; i < LANES; ++i )
+        {
+            delete m_lanes[i];
+        }
+        delete []m_cursors;
+    }
+
+    int push( T* task, int self, int home )
+    {
+        if ( ( size() >= m_capacity ) || !m_lanes[ lane( task ) ]->push( task ) )
+        {
+            return -1;
+        }
+        return preferred( self, home );
+    }
+
+    /* 同一个通道的连续任务成批放入，某个通道放不下时停止，被拒绝的总是后面的一部分 */
+    size_t push_batch( T* const* tasks, size_t n, int self, int home, int* target )
+    {
+        size_t used = size();
+        size_t room = ( used < m_capacity ) ? m_capacity - used : 0;
+        if ( n > room )
+        {
+            n = room;
+        }
+        *target = preferred( self, home );
+        size_t done = 0;
+        while ( done < n )
+        {
+            int l = lane( tasks[ done ] );
+            size_t run = 1;
+            while ( ( done + run < n ) && ( lane( tasks[ done + run ] ) == l ) )
+            {
+                ++run;
+            }
+            size_t pushed = m_lanes[ l ]->push_bulk( tasks + done, run );
+            done += pushed;
+            if ( pushed < run )
+            {
+                break;
+            }
+        }
+        return done;
+    }
+
+    bool pop( int worker, T*& task )
+    {
+        int first = next_lane( worker );
+        if ( m_lanes[ first ]->pop( task ) )
+        {
+            return true;
+        }
+        for ( int i = 0; i < LANES; ++i )
+        {
+            if ( ( i != first ) && m_lanes[i]->pop( task ) )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for ( int i = 0; i < LANES; ++i )
+        {
+            total += m_lanes[i]->size();
+        }
+        return total;
+    }
+
+    void set_running( int /* worker */, bool /* running */ ) {}
+
+private:
+    static int lane( const T* task )
+    {
+        int l = task->m_priority;
+        return ( l < 0 ) ? 0 : ( ( l >= LANES ) ? LANES - 1 : l );
+    }
+
+    static int preferred( int self, int home )
+    {
+        return ( self >= 0 ) ? self : ( ( home >= 0 ) ? home : 0 );
+    }
+
+    /* 平滑加权轮转，每个工作线程有自己的计数，不需要同步 */
+    int next_lane( int worker )
+    {
+        static const int WEIGHTS[ LANES ] = { 8, 4, 1 };
+        int total = 0;
+        int best = 0;
+        int* current = m_cursors[ worker ].current;
+        for ( int i = 0; i < LANES; ++i )
+        {
+            current[i] += WEIGHTS[i];
+            total += WEIGHTS[i];
+            if ( current[i] > current[ best ] )
+            {
+                best = i;
+            }
+        }
+        current[ best ] -= total;
+        return best;
+    }
+
+private:
+    priority_lanes( const priority_lanes& );
+    priority_lanes& operator=( const priority_lanes& );
+
+    /* 每个工作线程的轮转计数独占一条缓存行 */
+    struct cursor
+    {
+        int current[ LANES ];
+        char pad[ mpmc_queue< T >::CACHE_LINE - LANES * sizeof( int ) ];
+    };
+
+    size_t m_capacity;
+    mpmc_queue< T >* m_lanes[ LANES ];
+    cursor* m_cursors;
+};
+
+#endif
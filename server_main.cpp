@@ -8,18 +8,92 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <atomic>
 
 #include "14-2_locker.h"
 #include "15-3_threadpoll.h"
 #include "http_conn.h"
+#include "http_response.h"
+#include "admission.h"
+#include "placement.h"
 
 #define MAX_FD 65536
 #define MAX_EVENT_NUMBER 10000
+#define ACCEPT_BATCH 64
+/* 弹性线程池中空闲线程退出前的冷却时间（毫秒） */
+#define WORKER_IDLE_MS 10000
+/* 内存池每隔这么多秒把空闲的 slab 交还给系统一次，每一级保留 POOL_KEEP_BYTES 字节的空闲块 */
+#define POOL_TRIM_SECONDS 10
+#define POOL_KEEP_BYTES ( 1024 * 1024 )
 
-extern int addfd( int epollfd, int fd, bool one_shot );
-extern int removefd( int epollfd, int fd );
+extern void addfd( int epollfd, int fd, bool one_shot, bool set_nonblocking );
+extern void removefd( int epollfd, int fd );
 
 
+/* 一个事件循环：它有自己的 epoll 内核事件表，负责分给它的那部分连接上的读写。每个 reactor 一个线程，
+0 号 reactor 同时负责每秒刷新 Date，主线程只等待信号并负责关闭。默认只有 0 号 reactor 监听并把新连接轮流分给各个 reactor；SO_REUSEPORT 模式下
+每个 reactor 有自己的监听 socket，由内核在它们之间分配新连接，各自接受的连接留给自己处理 */
+struct reactor
+{
+    int id;
+    int epollfd;
+    int listenfd;  // 没有监听 socket 时为 -1，开始排空后由 reactor 自己关闭
+    bool listening;  // listenfd 是否注册在 epoll 上。listenfd 和它只由 reactor 自己的线程读写
+    std::atomic< bool > drain_seen;  // 已经看到排空开始，之后不会再把新请求交给线程池
+    int cpu;  // 绑定的 CPU，不绑定时为 -1
+    int home_worker;  // 优先处理这个 reactor 的请求的工作线程，绑定在同一个核或者同一个 NUMA 节点上，没有时为 -1
+    buffer_pool* pool;  // 这个 reactor 的连接的读写缓冲所用的内存池，同一个 NUMA 节点上的 reactor 共用一个
+    pthread_t thread;
+    epoll_event events[ MAX_EVENT_NUMBER ];
+    /* 一次唤醒中读到完整请求的连接，事件处理完后成批交给线程池 */
+    http_conn* ready[ MAX_EVENT_NUMBER ];
+    bool accepted_flags[ MAX_EVENT_NUMBER ];
+
+    /* 每次唤醒的统计。只有 reactor 自己的线程写，其他线程随时可以读，所以用 relaxed 的 load/store 即可 */
+    std::atomic< unsigned long > wakeups;         // epoll_wait 返回的次数，包括超时
+    std::atomic< unsigned long > events_handled;  // 处理过的就绪事件总数
+    std::atomic< unsigned long > accept_wakeups;  // 监听 socket 就绪的次数
+    std::atomic< unsigned long > accepted;        // 接受的连接总数
+    std::atomic< unsigned long > accept_batches;  // 成批注册的次数，每批最多 ACCEPT_BATCH 个连接
+    std::atomic< unsigned long > max_accepted;    // 单次唤醒接受连接数的最大值
+};
+
+/* 只有一个写者的计数器，不需要原子的读-改-写指令 */
+static inline void add_counter( std::atomic< unsigned long >& counter, unsigned long n )
+{
+    counter.store( counter.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+}
+
+/* 所有 reactor 共享的状态。文件描述符在进程内唯一，所以按描述符索引的 users 数组不需要按 reactor 划分 */
+static http_conn** users = NULL;
+static threadpoll< http_conn, priority_lanes< http_conn > >* poll = NULL;
+/* 请求在线程池中排队的最长时间，超过时回复 503，为 0 时不限 */
+static long long request_deadline_ns = 0;
+static reactor* reactors = NULL;
+static int reactor_number = 1;
+static bool reuseport = false;
+/* 按 SO_INCOMING_CPU 把连接交给绑定在处理它的网卡中断的核上的 reactor。cpu_reactor 是绑定在各个 CPU 上的
+reactor 编号，没有时为 -1 */
+static bool steer_incoming = false;
+static int cpu_reactor[ MAX_CPUS ];
+/* 绑定了 CPU 的 reactor 按 NUMA 节点使用的内存池，没有 reactor 的节点为 NULL */
+static buffer_pool* node_pools[ MAX_NODES ];
+static admission* gate = NULL;
+/* 主线程写，所有 reactor 线程读。写之后再唤醒 reactor，release/acquire 让 reactor 退出循环时看到排空阶段的全部结果 */
+static std::atomic< bool > stop_server( false );
+/* 优雅关闭的第一阶段：不再接受新连接和新请求，只把处理中的请求做完 */
+static std::atomic< bool > draining( false );
+/* 注册在每个 reactor 上的 eventfd（ET 模式），写一次就能让所有 reactor 从 epoll_wait 中返回 */
+static int wakefd = -1;
+/* 过载时暂停 accept。由接纳控制设置，各个 reactor 在自己的循环中注销或者重新注册自己的监听 socket */
+static std::atomic< bool > accept_paused( false );
+
 void addsig( int sig , void( handler )(int ), bool restart = true )
 {
     struct sigaction sa;
@@ -34,132 +108,726 @@ void addsig( int sig , void( handler )(int ), bool restart = true )
     assert( ret != -1 );
 }
 
-void show_error( int connfd, const char* info )
+/* 创建一个非阻塞的监听 socket。reuseport 为 true 时多个 socket 可以绑定同一个地址 */
+static int create_listener( const struct sockaddr_in& address, int backlog, bool reuseport )
 {
-    printf( "%s", info );
-    send( connfd, info, strlen( info ), 0 );
-    close( connfd );  // 这里关闭了连接 ？
+    int listenfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    assert( listenfd >= 0 );
+    /* 这里不能设置 SO_LINGER{ 1, 0 }：它会被 accept 得到的连接继承，close 时直接发送 RST 并丢弃发送缓冲区中
+    尚未发出的数据，sendfile 发送的大文件在非 keep-alive 连接上会被截断 */
+    if ( reuseport )
+    {
+        int reuse = 1;
+        int ret = setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) );
+        assert( ret == 0 );
+    }
+
+    int ret = bind( listenfd, ( const sockaddr* )&address, sizeof( address ) );
+    assert( ret >= 0 );
+
+    /* backlog 超过 net.core.somaxconn 时会被内核截断 */
+    ret = listen( listenfd, backlog );
+    assert( ret >= 0 );
+    return listenfd;
 }
 
-int main( int argc, char* argv[] )
+static void wake_reactors()
 {
-    if ( argc <= 2 )
+    uint64_t one = 1;
+    ssize_t ret = ::write( wakefd, &one, sizeof( one ) );
+    ( void )ret;
+}
+
+/* 接纳控制进入或离开过载状态时调用，调用它的可能是任何一个 reactor。这里只记下状态并唤醒所有 reactor，
+监听 socket 由各自的 reactor 在 sync_listener 中处理，不会和排空时关闭监听 socket 的 reactor 发生竞争 */
+static void pause_accept( bool paused )
+{
+    accept_paused.store( paused, std::memory_order_relaxed );
+    wake_reactors();
+}
+
+/* 在 reactor 自己的线程中调用：过载时把监听 socket 从 epoll 中移除，新连接留在内核的监听队列里；
+恢复时重新注册，ET 模式下注册时监听队列非空会立即触发一次事件 */
+static void sync_listener( reactor* r )
+{
+    bool wanted = !accept_paused.load( std::memory_order_relaxed );
+    if ( ( r->listenfd == -1 ) || ( wanted == r->listening ) )
     {
-        printf( "usage: #s ip_address port_number\n", basename( argv[1] ) );
-        return 1;
+        return;
     }
-    const char* ip = argv[1];
-    int port = atoi( argv[2] );
-
-    /* 忽略sigpipe信号 */
-    addsig( SIGPIPE, SIG_IGN );  // 这个信号默认处理方式是退出进程，因此我们设置为 IGN，这样子会返回-1，errno 设置为DIGPIPE
+    if ( wanted )
+    {
+        addfd( r->epollfd, r->listenfd, false, false );
+    }
+    else
+    {
+        epoll_ctl( r->epollfd, EPOLL_CTL_DEL, r->listenfd, 0 );
+    }
+    r->listening = wanted;
+}
 
-    /* 创建线程池 */
-    threadpoll< http_conn >*poll = nullptr;
-    try
+/* 连接的数据包由哪个核的软中断处理，就交给绑定在这个核上的 reactor，读写都不必跨核搬运缓存行。
+没有开启、内核还不知道或者这个核上没有 reactor 时返回 NULL */
+static reactor* incoming_reactor( int connfd )
+{
+    if ( !steer_incoming )
     {
-        poll = new threadpoll<http_conn>;
+        return NULL;
     }
-    catch( ... )
+    int cpu = -1;
+    socklen_t len = sizeof( cpu );
+    if ( ( getsockopt( connfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len ) != 0 ) || ( cpu < 0 ) || ( cpu >= MAX_CPUS )
+        || ( cpu_reactor[ cpu ] < 0 ) )
     {
-        return 1;
+        return NULL;
     }
-    
-    /* 预先为每个可能的客户连接分配一个 http_conn 对象 */
-    http_conn* users = new http_conn[ MAX_FD ];
-    assert( users );
-    int user_count = 0;
+    return &reactors[ cpu_reactor[ cpu ] ];
+}
 
-    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );
-    assert( listenfd >= 0 );
-    struct linger tmp = { 1, 0 };  // 设置为关闭以后，直接返回，丢弃发送缓冲区中数据，并发送一个 RST 报文？？
-    setsockopt( listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof( tmp ) );
+/* 监听 socket 以 ET 模式注册，一次事件可能对应多个已完成握手的连接，所以要一直 accept 到 EAGAIN，
+否则剩下的连接要等到下一个新连接到来才会被处理。accept4 直接返回非阻塞、close-on-exec 的描述符，省去每个连接
+两次 fcntl。连接先成批接受，再一起初始化和注册，接受循环本身保持紧凑。共享监听 socket 时新连接轮流分给
+各个 reactor，SO_REUSEPORT 模式下留给接受它的 reactor */
+static void accept_conns( reactor* r )
+{
+    static unsigned next_reactor = 0;
+    int connfds[ ACCEPT_BATCH ];
+    struct sockaddr_in client_addresses[ ACCEPT_BATCH ];
+    unsigned long total = 0;
+    bool drained = false;
+    while ( !drained )
+    {
+        int count = 0;
+        while ( count < ACCEPT_BATCH )
+        {
+            /* 已经进入过载状态，剩下的连接留在监听队列中 */
+            if ( gate->paused() )
+            {
+                drained = true;
+                break;
+            }
+            socklen_t client_addresslength = sizeof( client_addresses[ count ] );
+            int connfd = accept4( r->listenfd, ( struct sockaddr* )&client_addresses[ count ], &client_addresslength,
+                SOCK_NONBLOCK | SOCK_CLOEXEC );
+            if ( connfd < 0 )
+            {
+                /* 客户端在 accept 之前就断开了，继续接受下一个 */
+                if ( ( errno == EINTR ) || ( errno == ECONNABORTED ) )
+                {
+                    continue;
+                }
+                if ( errno != EAGAIN )
+                {
+                    printf( "errno is: %d\n", errno );
+                }
+                drained = true;
+                break;
+            }
+            connfds[ count++ ] = connfd;
+        }
 
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero( &address, sizeof( address ) );
-    address.sin_port = htons( port );
-    address.sin_family = AF_INET;
-    inet_pton( AF_INET, ip, &address.sin_addr );
+        for ( int i = 0; i < count; ++i )
+        {
+            int connfd = connfds[i];
+            /* users 按描述符索引，超出 MAX_FD 的描述符和超过连接高水位的连接都回复 503 后直接关闭 */
+            if ( ( connfd >= MAX_FD ) || !gate->admit_connection( http_conn::m_user_count ) )
+            {
+                http_conn::send_unavailable( connfd );
+                close( connfd );
+                continue;
+            }
+            /* 初始化客户连接 */
+            if ( !users[ connfd ] )
+            {
+                users[ connfd ] = new http_conn;
+            }
+            reactor* owner = reuseport ? r : incoming_reactor( connfd );
+            if ( !owner )
+            {
+                owner = &reactors[ next_reactor++ % reactor_number ];
+            }
+            users[ connfd ]->init( connfd, client_addresses[i], owner->epollfd, owner->pool );  // 这里面会增加用户量计数
+        }
+        if ( count > 0 )
+        {
+            add_counter( r->accept_batches, 1 );
+            total += count;
+            gate->update( http_conn::m_user_count, poll->depth() );
+        }
+    }
 
-    ret = bind( listenfd, (sockaddr*)&address, sizeof( address ) );
-    assert( ret >= 0 );
+    add_counter( r->accept_wakeups, 1 );
+    add_counter( r->accepted, total );
+    if ( total > r->max_accepted.load( std::memory_order_relaxed ) )
+    {
+        r->max_accepted.store( total, std::memory_order_relaxed );
+    }
+}
 
-    ret = listen( listenfd, 5 );
-    assert( ret >= 0 );
+/* 打印各个 reactor 的唤醒统计 */
+static void dump_reactor_stats( FILE* out )
+{
+    for ( int i = 0; i < reactor_number; ++i )
+    {
+        const reactor& r = reactors[i];
+        unsigned long wakeups = r.wakeups.load( std::memory_order_relaxed );
+        unsigned long events = r.events_handled.load( std::memory_order_relaxed );
+        unsigned long accept_wakeups = r.accept_wakeups.load( std::memory_order_relaxed );
+        unsigned long accepted = r.accepted.load( std::memory_order_relaxed );
+        fprintf( out, "reactor %d: wakeups %lu events %lu (%.2f/wakeup) accept wakeups %lu accepted %lu "
+            "(%.2f/wakeup, max %lu) batches %lu\n", r.id, wakeups, events,
+            wakeups ? ( double )events / wakeups : 0.0, accept_wakeups, accepted,
+            accept_wakeups ? ( double )accepted / accept_wakeups : 0.0,
+            r.max_accepted.load( std::memory_order_relaxed ), r.accept_batches.load( std::memory_order_relaxed ) );
+    }
+}
 
-    epoll_event events[ MAX_EVENT_NUMBER ];
-    int epollfd = epoll_create( 5 );
-    assert( epollfd != -1 );
-    addfd( epollfd, listenfd, false );
-    http_conn::m_epollfd = epollfd;  // 这是一个静态变量
+/* 把这次唤醒中读到完整请求的连接一次交给线程池。超出队列高水位的部分和入队失败的连接回复 503 并关闭，
+否则连接会停在 EPOLLONESHOT 状态，再也收不到事件 */
+static void dispatch( reactor* r, int count )
+{
+    if ( count == 0 )
+    {
+        return;
+    }
+    /* 入队之前开始计数，工作线程可能马上处理完并结束这个请求；被拒绝的连接在 shed 中关闭时结束计数 */
+    long long deadline = request_deadline_ns ? poll->now_ns() + request_deadline_ns : 0;
+    for ( int i = 0; i < count; ++i )
+    {
+        http_conn* conn = r->ready[i];
+        conn->m_priority = conn->priority();
+        conn->m_deadline_ns = deadline;
+        conn->begin_request();
+    }
+    int admitted = gate->admit_requests( poll->depth(), count );
+    int queued = ( int )poll->append_batch( r->ready, admitted, r->accepted_flags );
+    if ( queued < admitted )
+    {
+        gate->reject_requests( admitted - queued );
+    }
+    for ( int i = 0; i < count; ++i )
+    {
+        if ( ( i >= admitted ) || !r->accepted_flags[i] )
+        {
+            r->ready[i]->shed();
+        }
+    }
+}
+
+/* 连接数从高峰回落之后，把各个内存池中整个空闲的 slab 交还给系统 */
+static void trim_pools()
+{
+    http_conn::m_buffer_pool->trim( POOL_KEEP_BYTES );
+    for ( int i = 0; i < MAX_NODES; ++i )
+    {
+        if ( node_pools[i] )
+        {
+            node_pools[i]->trim( POOL_KEEP_BYTES );
+        }
+    }
+}
+
+/* reactor 的事件循环：读写分给它的连接，把解析和应答交给线程池 */
+static void run_reactor( reactor* r )
+{
+    /* 应答中的 Date 由 0 号 reactor 每秒刷新一次，工作线程只读取缓存的字符串。epoll_wait 最多等待 1 秒，
+    空闲时也能按时刷新。内存池的收缩也由 0 号 reactor 低频地做 */
+    time_t last_tick = time( NULL );
+    time_t last_trim = last_tick;
 
-    while( true )
+    while( !stop_server.load( std::memory_order_acquire ) )
     {
-        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, -1 );
+        /* 在 epoll_wait 之前关闭监听 socket，关闭的同时它也从 epoll 中移除，本轮不会再有它的事件。
+        SO_REUSEPORT 模式下内核从此把新连接交给其他进程，例如滚动重启中的新进程 */
+        if ( draining && !r->drain_seen )
+        {
+            if ( r->listenfd != -1 )
+            {
+                close( r->listenfd );
+                r->listenfd = -1;
+                r->listening = false;
+            }
+            r->drain_seen = true;
+        }
+        sync_listener( r );
+
+        int number = epoll_wait( r->epollfd, r->events, MAX_EVENT_NUMBER, 1000 );
         
         if ( ( number < 0 ) && ( errno != EINTR ) )
         {
+            /* 让主线程走正常的关闭流程 */
             printf( "epoll failure\n" );
+            kill( getpid(), SIGTERM );
             break;
         }
 
+        add_counter( r->wakeups, 1 );
+        if ( number > 0 )
+        {
+            add_counter( r->events_handled, number );
+        }
+
+        if ( r->id == 0 )
+        {
+            time_t now = time( NULL );
+            if ( now != last_tick )
+            {
+                http_date_tick( now );
+                last_tick = now;
+            }
+            if ( now - last_trim >= POOL_TRIM_SECONDS )
+            {
+                trim_pools();
+                last_trim = now;
+            }
+        }
+
+        int ready = 0;
         for( int i = 0; i < number; ++i )
         {
-            int sockfd = events[i].data.fd;
-            if ( sockfd == listenfd )
+            int sockfd = r->events[i].data.fd;
+            if ( sockfd == wakefd )
             {
-                struct sockaddr_in client_address;
-                socklen_t client_addresslength = sizeof( client_address );
-                int connfd = accept( listenfd, &client_address, &client_addresslength );
-                if ( connfd < 0 )
-                {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                }
-                if ( http_conn::m_user_count >= MAX_FD )
-                {
-                    // 此时连接数超过了我们的限制，直接在连接的时候和 client 说
-                    show_error( connfd, "Internal server busy" );
-                }
-                /* 初始化客户连接 */
-                users[ connfd ].init( connfd, client_address );  // 这里面会增加用户量计数
+                continue;
+            }
+            if ( sockfd == r->listenfd )
+            {
+                accept_conns( r );
             }
-            else if ( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+            else if ( r->events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
             {
                 // 该连接对方关闭了，或者有异常
-                users[sockfd].close_conn();
+                users[sockfd]->close_conn();
             }
-            else if ( events[i].events & EPOLLIN )
+            else if ( r->events[i].events & EPOLLIN )
             {
+                if ( users[sockfd]->lingering() )
+                {
+                    if ( !users[sockfd]->discard_input() )
+                    {
+                        users[sockfd]->close_conn();
+                    }
+                }
+                /* 排空期间其余等待 EPOLLIN 的连接不再读取新请求。之前的应答可能还在发送缓冲中，不能直接关闭 */
+                else if ( draining )
+                {
+                    users[sockfd]->linger_close();
+                }
                 /* 根据读的结果，决定是将任务添加到线程池，还是关闭连接 */
-                if ( users[sockfd].read() )
+                else if ( users[sockfd]->read() )
                 {
-                   if ( !poll->append( user+ sockfd )) {
-                        printf( "threadpoll append failure\n" );
-                   }
+                    r->ready[ ready++ ] = users[sockfd];
                 }
                 else
                 {
-                    users[sockfd].close_conn();
+                    users[sockfd]->close_conn();
                 }
             }
-            else if ( events[i].events & EPOLLOUT )
+            else if ( r->events[i].events & EPOLLOUT )
             {
                 /* 根据写的结果，决定是否关闭连接 */
-                if ( !users[sockfd].write() )
+                if ( !users[sockfd]->write() )
+                {
+                    users[sockfd]->close_conn();
+                }
+                else if ( draining && ( !users[sockfd]->in_flight() || users[sockfd]->has_pending_request() ) )
                 {
-                    users[sockfd].close_conn();
+                    /* 排空期间应答一发完就关闭连接，流水线中后面的请求不再处理 */
+                    users[sockfd]->linger_close();
+                }
+                else if ( users[sockfd]->has_pending_request() )
+                {
+                    /* 读缓冲中还有客户端流水线发来的请求，直接交给线程池继续处理 */
+                    r->ready[ ready++ ] = users[sockfd];
                 }
             }
             else
             {}
         }
+        dispatch( r, ready );
+
+        /* 连接在 reactor 和工作线程中关闭，队列由工作线程消化，所以每次唤醒都重新检查一次负载；
+        空闲时 epoll_wait 的超时保证暂停的 accept 最多一秒后就能恢复 */
+        gate->update( http_conn::m_user_count, poll->depth() );
+    }
+}
+
+/* 打印各个 reactor、接纳控制和线程池的指标 */
+static void dump_stats( FILE* out )
+{
+    dump_reactor_stats( out );
+    gate->dump( out );
+    poll->dump( out );
+}
+
+static void* reactor_thread( void* arg )
+{
+    reactor* r = ( reactor* )arg;
+    if ( ( r->cpu >= 0 ) && !pin_current_thread( r->cpu ) )
+    {
+        printf( "reactor %d: cannot bind to cpu %d\n", r->id, r->cpu );
+    }
+    poll->set_home( r->home_worker );
+    run_reactor( r );
+    return NULL;
+}
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* 先排空再停止：暂停并关闭监听 socket，等所有 reactor 确认之后不会再把新请求交给线程池，
+然后等处理中的请求（包括应答的发送）在 timeout_ms 毫秒内完成，最后停止 reactor 和线程池。返回被丢弃的处理中请求数 */
+static int graceful_shutdown( int timeout_ms )
+{
+    long long deadline = now_ms() + timeout_ms;
+
+    gate->close();
+    draining = true;
+    wake_reactors();
+    for ( int i = 0; i < reactor_number; ++i )
+    {
+        while ( !reactors[i].drain_seen && ( now_ms() < deadline ) )
+        {
+            usleep( 1000 );
+        }
+    }
+    while ( ( http_conn::m_in_flight_count > 0 ) && ( now_ms() < deadline ) )
+    {
+        usleep( 1000 );
+    }
+    int dropped = http_conn::m_in_flight_count;
+
+    stop_server.store( true, std::memory_order_release );
+    wake_reactors();
+    for ( int i = 0; i < reactor_number; ++i )
+    {
+        pthread_join( reactors[i].thread, NULL );
+    }
+    long long left = deadline - now_ms();
+    poll->shutdown( left > 0 ? ( int )left : 0 );
+
+    /* 所有线程都已退出，关闭剩下的（空闲的或者超时未完成的）连接 */
+    for ( int i = 0; i < MAX_FD; ++i )
+    {
+        if ( users[i] )
+        {
+            users[i]->close_conn();
+        }
+    }
+    return dropped;
+}
+
+/* 在工作线程中处理排队超过期限的请求，这时连接由工作线程持有 */
+static void shed_expired( http_conn* conn )
+{
+    conn->shed();
+}
+
+static void usage( const char* prog )
+{
+    printf( "usage: %s [-r reactor_number] [-p] [-b backlog] [-c conn_high[,conn_low]] [-q queue_high[,queue_low]] "
+        "[-g drain_seconds] [-w min_workers[,max_workers]] [-t target_wait_us] [-a reactor_cpus] [-A worker_cpus] [-i] "
+        "[-d deadline_ms] [-H interactive_path[,interactive_path]] "
+        "ip_address port_number [file_cache_mb] [gzip_cache_mb]\n", prog );
+}
+
+/* 解析 "high" 或 "high,low" 形式的水位，没有给出低水位时取高水位的 low_percent% */
+static bool parse_watermarks( const char* arg, int low_percent, int* high, int* low )
+{
+    int n = sscanf( arg, "%d,%d", high, low );
+    if ( n == 1 )
+    {
+        *low = ( int )( ( long )*high * low_percent / 100 );
     }
+    return ( n >= 1 ) && ( *high > 0 ) && ( *low >= 0 ) && ( *low < *high );
+}
 
-    close( epollfd );
-    close( listenfd );
+int main( int argc, char* argv[] )
+{
+    int opt = 0;
+    /* 监听队列的长度。部署之后大量客户端同时重连时，过短的队列会溢出，客户端只能等 SYN 超时重传 */
+    int backlog = 4096;
+    /* 连接数的默认高水位是可用描述符的一半：sendfile 发送大文件时一个连接还要占用一个文件描述符 */
+    int fd_limit = MAX_FD;
+    struct rlimit rl;
+    if ( ( getrlimit( RLIMIT_NOFILE, &rl ) == 0 ) && ( rl.rlim_cur < ( rlim_t )fd_limit ) )
+    {
+        fd_limit = ( int )rl.rlim_cur;
+    }
+    int conn_high = fd_limit / 2;
+    int conn_low = conn_high * 9 / 10;
+    /* 线程池队列的高低水位，高水位同时也是队列的容量 */
+    int queue_high = 4096;
+    int queue_low = queue_high / 4;
+    /* 收到 SIGTERM/SIGINT 后等待处理中的请求完成的最长时间 */
+    int drain_seconds = 10;
+    /* 工作线程数的上下限，两者相等时线程数固定；弹性模式下排队时间的 p99 超过 target_wait_us 微秒时增加线程 */
+    int min_workers = 8;
+    int max_workers = 8;
+    int target_wait_us = 2000;
+    /* reactor 和工作线程绑定的 CPU 列表，例如 "0-3,8"，线程数多于列表长度时循环使用 */
+    int reactor_cpus[ MAX_CPUS ];
+    int reactor_cpu_count = 0;
+    int worker_cpus[ MAX_CPUS ];
+    int worker_cpu_count = 0;
+    /* 请求排队的期限，以及进入最高优先级通道的路径前缀，默认只有健康检查 */
+    int deadline_ms = 0;
+    const char* interactive_paths = "/health";
+    while ( ( opt = getopt( argc, argv, "r:pb:c:q:g:w:t:a:A:id:H:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            /* reactor 的数量，通常设为 CPU 核数 */
+            case 'r':
+                reactor_number = atoi( optarg );
+                break;
+            /* 每个 reactor 一个 SO_REUSEPORT 监听 socket */
+            case 'p':
+                reuseport = true;
+                break;
+            case 'b':
+                backlog = atoi( optarg );
+                break;
+            case 'c':
+                if ( !parse_watermarks( optarg, 90, &conn_high, &conn_low ) )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                break;
+            case 'g':
+                drain_seconds = atoi( optarg );
+                break;
+            case 't':
+                target_wait_us = atoi( optarg );
+                break;
+            case 'a':
+                reactor_cpu_count = parse_cpu_list( optarg, reactor_cpus, MAX_CPUS );
+                if ( reactor_cpu_count < 0 )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                break;
+            case 'A':
+                worker_cpu_count = parse_cpu_list( optarg, worker_cpus, MAX_CPUS );
+                if ( worker_cpu_count < 0 )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                break;
+            case 'i':
+                steer_incoming = true;
+                break;
+            case 'd':
+                deadline_ms = atoi( optarg );
+                break;
+            case 'H':
+                interactive_paths = optarg;
+                break;
+            case 'w':
+            {
+                int n = sscanf( optarg, "%d,%d", &min_workers, &max_workers );
+                if ( n < 1 )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                if ( n == 1 )
+                {
+                    max_workers = min_workers;
+                }
+                break;
+            }
+            case 'q':
+                if ( !parse_watermarks( optarg, 25, &queue_high, &queue_low ) )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                break;
+            default:
+                usage( argv[0] );
+                return 1;
+        }
+    }
+    if ( ( argc - optind < 2 ) || ( reactor_number <= 0 ) || ( backlog <= 0 ) || ( drain_seconds < 0 )
+        || ( min_workers <= 0 ) || ( max_workers < min_workers ) || ( target_wait_us <= 0 )
+        || ( steer_incoming && ( reactor_cpu_count == 0 ) ) || ( deadline_ms < 0 ) )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+    const char* ip = argv[ optind ];
+    int port = atoi( argv[ optind + 1 ] );
+    /* 热点文件缓存的字节预算，单位为 MB，为 0 时关闭缓存 */
+    int cache_mb = ( argc - optind > 2 ) ? atoi( argv[ optind + 2 ] ) : 64;
+    /* 实时压缩的结果缓存的字节预算，单位为 MB，为 0 时只发送预先压缩好的 .gz 文件 */
+    int gzip_cache_mb = ( argc - optind > 3 ) ? atoi( argv[ optind + 3 ] ) : 16;
+
+    /* 忽略sigpipe信号 */
+    addsig( SIGPIPE, SIG_IGN );  // 这个信号默认处理方式是退出进程，因此我们设置为 IGN，这样子会返回-1，errno 设置为DIGPIPE
+
+    /* 关闭信号和 SIGUSR1 在创建任何线程之前屏蔽，之后创建的线程都继承这个掩码，只有主线程用 sigwait 同步地等待它们 */
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGTERM );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGUSR1 );
+    pthread_sigmask( SIG_BLOCK, &signals, NULL );
+
+    /* 创建线程池 */
+    try
+    {
+        poll = new threadpoll< http_conn, priority_lanes< http_conn > >( min_workers, max_workers, queue_high,
+            target_wait_us, WORKER_IDLE_MS, worker_cpus, worker_cpu_count );
+    }
+    catch( ... )
+    {
+        return 1;
+    }
+    
+    /* 每个可能的客户连接对应一个 http_conn 指针，对象在该文件描述符第一次被使用时才创建，
+    连接的读写缓冲则在需要时才从内存池申请，所以内存占用随活跃连接数而不是 MAX_FD 增长 */
+    users = new http_conn*[ MAX_FD ]();
+    assert( users );
+    request_deadline_ns = deadline_ms * 1000000LL;
+    poll->set_expired_handler( shed_expired );
+    for ( const char* p = interactive_paths; *p; )
+    {
+        const char* comma = strchr( p, ',' );
+        size_t len = comma ? ( size_t )( comma - p ) : strlen( p );
+        if ( len > 0 )
+        {
+            http_conn::m_interactive_paths.push_back( std::string( p, len ) );
+        }
+        p += comma ? len + 1 : len;
+    }
+    http_conn::m_buffer_pool = new buffer_pool;
+    http_conn::init_static_responses();
+    gate = new admission( conn_high, conn_low, queue_high, queue_low, pause_accept );
+    if ( cache_mb > 0 )
+    {
+        http_conn::m_file_cache = new file_cache( ( size_t )cache_mb * 1024 * 1024 );
+    }
+    if ( gzip_cache_mb > 0 )
+    {
+        http_conn::m_variant_cache = new variant_cache( ( size_t )gzip_cache_mb * 1024 * 1024 );
+    }
+
+    int ret = 0;
+    struct sockaddr_in address;
+    bzero( &address, sizeof( address ) );
+    address.sin_port = htons( port );
+    address.sin_family = AF_INET;
+    inet_pton( AF_INET, ip, &address.sin_addr );
+
+    wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    assert( wakefd != -1 );
+
+    /* 绑定了 CPU 的 reactor 按 NUMA 节点使用各自的内存池。读缓冲由 reactor 申请，写缓冲和文件名缓冲却由工作线程
+    申请，所以内存池的 slab 在切分之前就绑定到节点上，不依赖首次访问的线程；归还的块也只在同一个节点的连接之间复用 */
+    for ( int i = 0; i < MAX_CPUS; ++i )
+    {
+        cpu_reactor[i] = -1;
+    }
+
+    /* 每个 reactor 一个 epoll 内核事件表。共享模式下监听 socket 注册在 0 号 reactor 上 */
+    reactors = new reactor[ reactor_number ];
+    for ( int i = 0; i < reactor_number; ++i )
+    {
+        reactors[i].id = i;
+        reactors[i].epollfd = epoll_create( 5 );
+        assert( reactors[i].epollfd != -1 );
+        reactors[i].listenfd = -1;
+        reactors[i].listening = false;
+        reactors[i].drain_seen = false;
+        reactors[i].cpu = ( reactor_cpu_count > 0 ) ? reactor_cpus[ i % reactor_cpu_count ] : -1;
+        reactors[i].home_worker = home_worker( reactors[i].cpu, worker_cpus, worker_cpu_count, max_workers, cpu_node );
+        reactors[i].pool = http_conn::m_buffer_pool;
+        if ( reactors[i].cpu >= 0 )
+        {
+            int node = cpu_node( reactors[i].cpu );
+            if ( !node_pools[ node ] )
+            {
+                node_pools[ node ] = new buffer_pool( node );
+            }
+            reactors[i].pool = node_pools[ node ];
+            if ( cpu_reactor[ reactors[i].cpu ] < 0 )
+            {
+                cpu_reactor[ reactors[i].cpu ] = i;
+            }
+            printf( "reactor %d: cpu %d node %d home worker %d\n", i, reactors[i].cpu, node, reactors[i].home_worker );
+        }
+        addfd( reactors[i].epollfd, wakefd, false, false );
+        reactors[i].wakeups = 0;
+        reactors[i].events_handled = 0;
+        reactors[i].accept_wakeups = 0;
+        reactors[i].accepted = 0;
+        reactors[i].accept_batches = 0;
+        reactors[i].max_accepted = 0;
+        if ( reuseport || ( i == 0 ) )
+        {
+            reactors[i].listenfd = create_listener( address, backlog, reuseport );
+            /* SO_REUSEPORT 模式下让内核优先把新连接交给绑定在处理它的网卡中断的核上的 reactor 的监听 socket */
+            if ( reuseport && steer_incoming && ( reactors[i].cpu >= 0 ) )
+            {
+                setsockopt( reactors[i].listenfd, SOL_SOCKET, SO_INCOMING_CPU, &reactors[i].cpu, sizeof( reactors[i].cpu ) );
+            }
+            addfd( reactors[i].epollfd, reactors[i].listenfd, false, false );
+            reactors[i].listening = true;
+        }
+    }
+    http_date_tick( time( NULL ) );
+
+    for ( int i = 0; i < reactor_number; ++i )
+    {
+        ret = pthread_create( &reactors[i].thread, NULL, reactor_thread, &reactors[i] );
+        assert( ret == 0 );
+    }
+
+    /* 主线程等待关闭信号。reactor 出错时也会给进程发送 SIGTERM */
+    int sig = 0;
+    while ( ( sigwait( &signals, &sig ) == 0 ) && ( sig == SIGUSR1 ) )
+    {
+        /* SIGUSR1 打印一次各项指标，服务不受影响 */
+        dump_stats( stdout );
+        fflush( stdout );
+    }
+    printf( "got signal %d, draining for up to %d s\n", sig, drain_seconds );
+    long long begin = now_ms();
+    int dropped = graceful_shutdown( drain_seconds * 1000 );
+    printf( "shutdown took %lld ms, %d in-flight requests dropped\n", now_ms() - begin, dropped );
+
+    dump_stats( stdout );
+    for ( int i = 0; i < reactor_number; ++i )
+    {
+        close( reactors[i].epollfd );
+        if ( reactors[i].listenfd != -1 )
+        {
+            close( reactors[i].listenfd );
+        }
+    }
+    delete []reactors;
+    close( wakefd );
+    for ( int i = 0; i < MAX_FD; ++i )
+    {
+        delete users[i];
+    }
     delete []users;
     delete poll;
+    delete gate;
+    delete http_conn::m_file_cache;
+    delete http_conn::m_variant_cache;
+    delete http_conn::m_buffer_pool;
+    for ( int i = 0; i < MAX_NODES; ++i )
+    {
+        delete node_pools[i];
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,210 @@
+/* 接纳控制：只在达到高水位时暂停，连接数和队列深度都回落到低水位才恢复，暂停和恢复严格交替，关闭之后不再恢复；
+成批接纳时只有前面一部分放得下的计数；以及被拒绝的请求收到预先编码的 503 后连接被关闭 */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "test_util.h"
+#include "conn_harness.h"
+#include "admission.h"
+#include "http_response.h"
+
+
+/* 503 应答的正文，定义在 http_conn.cpp 中 */
+extern const char* error_503_form;
+
+/* pause_handler 收到的每一次调用，调用时持有 admission 内部的锁，不需要再加锁 */
+static std::vector< bool > events;
+
+static void record_pause( bool paused )
+{
+    events.push_back( paused );
+}
+
+static void test_hysteresis()
+{
+    events.clear();
+    admission gate( 100, 50, 20, 5, record_pause );
+
+    /* 两项都在高水位以下时不暂停 */
+    gate.update( 99, 19 );
+    CHECK( events.empty() && !gate.paused() );
+
+    /* 连接数达到高水位时暂停，重复的更新不会再次调用 */
+    gate.update( 100, 0 );
+    gate.update( 150, 30 );
+    CHECK_EQ( events.size(), 1u );
+    CHECK( gate.paused() );
+
+    /* 在两个水位之间、或者只有一项回落到低水位，都保持暂停 */
+    gate.update( 60, 0 );
+    gate.update( 50, 6 );
+    gate.update( 99, 19 );
+    CHECK_EQ( events.size(), 1u );
+    CHECK( gate.paused() );
+
+    /* 两项都回落到低水位才恢复 */
+    gate.update( 50, 5 );
+    CHECK_EQ( events.size(), 2u );
+    CHECK( !gate.paused() );
+    gate.update( 0, 0 );
+    CHECK_EQ( events.size(), 2u );
+
+    /* 队列深度单独达到高水位同样暂停 */
+    gate.update( 0, 20 );
+    gate.update( 10, 10 );
+    CHECK_EQ( events.size(), 3u );
+    gate.update( 10, 5 );
+    CHECK_EQ( events.size(), 4u );
+
+    bool alternate = true;
+    for ( size_t i = 0; i < events.size(); ++i )
+    {
+        alternate = alternate && ( events[i] == ( i % 2 == 0 ) );
+    }
+    CHECK( alternate );
+    CHECK_EQ( gate.pauses(), 2u );
+}
+
+struct update_arg
+{
+    admission* gate;
+    unsigned seed;
+};
+
+static void* random_updates( void* arg )
+{
+    update_arg* a = ( update_arg* )arg;
+    for ( int i = 0; i < 200000; ++i )
+    {
+        a->gate->update( rand_r( &a->seed ) % 130, rand_r( &a->seed ) % 30 );
+    }
+    return NULL;
+}
+
+/* 多个 reactor 同时更新：暂停和恢复仍然严格交替，从暂停开始 */
+static void test_concurrent_updates()
+{
+    events.clear();
+    admission gate( 100, 50, 20, 5, record_pause );
+    const int THREADS = 4;
+    pthread_t threads[ THREADS ];
+    update_arg args[ THREADS ];
+    for ( int i = 0; i < THREADS; ++i )
+    {
+        args[i].gate = &gate;
+        args[i].seed = 12345 + i;
+        pthread_create( &threads[i], NULL, random_updates, &args[i] );
+    }
+    for ( int i = 0; i < THREADS; ++i )
+    {
+        pthread_join( threads[i], NULL );
+    }
+    CHECK( events.size() > 2 );
+    bool alternate = true;
+    for ( size_t i = 0; i < events.size(); ++i )
+    {
+        alternate = alternate && ( events[i] == ( i % 2 == 0 ) );
+    }
+    CHECK( alternate );
+    CHECK_EQ( gate.paused(), !events.empty() && events.back() );
+    CHECK_EQ( gate.pauses(), ( unsigned long )( events.size() + 1 ) / 2 );
+}
+
+static void test_close()
+{
+    /* 没有暂停时关闭：暂停一次，之后负载再低也不恢复 */
+    events.clear();
+    admission gate( 100, 50, 20, 5, record_pause );
+    gate.close();
+    CHECK_EQ( events.size(), 1u );
+    CHECK( ( events.size() == 1 ) && events[0] );
+    gate.update( 0, 0 );
+    gate.update( 200, 200 );
+    gate.close();
+    CHECK_EQ( events.size(), 1u );
+    CHECK( gate.paused() );
+
+    /* 已经暂停时关闭不再调用，之后同样不恢复 */
+    events.clear();
+    admission busy( 100, 50, 20, 5, record_pause );
+    busy.update( 100, 0 );
+    busy.close();
+    busy.update( 0, 0 );
+    CHECK_EQ( events.size(), 1u );
+    CHECK( busy.paused() );
+}
+
+static void test_counts()
+{
+    admission gate( 100, 50, 10, 5, NULL );
+    CHECK( gate.admit_connection( 99 ) );
+    CHECK( !gate.admit_connection( 100 ) );
+    CHECK_EQ( gate.admitted_conns(), 1u );
+    CHECK_EQ( gate.shed_conns(), 1u );
+
+    CHECK( gate.admit_request( 9 ) );
+    CHECK( !gate.admit_request( 10 ) );
+
+    /* 队列里还有 3 个空位，一批 5 个只接纳前 3 个 */
+    CHECK_EQ( gate.admit_requests( 7, 5 ), 3 );
+    CHECK_EQ( gate.admitted_requests(), 4u );
+    CHECK_EQ( gate.shed_requests(), 3u );
+    /* 队列已满或者超出高水位时一个都不接纳 */
+    CHECK_EQ( gate.admit_requests( 10, 4 ), 0 );
+    CHECK_EQ( gate.admit_requests( 12, 1 ), 0 );
+    CHECK_EQ( gate.admitted_requests(), 4u );
+    CHECK_EQ( gate.shed_requests(), 8u );
+    CHECK_EQ( gate.admit_requests( 0, 4 ), 4 );
+    CHECK_EQ( gate.admitted_requests(), 8u );
+
+    /* 接纳之后没能入队的改记为拒绝 */
+    gate.reject_requests( 2 );
+    CHECK_EQ( gate.admitted_requests(), 6u );
+    CHECK_EQ( gate.shed_requests(), 10u );
+    CHECK_EQ( gate.pauses(), 0u );
+}
+
+/* 队列已满时被拒绝的请求收到预先编码好的 503，连接随即关闭；有空位时照常处理 */
+static void test_shed_response( const std::string& root )
+{
+    write_test_file( root, "a.txt", "hello" );
+    admission gate( 100, 50, 1, 0, NULL );
+    {
+        test_conn c;
+        c.set_gate( &gate, 1 );
+        std::vector< test_response > r = c.exchange( "GET /a.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n" );
+        CHECK_EQ( r.size(), 1u );
+        if ( r.size() == 1 )
+        {
+            CHECK_EQ( r[0].status, 503 );
+            CHECK( r[0].header( "retry-after" ) && ( strcmp( r[0].header( "retry-after" ), "1" ) == 0 ) );
+            CHECK( r[0].header( "connection" ) && ( strcmp( r[0].header( "connection" ), "close" ) == 0 ) );
+            CHECK( r[0].header( "date" ) && ( strlen( r[0].header( "date" ) ) == ( size_t )HTTP_DATE_LEN ) );
+            CHECK_EQ( r[0].body, std::string( error_503_form ) );
+        }
+        CHECK( c.closed() );
+        CHECK_EQ( gate.shed_requests(), 1u );
+    }
+    {
+        test_conn c;
+        c.set_gate( &gate, 0 );
+        std::vector< test_response > r = c.exchange( "GET /a.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n" );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) && ( r[0].body == "hello" ) );
+        CHECK( !c.closed() );
+        CHECK_EQ( gate.admitted_requests(), 1u );
+    }
+}
+
+int main()
+{
+    std::string root = setup_doc_root();
+    test_hysteresis();
+    test_concurrent_updates();
+    test_close();
+    test_counts();
+    test_shed_response( root );
+    remove_doc_root( root );
+    return test_result( "admission_test" );
+}
@@ -0,0 +1,147 @@
+/* 内存池：分级、块之间互不重叠、归还的块被复用，以及 trim 只交还整个空闲的 slab 并遵守保留的字节数 */
+#include <string.h>
+#include <vector>
+
+#include "test_util.h"
+#include "buffer_pool.h"
+
+
+static const size_t SLAB = buffer_pool::SLAB_SIZE;
+
+/* 申请 count 个 size 字节的块，每个块填上自己的序号 */
+static std::vector< char* > fill( buffer_pool& pool, size_t size, int count, size_t* capacity )
+{
+    std::vector< char* > chunks;
+    for ( int i = 0; i < count; ++i )
+    {
+        char* c = pool.acquire( size, capacity );
+        CHECK( c != NULL );
+        if ( c )
+        {
+            memset( c, i & 0xff, *capacity );
+            chunks.push_back( c );
+        }
+    }
+    return chunks;
+}
+
+static bool intact( const std::vector< char* >& chunks, size_t capacity, int index )
+{
+    for ( size_t j = 0; j < capacity; ++j )
+    {
+        if ( chunks[ index ][j] != ( char )( index & 0xff ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_classes()
+{
+    buffer_pool pool;
+    size_t capacity = 0;
+    const size_t sizes[][2] = { { 1, 256 }, { 256, 256 }, { 257, 512 }, { 3000, 4096 }, { 65536, 65536 } };
+    for ( unsigned i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i )
+    {
+        char* c = pool.acquire( sizes[i][0], &capacity );
+        CHECK( c != NULL );
+        CHECK_EQ( capacity, sizes[i][1] );
+        pool.release( c, capacity );
+    }
+    CHECK( pool.acquire( buffer_pool::MAX_CHUNK_SIZE + 1, &capacity ) == NULL );
+
+    /* 跨越多个 slab 的块互不重叠，刚归还的块最先被复用 */
+    std::vector< char* > chunks = fill( pool, 300, 1000, &capacity );
+    bool ok = true;
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        ok = ok && intact( chunks, capacity, i );
+    }
+    CHECK( ok );
+    char* last = chunks.back();
+    pool.release( last, capacity );
+    CHECK( pool.acquire( 300, &capacity ) == last );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        pool.release( chunks[i], capacity );
+    }
+}
+
+static void test_trim()
+{
+    buffer_pool pool;
+    size_t capacity = 0;
+    /* 512 字节的块每个 slab 切出 128 个，1280 个正好占满 10 个 slab */
+    std::vector< char* > chunks = fill( pool, 512, 1280, &capacity );
+    CHECK_EQ( capacity, 512u );
+    CHECK_EQ( pool.trim( 0 ), 0u );
+
+    /* 每个 slab 留一个块在使用，哪个 slab 都不能交还 */
+    std::vector< char* > held;
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        size_t slab = ( ( size_t )chunks[i] ) / SLAB;
+        bool seen = false;
+        for ( size_t j = 0; j < held.size(); ++j )
+        {
+            seen = seen || ( ( size_t )held[j] / SLAB == slab );
+        }
+        if ( seen )
+        {
+            pool.release( chunks[i], capacity );
+        }
+        else
+        {
+            held.push_back( chunks[i] );
+        }
+    }
+    CHECK_EQ( held.size(), 10u );
+    for ( size_t i = 0; i < held.size(); ++i )
+    {
+        memset( held[i], 'h', capacity );
+    }
+    CHECK_EQ( pool.trim( 0 ), 0u );
+
+    /* 归还其中 7 个之后有 7 个整个空闲的 slab，另外 3 个 slab 上还有 381 个空闲块。保留的字节数把所有空闲块都算在内，
+    要保留 4 个 slab 那么多时只能交还 5 个 */
+    for ( int i = 0; i < 7; ++i )
+    {
+        pool.release( held[i], capacity );
+    }
+    CHECK_EQ( pool.trim( 4 * SLAB ), 5 * SLAB );
+    CHECK_EQ( pool.trim( 4 * SLAB ), 0u );
+    CHECK_EQ( pool.trim( 0 ), 2 * SLAB );
+
+    /* 仍在使用的块不受影响，池子在收缩之后照常工作 */
+    for ( size_t i = 7; i < held.size(); ++i )
+    {
+        CHECK( ( held[i][0] == 'h' ) && ( memcmp( held[i], held[i] + 1, capacity - 1 ) == 0 ) );
+        pool.release( held[i], capacity );
+    }
+    CHECK_EQ( pool.trim( 0 ), 3 * SLAB );
+    chunks = fill( pool, 512, 300, &capacity );
+    bool ok = true;
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        ok = ok && intact( chunks, capacity, i );
+    }
+    CHECK( ok );
+    for ( size_t i = 0; i < chunks.size(); ++i )
+    {
+        pool.release( chunks[i], capacity );
+    }
+
+    /* 最大的一级一个块就是整个 slab */
+    char* big = pool.acquire( buffer_pool::MAX_CHUNK_SIZE, &capacity );
+    CHECK( big != NULL );
+    pool.release( big, capacity );
+    CHECK_EQ( pool.trim( 0 ), 3 * SLAB + SLAB );
+}
+
+int main()
+{
+    test_classes();
+    test_trim();
+    return test_result( "buffer_pool_test" );
+}
@@ -0,0 +1,438 @@
+/* 文件缓存和压缩版本缓存的引用计数：命中、失效、淘汰时仍被引用的项保持有效，以及连接处理完请求后
+（包括流水线中的 HEAD 之后紧跟 GET）不会遗留引用，以及按 Accept-Encoding 协商压缩编码，
+HEAD 和条件请求针对协商出的版本 */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <string>
+
+#include "test_util.h"
+#include "conn_harness.h"
+#include "file_cache.h"
+#include "variant_cache.h"
+
+
+/* 解压 gzip 格式的应答体，zlib 为 true 时按 deflate 编码使用的 zlib 格式解压 */
+static std::string gunzip( const std::string& data, bool zlib = false )
+{
+    z_stream zs;
+    memset( &zs, 0, sizeof( zs ) );
+    if ( inflateInit2( &zs, zlib ? 15 : 15 + 16 ) != Z_OK )
+    {
+        return "";
+    }
+    std::string out;
+    char buf[ 4096 ];
+    zs.next_in = ( Bytef* )data.data();
+    zs.avail_in = data.size();
+    int ret = Z_OK;
+    while ( ret == Z_OK )
+    {
+        zs.next_out = ( Bytef* )buf;
+        zs.avail_out = sizeof( buf );
+        ret = inflate( &zs, Z_NO_FLUSH );
+        out.append( buf, sizeof( buf ) - zs.avail_out );
+    }
+    inflateEnd( &zs );
+    return ( ret == Z_STREAM_END ) ? out : "";
+}
+
+static void test_file_cache( const std::string& root )
+{
+    write_test_file( root, "a.bin", "aaaaaaaaaa" );
+    write_test_file( root, "b.bin", "bbbbbbbbbb" );
+    std::string a = root + "/a.bin";
+    std::string b = root + "/b.bin";
+    struct stat st;
+
+    /* 预算只够放一个文件，检查间隔为 0，每次命中都重新 stat */
+    file_cache cache( 15, 1024, 0 );
+    CHECK( cache.lookup( a.c_str() ) == NULL );
+    stat( a.c_str(), &st );
+    file_cache_entry* ea = cache.insert( a.c_str(), st );
+    CHECK( ea != NULL );
+    if ( !ea )
+    {
+        return;
+    }
+    CHECK_EQ( ea->refcount, 2 );
+    CHECK( !ea->header.empty() );
+    file_cache_entry* hit = cache.lookup( a.c_str() );
+    CHECK( hit == ea );
+    CHECK_EQ( ea->refcount, 3 );
+    cache.release( hit );
+    CHECK_EQ( ea->refcount, 2 );
+
+    /* 放入 b 超出预算，a 被淘汰，但调用者持有的引用和映射仍然有效 */
+    stat( b.c_str(), &st );
+    file_cache_entry* eb = cache.insert( b.c_str(), st );
+    CHECK( eb != NULL );
+    CHECK( !ea->linked );
+    CHECK_EQ( ea->refcount, 1 );
+    CHECK( memcmp( ea->address, "aaaaaaaaaa", 10 ) == 0 );
+    CHECK( cache.lookup( a.c_str() ) == NULL );
+    cache.release( ea );
+
+    /* 文件被替换之后不再命中，旧的映射仍然是替换前的内容 */
+    write_test_file( root, "b.new", "changed content" );
+    rename( ( root + "/b.new" ).c_str(), b.c_str() );
+    CHECK( cache.lookup( b.c_str() ) == NULL );
+    CHECK( eb && !eb->linked );
+    if ( eb )
+    {
+        CHECK( memcmp( eb->address, "bbbbbbbbbb", 10 ) == 0 );
+        cache.release( eb );
+    }
+
+    /* 过大和空的文件不进入缓存 */
+    write_test_file( root, "empty.bin", "" );
+    stat( ( root + "/empty.bin" ).c_str(), &st );
+    CHECK( cache.insert( ( root + "/empty.bin" ).c_str(), st ) == NULL );
+    write_test_file( root, "large.bin", std::string( 2048, 'x' ) );
+    stat( ( root + "/large.bin" ).c_str(), &st );
+    CHECK( cache.insert( ( root + "/large.bin" ).c_str(), st ) == NULL );
+}
+
+static void test_variant_cache( const std::string& root )
+{
+    std::string text( 4000, 'x' );
+    write_test_file( root, "v.txt", text );
+    std::string path = root + "/v.txt";
+    struct stat st;
+    stat( path.c_str(), &st );
+
+    variant_cache cache( 1024 * 1024 );
+    CHECK( cache.lookup( path.c_str(), ENCODING_GZIP, st ) == NULL );
+    variant_entry* gz = cache.insert( path.c_str(), ENCODING_GZIP, st, text.data() );
+    CHECK( gz && gz->data && ( gz->size < text.size() ) );
+    if ( !gz || !gz->data )
+    {
+        return;
+    }
+    CHECK_EQ( gunzip( std::string( gz->data, gz->size ) ), text );
+    CHECK_EQ( gz->refcount, 2 );
+    /* 不同的编码是不同的项 */
+    CHECK( cache.lookup( path.c_str(), ENCODING_DEFLATE, st ) == NULL );
+    variant_entry* hit = cache.lookup( path.c_str(), ENCODING_GZIP, st );
+    CHECK( hit == gz );
+    cache.release( hit );
+
+    /* 原文件变化后压缩版本失效，持有的引用仍然可以读 */
+    struct stat changed = st;
+    changed.st_mtim.tv_nsec ^= 1;
+    CHECK( cache.lookup( path.c_str(), ENCODING_GZIP, changed ) == NULL );
+    CHECK( !gz->linked );
+    CHECK_EQ( gunzip( std::string( gz->data, gz->size ) ), text );
+    cache.release( gz );
+
+    /* 压缩后没有变小的内容记一个空项，长度取自 st */
+    std::string noise( 200, '\0' );
+    unsigned x = 1;
+    for ( size_t i = 0; i < noise.size(); ++i )
+    {
+        x = x * 1103515245u + 12345u;
+        noise[i] = ( char )( x >> 24 );
+    }
+    write_test_file( root, "noise.bin", noise );
+    std::string noise_path = root + "/noise.bin";
+    stat( noise_path.c_str(), &st );
+    variant_entry* empty = cache.insert( noise_path.c_str(), ENCODING_DEFLATE, st, noise.data() );
+    CHECK( empty && !empty->data );
+    if ( empty )
+    {
+        cache.release( empty );
+    }
+}
+
+/* 连接处理完请求之后，缓存项上只剩缓存自己的引用：再 lookup 一次应该正好是 2 */
+static void check_idle_refs( const std::string& path, const struct stat& st )
+{
+    file_cache_entry* entry = http_conn::m_file_cache->lookup( path.c_str() );
+    CHECK( entry && ( entry->refcount == 2 ) );
+    if ( entry )
+    {
+        http_conn::m_file_cache->release( entry );
+    }
+    variant_entry* variant = http_conn::m_variant_cache->lookup( path.c_str(), ENCODING_GZIP, st );
+    CHECK( variant && ( variant->refcount == 2 ) );
+    if ( variant )
+    {
+        http_conn::m_variant_cache->release( variant );
+    }
+}
+
+static void test_connection_refs( const std::string& root )
+{
+    std::string text;
+    for ( int i = 0; i < 200; ++i )
+    {
+        text += "<p>compressible line</p>\n";
+    }
+    write_test_file( root, "page.html", text );
+    std::string path = root + "/page.html";
+    struct stat st;
+    stat( path.c_str(), &st );
+    http_conn::m_file_cache = new file_cache();
+    http_conn::m_variant_cache = new variant_cache();
+
+    /* 先各请求一次，文件和压缩版本都进入缓存 */
+    {
+        test_conn c;
+        std::vector< test_response > r = c.exchange( "GET /page.html HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n" );
+        CHECK( ( r.size() == 1 ) && r[0].header( "content-encoding" ) );
+        CHECK( ( r.size() == 1 ) && ( gunzip( r[0].body ) == text ) );
+    }
+    check_idle_refs( path, st );
+
+    /* 流水线中 HEAD 命中压缩版本之后紧跟 GET：GET 的头部必须描述它自己的应答体 */
+    const char* follow[] = {
+        "GET /page.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n",
+        "GET /page.html HTTP/1.1\r\nAccept-Encoding: gzip\r\nConnection: keep-alive\r\n\r\n",
+    };
+    for ( int i = 0; i < 2; ++i )
+    {
+        test_conn c;
+        std::vector< bool > heads;
+        heads.push_back( true );
+        heads.push_back( false );
+        std::vector< test_response > r = c.exchange(
+            std::string( "HEAD /page.html HTTP/1.1\r\nAccept-Encoding: gzip\r\nConnection: keep-alive\r\n\r\n" )
+            + follow[i], 2, heads );
+        CHECK_EQ( r.size(), 2u );
+        if ( r.size() != 2 )
+        {
+            continue;
+        }
+        CHECK( r[0].header( "content-encoding" ) && ( strcmp( r[0].header( "content-encoding" ), "gzip" ) == 0 ) );
+        bool gzip = ( i == 1 );
+        CHECK_EQ( r[1].header( "content-encoding" ) != NULL, gzip );
+        CHECK_EQ( gzip ? gunzip( r[1].body ) : r[1].body, text );
+        /* HEAD 报告的长度与同样条件下的 GET 一致 */
+        if ( gzip )
+        {
+            CHECK( strcmp( r[0].header( "content-length" ), r[1].header( "content-length" ) ) == 0 );
+        }
+        CHECK( !c.closed() );
+    }
+    check_idle_refs( path, st );
+
+    /* 304 和 Range 的应答同样不遗留引用 */
+    {
+        test_conn c;
+        std::vector< test_response > r = c.exchange( "GET /page.html HTTP/1.1\r\nAccept-Encoding: gzip\r\n"
+            "Connection: keep-alive\r\n\r\n" );
+        CHECK( ( r.size() == 1 ) && r[0].header( "etag" ) );
+        if ( ( r.size() == 1 ) && r[0].header( "etag" ) )
+        {
+            std::string etag = r[0].header( "etag" );
+            r = c.exchange( "GET /page.html HTTP/1.1\r\nAccept-Encoding: gzip\r\nIf-None-Match: " + etag
+                + "\r\nConnection: keep-alive\r\n\r\nGET /page.html HTTP/1.1\r\nRange: bytes=0-9\r\n"
+                "Connection: keep-alive\r\n\r\n", 2 );
+            CHECK( ( r.size() == 2 ) && ( r[0].status == 304 ) && ( r[1].status == 206 ) );
+            CHECK( ( r.size() == 2 ) && ( r[1].body == text.substr( 0, 10 ) ) );
+        }
+    }
+    check_idle_refs( path, st );
+
+    delete http_conn::m_variant_cache;
+    http_conn::m_variant_cache = NULL;
+    delete http_conn::m_file_cache;
+    http_conn::m_file_cache = NULL;
+}
+
+/* 按 Accept-Encoding 协商编码：q=0 表示拒绝，两种都接受时选 gzip，* 当作 gzip；可压缩类型的应答总是带 Vary，
+其他类型既不压缩也不带 Vary。目录下有预先压缩的 .gz 文件时原样发送它 */
+static void test_negotiation( const std::string& root )
+{
+    std::string text;
+    for ( int i = 0; i < 200; ++i )
+    {
+        text += "line of compressible text\n";
+    }
+    write_test_file( root, "notes.txt", text );
+    write_test_file( root, "style.css", text );
+    write_test_file( root, "style.css.gz", "precompressed" );
+    write_test_file( root, "blob.bin", text );
+    http_conn::m_variant_cache = new variant_cache();
+
+    struct
+    {
+        const char* path;
+        const char* accept;     // Accept-Encoding 的值，NULL 表示没有这个头部
+        const char* encoding;   // 期望的 Content-Encoding，NULL 表示不压缩
+        bool vary;
+    } cases[] = {
+        { "/notes.txt", NULL, NULL, true },
+        { "/notes.txt", "gzip", "gzip", true },
+        { "/notes.txt", "deflate", "deflate", true },
+        { "/notes.txt", "gzip;q=0, deflate", "deflate", true },
+        { "/notes.txt", "deflate;q=0.5, gzip;q=1.0", "gzip", true },
+        { "/notes.txt", "GZIP ; Q=0", NULL, true },
+        { "/notes.txt", "gzip;q=0.0, deflate;q=0", NULL, true },
+        { "/notes.txt", "identity", NULL, true },
+        { "/notes.txt", "br, *", "gzip", true },
+        { "/style.css", "gzip", "gzip", true },
+        { "/style.css", "deflate", "deflate", true },
+        { "/blob.bin", "gzip, deflate", NULL, false },
+    };
+    for ( unsigned i = 0; i < sizeof( cases ) / sizeof( cases[0] ); ++i )
+    {
+        std::string request = std::string( "GET " ) + cases[i].path + " HTTP/1.1\r\n";
+        if ( cases[i].accept )
+        {
+            request += std::string( "Accept-Encoding: " ) + cases[i].accept + "\r\n";
+        }
+        test_conn c;
+        std::vector< test_response > r = c.exchange( request + "\r\n" );
+        CHECK_EQ( r.size(), 1u );
+        if ( r.size() != 1 )
+        {
+            continue;
+        }
+        const char* encoding = r[0].header( "content-encoding" );
+        const char* vary = r[0].header( "vary" );
+        bool ok = ( r[0].status == 200 ) && ( ( encoding == NULL ) == ( cases[i].encoding == NULL ) )
+            && ( !encoding || ( strcmp( encoding, cases[i].encoding ) == 0 ) )
+            && ( ( vary != NULL ) == cases[i].vary ) && ( !vary || ( strcmp( vary, "Accept-Encoding" ) == 0 ) );
+        if ( !encoding )
+        {
+            ok = ok && ( r[0].body == text );
+        }
+        else if ( ( strcmp( cases[i].path, "/style.css" ) == 0 ) && ( strcmp( encoding, "gzip" ) == 0 ) )
+        {
+            ok = ok && ( r[0].body == "precompressed" );
+        }
+        else
+        {
+            ok = ok && ( gunzip( r[0].body, strcmp( encoding, "deflate" ) == 0 ) == text );
+        }
+        if ( !ok )
+        {
+            fprintf( stderr, "negotiation case %u: GET %s with Accept-Encoding %s\n", i, cases[i].path,
+                cases[i].accept ? cases[i].accept : "(none)" );
+        }
+        CHECK( ok );
+    }
+
+    delete http_conn::m_variant_cache;
+    http_conn::m_variant_cache = NULL;
+}
+
+/* 压缩版本缓存未命中时 HEAD 同样协商出压缩版本，头部和 ETag 与 GET 的相同；If-None-Match 和 If-Range
+与选定的版本的 ETag 比较，原文件的 ETag 不匹配压缩版本 */
+static void test_head_negotiation( const std::string& root )
+{
+    std::string text;
+    for ( int i = 0; i < 200; ++i )
+    {
+        text += "<li>negotiated item</li>\n";
+    }
+    write_test_file( root, "list.html", text );
+    const char* gzip = "Accept-Encoding: gzip\r\nConnection: keep-alive\r\n";
+
+    for ( int cached = 0; cached < 2; ++cached )
+    {
+        http_conn::m_file_cache = cached ? new file_cache() : NULL;
+
+        /* 原文件的 ETag */
+        std::string identity;
+        {
+            test_conn c;
+            std::vector< test_response > r = c.exchange( "GET /list.html HTTP/1.1\r\n\r\n" );
+            CHECK( ( r.size() == 1 ) && r[0].header( "etag" ) && !r[0].header( "content-encoding" ) );
+            identity = ( ( r.size() == 1 ) && r[0].header( "etag" ) ) ? r[0].header( "etag" ) : "";
+        }
+
+        /* 每次都用空的压缩版本缓存，HEAD 是第一个请求 */
+        http_conn::m_variant_cache = new variant_cache();
+        std::string etag;
+        std::string body;
+        {
+            test_conn c;
+            std::vector< bool > heads;
+            heads.push_back( true );
+            heads.push_back( false );
+            std::vector< test_response > r = c.exchange( std::string( "HEAD /list.html HTTP/1.1\r\n" ) + gzip
+                + "\r\nGET /list.html HTTP/1.1\r\n" + gzip + "\r\n", 2, heads );
+            CHECK_EQ( r.size(), 2u );
+            if ( r.size() == 2 )
+            {
+                const char* names[] = { "content-encoding", "content-length", "etag", "vary", "last-modified" };
+                bool same = true;
+                for ( unsigned i = 0; i < sizeof( names ) / sizeof( names[0] ); ++i )
+                {
+                    const char* head = r[0].header( names[i] );
+                    const char* get = r[1].header( names[i] );
+                    same = same && head && get && ( strcmp( head, get ) == 0 );
+                }
+                CHECK( same );
+                CHECK( r[0].header( "content-encoding" ) && ( strcmp( r[0].header( "content-encoding" ), "gzip" ) == 0 ) );
+                CHECK( r[0].body.empty() );
+                CHECK_EQ( gunzip( r[1].body ), text );
+                etag = r[1].header( "etag" ) ? r[1].header( "etag" ) : "";
+                body = r[1].body;
+            }
+            CHECK( etag != identity );
+        }
+        delete http_conn::m_variant_cache;
+
+        /* 未命中时 HEAD 和 GET 带着压缩版本的 ETag 都得到 304；带着原文件的 ETag 得到压缩版本 */
+        http_conn::m_variant_cache = new variant_cache();
+        {
+            test_conn c;
+            std::vector< bool > heads;
+            heads.push_back( true );
+            heads.push_back( false );
+            heads.push_back( false );
+            std::vector< test_response > r = c.exchange( std::string( "HEAD /list.html HTTP/1.1\r\n" ) + gzip
+                + "If-None-Match: " + etag + "\r\n\r\nGET /list.html HTTP/1.1\r\n" + gzip
+                + "If-None-Match: " + etag + "\r\n\r\nGET /list.html HTTP/1.1\r\n" + gzip
+                + "If-None-Match: " + identity + "\r\n\r\n", 3, heads );
+            CHECK_EQ( r.size(), 3u );
+            if ( r.size() == 3 )
+            {
+                CHECK_EQ( r[0].status, 304 );
+                CHECK_EQ( r[1].status, 304 );
+                CHECK( r[1].header( "etag" ) && ( etag == r[1].header( "etag" ) ) );
+                CHECK_EQ( r[2].status, 200 );
+                CHECK( r[2].header( "content-encoding" ) && ( strcmp( r[2].header( "content-encoding" ), "gzip" ) == 0 ) );
+                CHECK_EQ( r[2].body, body );
+            }
+        }
+        delete http_conn::m_variant_cache;
+
+        /* If-Range 同样：压缩版本的 ETag 取压缩后内容的片段，原文件的 ETag 发送整个压缩版本 */
+        http_conn::m_variant_cache = new variant_cache();
+        {
+            test_conn c;
+            std::vector< test_response > r = c.exchange( std::string( "GET /list.html HTTP/1.1\r\n" ) + gzip
+                + "Range: bytes=0-9\r\nIf-Range: " + etag + "\r\n\r\nGET /list.html HTTP/1.1\r\n" + gzip
+                + "Range: bytes=0-9\r\nIf-Range: " + identity + "\r\n\r\n", 2 );
+            CHECK_EQ( r.size(), 2u );
+            if ( r.size() == 2 )
+            {
+                CHECK_EQ( r[0].status, 206 );
+                CHECK_EQ( r[0].body, body.substr( 0, 10 ) );
+                CHECK_EQ( r[1].status, 200 );
+                CHECK_EQ( r[1].body, body );
+            }
+        }
+        delete http_conn::m_variant_cache;
+        http_conn::m_variant_cache = NULL;
+        delete http_conn::m_file_cache;
+        http_conn::m_file_cache = NULL;
+    }
+}
+
+int main()
+{
+    std::string root = setup_doc_root();
+    test_file_cache( root );
+    test_variant_cache( root );
+    test_connection_refs( root );
+    test_negotiation( root );
+    test_head_negotiation( root );
+    remove_doc_root( root );
+    return test_result( "cache_test" );
+}
@@ -0,0 +1,307 @@
+#ifndef CONN_HARNESS_H
+#define CONN_HARNESS_H
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "http_conn.h"
+#include "admission.h"
+
+/* 网站根目录，定义在 http_conn.cpp 中，测试把它指向一个临时目录 */
+extern const char* doc_root;
+
+
+/* 解析出来的一个应答，头部的字段名都转成小写 */
+struct test_response
+{
+    int status;
+    std::map< std::string, std::string > headers;
+    std::string body;
+
+    const char* header( const char* name ) const
+    {
+        std::map< std::string, std::string >::const_iterator it = headers.find( name );
+        return ( it == headers.end() ) ? NULL : it->second.c_str();
+    }
+};
+
+/* 从 buf 的 *pos 处解析一个完整的应答，不完整时返回 false 并且不移动 *pos。
+head 为 true 时按 HEAD 请求的应答处理，只有头部。100 Continue 这样的中间应答直接跳过 */
+static bool parse_test_response( const std::string& buf, size_t* pos, bool head, test_response* out )
+{
+    size_t start = *pos;
+    while ( true )
+    {
+        size_t end = buf.find( "\r\n\r\n", start );
+        if ( end == std::string::npos )
+        {
+            return false;
+        }
+        test_response r;
+        r.status = atoi( buf.c_str() + start + 9 );
+        size_t line = buf.find( "\r\n", start ) + 2;
+        while ( line < end + 2 )
+        {
+            size_t next = buf.find( "\r\n", line );
+            size_t colon = buf.find( ':', line );
+            if ( ( colon != std::string::npos ) && ( colon < next ) )
+            {
+                std::string name = buf.substr( line, colon - line );
+                for ( size_t i = 0; i < name.size(); ++i )
+                {
+                    name[i] = ( char )tolower( ( unsigned char )name[i] );
+                }
+                size_t value = buf.find_first_not_of( ' ', colon + 1 );
+                r.headers[ name ] = buf.substr( value, next - value );
+            }
+            line = next + 2;
+        }
+        size_t body = end + 4;
+        if ( r.status / 100 == 1 )
+        {
+            start = body;
+            continue;
+        }
+        size_t len = 0;
+        if ( !head && ( r.status != 204 ) && ( r.status != 304 ) && r.header( "content-length" ) )
+        {
+            len = strtoul( r.header( "content-length" ), NULL, 10 );
+        }
+        if ( buf.size() < body + len )
+        {
+            return false;
+        }
+        r.body = buf.substr( body, len );
+        *pos = body + len;
+        *out = r;
+        return true;
+    }
+}
+
+
+/* 用一对 UNIX socket 驱动一个真实的 http_conn：测试在 client 一端收发，连接的事件注册在自己的 epoll 上，
+按照 reactor 的做法处理，只是 process() 直接在当前线程中调用 */
+class test_conn
+{
+public:
+    test_conn(): m_gate( NULL ), m_depth( 0 ), m_closed( false ), m_parsed( 0 )
+    {
+        int fds[2];
+        socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds );
+        m_client = fds[1];
+        m_epollfd = epoll_create( 1 );
+        sockaddr_in addr;
+        memset( &addr, 0, sizeof( addr ) );
+        m_conn.init( fds[0], addr, m_epollfd );
+    }
+
+    ~test_conn()
+    {
+        if ( !m_closed )
+        {
+            m_conn.close_conn();
+        }
+        close( m_client );
+        close( m_epollfd );
+    }
+
+    void send_raw( const std::string& data )
+    {
+        size_t done = 0;
+        while ( done < data.size() )
+        {
+            ssize_t n = ::send( m_client, data.data() + done, data.size() - done, MSG_NOSIGNAL );
+            if ( n > 0 )
+            {
+                done += n;
+            }
+            else
+            {
+                pump( 1 );
+            }
+        }
+    }
+
+    /* 处理连接上的事件，直到收到 count 个应答、连接关闭或者 200 毫秒内没有任何事件。heads[i] 表示第 i 个应答
+    是不是 HEAD 请求的，缺省都不是。返回收到的应答 */
+    std::vector< test_response > responses( size_t count, const std::vector< bool >& heads = std::vector< bool >() )
+    {
+        std::vector< test_response > out;
+        while ( true )
+        {
+            drain();
+            test_response r;
+            bool head = ( out.size() < heads.size() ) && heads[ out.size() ];
+            while ( ( out.size() < count ) && parse_test_response( m_received, &m_parsed, head, &r ) )
+            {
+                out.push_back( r );
+                head = ( out.size() < heads.size() ) && heads[ out.size() ];
+            }
+            /* count 为 0 时只是处理完已经到达的数据，短暂空闲就返回 */
+            if ( ( ( count > 0 ) && ( out.size() >= count ) ) || m_closed || !pump( count ? 200 : 10 ) )
+            {
+                break;
+            }
+        }
+        return out;
+    }
+
+    /* 发送一段请求并等待 count 个应答 */
+    std::vector< test_response > exchange( const std::string& request, size_t count = 1,
+        const std::vector< bool >& heads = std::vector< bool >() )
+    {
+        send_raw( request );
+        return responses( count, heads );
+    }
+
+    /* 服务器一端是否已经关闭了连接 */
+    bool closed()
+    {
+        pump( 50 );
+        drain();
+        return m_closed;
+    }
+
+    http_conn& conn() { return m_conn; }
+
+    /* 之后读到的请求像 reactor 的 dispatch 那样先经过接纳控制，depth 是当作线程池队列深度的值。
+    被拒绝的请求由 shed 回复 503 并关闭连接 */
+    void set_gate( admission* gate, int depth )
+    {
+        m_gate = gate;
+        m_depth = depth;
+    }
+
+private:
+    /* 处理一个事件，等待 timeout_ms 毫秒仍然没有事件时返回 false */
+    bool pump( int timeout_ms )
+    {
+        if ( m_closed )
+        {
+            return false;
+        }
+        epoll_event ev;
+        if ( epoll_wait( m_epollfd, &ev, 1, timeout_ms ) != 1 )
+        {
+            return false;
+        }
+        if ( ev.events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+        {
+            close_server();
+        }
+        else if ( ev.events & EPOLLIN )
+        {
+            if ( m_conn.read() )
+            {
+                m_conn.begin_request();
+                if ( m_gate && ( m_gate->admit_requests( m_depth, 1 ) == 0 ) )
+                {
+                    m_conn.shed();
+                    m_closed = true;
+                }
+                else
+                {
+                    m_conn.process();
+                }
+            }
+            else
+            {
+                close_server();
+            }
+        }
+        else if ( ev.events & EPOLLOUT )
+        {
+            if ( !m_conn.write() )
+            {
+                close_server();
+            }
+            else if ( m_conn.has_pending_request() )
+            {
+                m_conn.process();
+            }
+        }
+        return true;
+    }
+
+    void close_server()
+    {
+        m_conn.close_conn();
+        m_closed = true;
+    }
+
+    void drain()
+    {
+        char buf[ 65536 ];
+        ssize_t n;
+        while ( ( n = recv( m_client, buf, sizeof( buf ), MSG_DONTWAIT ) ) > 0 )
+        {
+            m_received.append( buf, n );
+        }
+        /* process 中出错时连接由 http_conn 自己关闭，这里只能从客户端一端读到结束看出来 */
+        if ( n == 0 )
+        {
+            m_closed = true;
+        }
+    }
+
+private:
+    http_conn m_conn;
+    admission* m_gate;
+    int m_depth;
+    int m_client;
+    int m_epollfd;
+    bool m_closed;
+    std::string m_received;
+    size_t m_parsed;
+};
+
+
+/* 创建一个临时的网站根目录并让 http_conn 使用它，同时完成 http_conn 的静态初始化 */
+static std::string setup_doc_root()
+{
+    static char dir[] = "/tmp/http_test.XXXXXX";
+    if ( !mkdtemp( dir ) )
+    {
+        abort();
+    }
+    doc_root = dir;
+    if ( !http_conn::m_buffer_pool )
+    {
+        http_conn::m_buffer_pool = new buffer_pool;
+        http_conn::init_static_responses();
+    }
+    return dir;
+}
+
+/* 在网站根目录下写一个所有人可读的文件 */
+static void write_test_file( const std::string& root, const char* name, const std::string& content )
+{
+    std::string path = root + "/" + name;
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( ( fd < 0 ) || ( ::write( fd, content.data(), content.size() ) != ( ssize_t )content.size() ) )
+    {
+        abort();
+    }
+    close( fd );
+}
+
+/* 删除测试创建的文件和目录 */
+static void remove_doc_root( const std::string& root )
+{
+    std::string cmd = "rm -rf " + root;
+    if ( system( cmd.c_str() ) != 0 )
+    {
+        fprintf( stderr, "failed to remove %s\n", root.c_str() );
+    }
+}
+
+#endif
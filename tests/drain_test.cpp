@@ -0,0 +1,348 @@
+/* 先排空再停止：线程池的 shutdown 等队列中的和正在处理的任务完成，超时时丢弃剩下的，关闭之后拒绝新任务；
+服务器收到 SIGTERM 后不再接受连接，关闭空闲连接，正在发送的应答发完整之后才关闭连接，最后正常退出。
+服务器程序的路径由第一个参数给出 */
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+#include "15-3_threadpoll.h"
+#include "http_conn.h"
+
+
+/* 线程池的任务：先睡 sleep_us 微秒再记录执行次数，hold 不为空时还要等它变为 true */
+struct slow_task
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+    int sleep_us;
+    std::atomic< int > runs;
+    const std::atomic< bool >* hold;
+
+    void process()
+    {
+        usleep( sleep_us );
+        while ( hold && !hold->load() )
+        {
+            sched_yield();
+        }
+        runs.fetch_add( 1 );
+    }
+};
+
+static void init_tasks( std::vector< slow_task >& tasks, int sleep_us )
+{
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].m_deadline_ns = 0;
+        tasks[i].m_priority = 0;
+        tasks[i].sleep_us = sleep_us;
+        tasks[i].runs.store( 0 );
+        tasks[i].hold = NULL;
+    }
+}
+
+static void test_pool_drain()
+{
+    std::vector< slow_task > tasks( 200 );
+    init_tasks( tasks, 200 );
+    threadpoll< slow_task > pool( 2, 1000 );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    CHECK( pool.shutdown( 10000 ) );
+    bool once = true;
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        once = once && ( tasks[i].runs.load() == 1 );
+    }
+    CHECK( once );
+
+    /* 关闭之后提交的任务被拒绝，并且计入 rejected_closing */
+    slow_task* late[ 3 ] = { &tasks[0], &tasks[1], &tasks[2] };
+    bool accepted[ 3 ] = { true, true, true };
+    CHECK( !pool.append( &tasks[0] ) );
+    CHECK_EQ( pool.append_batch( late, 3, accepted ), 0u );
+    CHECK( !accepted[0] && !accepted[1] && !accepted[2] );
+    threadpoll_snapshot s;
+    pool.snapshot( s );
+    CHECK_EQ( s.rejected_closing, 4u );
+    CHECK_EQ( s.rejected_full, 0u );
+    CHECK_EQ( tasks[0].runs.load(), 1 );
+}
+
+struct release_arg
+{
+    std::atomic< bool >* flag;
+    int delay_us;
+};
+
+static void* release_later( void* arg )
+{
+    release_arg* a = ( release_arg* )arg;
+    usleep( a->delay_us );
+    a->flag->store( true );
+    return NULL;
+}
+
+/* 唯一的工作线程被占住，期限内排不空：shutdown 返回 false，等正在执行的任务结束后回收线程，队列中剩下的不再执行 */
+static void test_pool_timeout()
+{
+    std::vector< slow_task > tasks( 6 );
+    init_tasks( tasks, 0 );
+    std::atomic< bool > release( false );
+    tasks[0].hold = &release;
+    threadpoll< slow_task > pool( 1, 16 );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    release_arg arg = { &release, 300000 };
+    pthread_t releaser;
+    pthread_create( &releaser, NULL, release_later, &arg );
+    CHECK( !pool.shutdown( 50 ) );
+    pthread_join( releaser, NULL );
+    CHECK_EQ( tasks[0].runs.load(), 1 );
+    int rest = 0;
+    for ( size_t i = 1; i < tasks.size(); ++i )
+    {
+        rest += tasks[i].runs.load();
+    }
+    CHECK_EQ( rest, 0 );
+}
+
+static int free_port()
+{
+    int fd = socket( PF_INET, SOCK_STREAM, 0 );
+    struct sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    inet_pton( AF_INET, "127.0.0.1", &address.sin_addr );
+    socklen_t len = sizeof( address );
+    bind( fd, ( struct sockaddr* )&address, len );
+    getsockname( fd, ( struct sockaddr* )&address, &len );
+    close( fd );
+    return ntohs( address.sin_port );
+}
+
+static int connect_to( int port, int rcvbuf )
+{
+    int fd = socket( PF_INET, SOCK_STREAM, 0 );
+    if ( rcvbuf > 0 )
+    {
+        setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ) );
+    }
+    struct sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+    inet_pton( AF_INET, "127.0.0.1", &address.sin_addr );
+    if ( connect( fd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 )
+    {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+/* 读到对方关闭连接为止，timeout_ms 毫秒内没有关闭时返回 false */
+static bool read_until_close( int fd, std::string& data, int timeout_ms )
+{
+    char buf[ 65536 ];
+    while ( true )
+    {
+        struct pollfd p = { fd, POLLIN, 0 };
+        if ( poll( &p, 1, timeout_ms ) <= 0 )
+        {
+            return false;
+        }
+        ssize_t n = recv( fd, buf, sizeof( buf ), 0 );
+        if ( n <= 0 )
+        {
+            return ( n == 0 ) || ( errno == ECONNRESET );
+        }
+        data.append( buf, n );
+    }
+}
+
+/* 把 data 切分成完整的应答，返回应答个数；最后剩下不完整的数据时 complete 为 false */
+static int count_responses( const std::string& data, bool* complete )
+{
+    size_t pos = 0;
+    int count = 0;
+    while ( pos < data.size() )
+    {
+        size_t end = data.find( "\r\n\r\n", pos );
+        if ( end == std::string::npos )
+        {
+            break;
+        }
+        size_t length = 0;
+        size_t field = data.find( "Content-Length: ", pos );
+        if ( ( field != std::string::npos ) && ( field < end ) )
+        {
+            length = strtoul( data.c_str() + field + 16, NULL, 10 );
+        }
+        if ( data.size() < end + 4 + length )
+        {
+            break;
+        }
+        pos = end + 4 + length;
+        ++count;
+    }
+    *complete = ( pos == data.size() );
+    return count;
+}
+
+static void test_server_drain( const char* server )
+{
+    int port = free_port();
+    char port_arg[ 16 ];
+    snprintf( port_arg, sizeof( port_arg ), "%d", port );
+    int out[2];
+    CHECK( pipe( out ) == 0 );
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        dup2( out[1], STDOUT_FILENO );
+        int null = open( "/dev/null", O_WRONLY );
+        dup2( null, STDERR_FILENO );
+        close( out[0] );
+        execl( server, server, "-r", "2", "-g", "5", "127.0.0.1", port_arg, ( char* )NULL );
+        _exit( 127 );
+    }
+    close( out[1] );
+
+    /* 服务器启动之后才能连上 */
+    int idle = -1;
+    for ( int i = 0; ( i < 300 ) && ( idle < 0 ); ++i )
+    {
+        idle = connect_to( port, 0 );
+        if ( idle < 0 )
+        {
+            usleep( 10000 );
+        }
+    }
+    CHECK( idle >= 0 );
+    if ( idle < 0 )
+    {
+        kill( pid, SIGKILL );
+        waitpid( pid, NULL, 0 );
+        return;
+    }
+    const char* request = "GET /no-such-file HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    send( idle, request, strlen( request ), MSG_NOSIGNAL );
+    char buf[ 4096 ];
+    CHECK( recv( idle, buf, sizeof( buf ), 0 ) > 0 );
+
+    /* 另一个连接流水线发来大量请求却先不读。应答是请求的三倍左右，远远超过内核的发送缓冲，服务器一定会停在
+    一批应答的发送中间。读缓冲的上限是 64KB，服务器每次只取一部分请求，其余的留在内核的接收缓冲中 */
+    int busy = connect_to( port, 4096 );
+    CHECK( busy >= 0 );
+    std::string pipeline;
+    while ( pipeline.size() < 8 * 1024 * 1024 )
+    {
+        pipeline += request;
+    }
+    fcntl( busy, F_SETFL, fcntl( busy, F_GETFL ) | O_NONBLOCK );
+    size_t sent = 0;
+    for ( int stalled = 0; ( stalled < 50 ) && ( sent < pipeline.size() ); )
+    {
+        ssize_t n = send( busy, pipeline.data() + sent, pipeline.size() - sent, MSG_NOSIGNAL );
+        if ( n > 0 )
+        {
+            sent += n;
+            stalled = 0;
+        }
+        else
+        {
+            ++stalled;
+            usleep( 2000 );
+        }
+    }
+    CHECK( sent > 0 );
+    usleep( 200000 );
+
+    kill( pid, SIGTERM );
+    usleep( 300000 );
+
+    /* 不再接受新连接 */
+    int late = connect_to( port, 0 );
+    CHECK( late < 0 );
+    if ( late >= 0 )
+    {
+        close( late );
+    }
+
+    /* 正在发送的一批应答发完整之后连接才关闭，流水线中后面的请求不再处理。服务器的接收缓冲中还有没读的请求，
+    应答不能因为连接被重置而截断 */
+    std::string data;
+    CHECK( read_until_close( busy, data, 5000 ) );
+    bool complete = false;
+    int responses = count_responses( data, &complete );
+    CHECK( responses > 0 );
+    CHECK( ( size_t )responses < sent / strlen( request ) );
+    CHECK( complete );
+    CHECK( data.compare( 0, 12, "HTTP/1.1 404" ) == 0 );
+    close( busy );
+
+    /* 空闲的连接没有再收到任何数据，最迟在服务器退出时被关闭 */
+    std::string rest;
+    CHECK( read_until_close( idle, rest, 5000 ) );
+    CHECK( rest.empty() );
+    close( idle );
+
+    int status = -1;
+    for ( int i = 0; ( i < 1000 ) && ( waitpid( pid, &status, WNOHANG ) == 0 ); ++i )
+    {
+        usleep( 10000 );
+    }
+    CHECK( WIFEXITED( status ) && ( WEXITSTATUS( status ) == 0 ) );
+    if ( !WIFEXITED( status ) )
+    {
+        kill( pid, SIGKILL );
+        waitpid( pid, NULL, 0 );
+    }
+    std::string log;
+    ssize_t n;
+    while ( ( n = read( out[0], buf, sizeof( buf ) ) ) > 0 )
+    {
+        log.append( buf, n );
+    }
+    close( out[0] );
+    /* 服务器一直等到客户端读完正在发送的应答 */
+    size_t took = log.find( "shutdown took " );
+    CHECK( ( took != std::string::npos ) && ( atoi( log.c_str() + took + 14 ) >= 200 ) );
+    CHECK( log.find( " 0 in-flight requests dropped" ) != std::string::npos );
+}
+
+int main( int argc, char* argv[] )
+{
+    test_pool_drain();
+    test_pool_timeout();
+    if ( argc > 1 )
+    {
+        test_server_drain( argv[1] );
+    }
+    else
+    {
+        fprintf( stderr, "no server path given, skipping the SIGTERM test\n" );
+    }
+    return test_result( "drain_test" );
+}
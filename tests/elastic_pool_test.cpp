@@ -0,0 +1,164 @@
+/* 弹性线程池：排队时间超过目标时增加线程但不超过上限，空闲超过冷却时间之后退回下限；
+有任务出队但都没有被采样的周期不算落后；关闭时回收退出了的和还在工作的线程 */
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "test_util.h"
+#include "15-3_threadpoll.h"
+
+
+/* hold 不为空时等它变为 true 才结束，否则睡 sleep_us 微秒 */
+struct block_task
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+    int sleep_us;
+    const std::atomic< bool >* hold;
+    std::atomic< int >* done;
+
+    void process()
+    {
+        while ( hold && !hold->load() )
+        {
+            usleep( 1000 );
+        }
+        if ( sleep_us > 0 )
+        {
+            usleep( sleep_us );
+        }
+        done->fetch_add( 1 );
+    }
+};
+
+/* 和 block_task 一样，单独的类型让它有自己的采样计数，第一个任务一定被采样 */
+struct trickle_task : block_task
+{
+};
+
+template< typename T >
+static void init_tasks( std::vector< T >& tasks, int sleep_us, const std::atomic< bool >* hold, std::atomic< int >* done )
+{
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].m_deadline_ns = 0;
+        tasks[i].m_priority = 0;
+        tasks[i].sleep_us = sleep_us;
+        tasks[i].hold = hold;
+        tasks[i].done = done;
+    }
+}
+
+static long long now_ms()
+{
+    return threadpoll< block_task >::now_ns() / 1000000;
+}
+
+static void test_grow_and_shrink()
+{
+    const int MIN = 1;
+    const int MAX = 4;
+    std::vector< block_task > tasks( 12 );
+    std::atomic< bool > release( false );
+    std::atomic< int > done( 0 );
+    init_tasks( tasks, 0, &release, &done );
+    threadpoll< block_task > pool( MIN, MAX, 64, 1000, 200 );
+    CHECK_EQ( pool.threads(), MIN );
+
+    /* 所有线程都被占住，队列一直不空：管理线程每个周期增加线程，直到上限 */
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    int most = 0;
+    long long deadline = now_ms() + 5000;
+    while ( ( now_ms() < deadline ) && ( most < MAX ) )
+    {
+        int n = pool.threads();
+        most = ( n > most ) ? n : most;
+        usleep( 1000 );
+    }
+    CHECK_EQ( most, MAX );
+    /* 到了上限之后队列仍然不空，也不再增加 */
+    for ( int i = 0; i < 500; ++i )
+    {
+        int n = pool.threads();
+        most = ( n > most ) ? n : most;
+        usleep( 1000 );
+    }
+    CHECK_EQ( most, MAX );
+
+    /* 放开之后任务很快做完，空闲的线程在冷却时间之后退出，只剩下限那么多 */
+    release.store( true );
+    deadline = now_ms() + 5000;
+    while ( ( now_ms() < deadline ) && ( ( done.load() < ( int )tasks.size() ) || ( pool.threads() > MIN ) ) )
+    {
+        usleep( 1000 );
+    }
+    CHECK_EQ( done.load(), ( int )tasks.size() );
+    CHECK_EQ( pool.threads(), MIN );
+    usleep( 300000 );
+    CHECK_EQ( pool.threads(), MIN );
+
+    /* 刚退出的线程可能还没有被管理线程回收，关闭时一起回收，不会卡住 */
+    long long begin = now_ms();
+    CHECK( pool.shutdown( 2000 ) );
+    CHECK( now_ms() - begin < 1000 );
+}
+
+/* 只有一个线程，任务一个接一个地出队，队列在每个周期结束时都不空，但只有第一个任务被采样，
+而且它没有排队。采样的排队时间没有超过目标，就不应该增加线程 */
+static void test_unsampled_period()
+{
+    const int COUNT = threadpoll< trickle_task >::SAMPLE_EVERY;
+    std::vector< trickle_task > tasks( COUNT );
+    std::atomic< int > done( 0 );
+    init_tasks( tasks, 20000, NULL, &done );
+    threadpoll< trickle_task > pool( 1, 4, 64, 1000, 1000 );
+    for ( int i = 0; i < COUNT; ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    int most = 0;
+    while ( done.load() < COUNT )
+    {
+        int n = pool.threads();
+        most = ( n > most ) ? n : most;
+        usleep( 1000 );
+    }
+    CHECK_EQ( most, 1 );
+    CHECK( pool.shutdown( 2000 ) );
+}
+
+/* 线程数增加之后马上关闭：队列中的和正在执行的任务做完，包括运行中启动的线程在内都被回收 */
+static void test_shutdown_busy()
+{
+    std::vector< block_task > tasks( 6 );
+    std::atomic< bool > release( false );
+    std::atomic< int > done( 0 );
+    init_tasks( tasks, 0, &release, &done );
+    threadpoll< block_task > pool( 2, 3, 16, 1000, 100 );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    long long deadline = now_ms() + 5000;
+    while ( ( now_ms() < deadline ) && ( pool.threads() < 3 ) )
+    {
+        usleep( 1000 );
+    }
+    CHECK_EQ( pool.threads(), 3 );
+    release.store( true );
+    CHECK( pool.shutdown( 5000 ) );
+    CHECK_EQ( done.load(), ( int )tasks.size() );
+}
+
+int main()
+{
+    test_grow_and_shrink();
+    test_unsampled_period();
+    test_shutdown_busy();
+    return test_result( "elastic_pool_test" );
+}
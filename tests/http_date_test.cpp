@@ -0,0 +1,166 @@
+/* 缓存的 Date 字符串：第一次刷新之前退回到直接格式化；一个线程不断刷新不同的时间时，并发的读者拿到的
+总是某一次刷新写入的完整的 IMF-fixdate，不会是两次刷新拼在一起的，而且同一个读者看到的不会往回走 */
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+#include "http_response.h"
+
+
+/* 逐个字符检查 "Sun, 06 Nov 1994 08:49:37 GMT" 的格式 */
+static bool well_formed( const char* s )
+{
+    static const char* days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    static const char* pattern = "www, dd mmm dddd dd:dd:dd GMT";
+    bool day = false;
+    for ( int i = 0; i < 7; ++i )
+    {
+        day = day || ( memcmp( s, days[i], 3 ) == 0 );
+    }
+    bool month = false;
+    for ( int i = 0; i < 12; ++i )
+    {
+        month = month || ( memcmp( s + 8, months[i], 3 ) == 0 );
+    }
+    if ( !day || !month )
+    {
+        return false;
+    }
+    for ( int i = 0; i < HTTP_DATE_LEN; ++i )
+    {
+        char p = pattern[i];
+        if ( ( p == 'd' ) ? ( ( s[i] < '0' ) || ( s[i] > '9' ) ) : ( ( p != 'w' ) && ( p != 'm' ) && ( s[i] != p ) ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 还没有刷新过时格式化当前时间 */
+static void test_fallback()
+{
+    char before[ 64 ];
+    char after[ 64 ];
+    char buf[ HTTP_DATE_LEN + 1 ] = "";
+    format_http_date( time( NULL ), before, sizeof( before ) );
+    http_date( buf );
+    format_http_date( time( NULL ), after, sizeof( after ) );
+    CHECK( well_formed( buf ) );
+    CHECK( ( memcmp( buf, before, HTTP_DATE_LEN ) == 0 ) || ( memcmp( buf, after, HTTP_DATE_LEN ) == 0 ) );
+}
+
+/* 相邻两次刷新的时间相差一天一小时一分一秒，每一段都不同，拼起来的字符串不会碰巧等于某一次写入的 */
+static const int TICKS = 100000;
+static const time_t FIRST = 784111777;
+static const time_t STEP = 90061;
+static const int READERS = 3;
+
+static std::map< std::string, int > published;
+static std::atomic< bool > ticking( true );
+
+struct reader_result
+{
+    long reads;
+    long malformed;
+    long unknown;
+    long backwards;
+};
+
+static void* ticker( void* )
+{
+    for ( int i = 0; i < TICKS; ++i )
+    {
+        http_date_tick( FIRST + i * STEP );
+    }
+    ticking.store( false, std::memory_order_release );
+    return NULL;
+}
+
+static void* reader( void* arg )
+{
+    reader_result* r = ( reader_result* )arg;
+    int last = -1;
+    char buf[ HTTP_DATE_LEN + 1 ] = "";
+    bool more = true;
+    while ( more )
+    {
+        /* 刷新结束之后再读一次，保证读到最后写入的值 */
+        more = ticking.load( std::memory_order_acquire );
+        http_date( buf );
+        ++r->reads;
+        if ( !well_formed( buf ) )
+        {
+            ++r->malformed;
+            continue;
+        }
+        std::map< std::string, int >::const_iterator it = published.find( std::string( buf, HTTP_DATE_LEN ) );
+        if ( it == published.end() )
+        {
+            ++r->unknown;
+            continue;
+        }
+        if ( it->second < last )
+        {
+            ++r->backwards;
+        }
+        last = it->second;
+    }
+    return NULL;
+}
+
+static void test_concurrent_ticks()
+{
+    char date[ 64 ];
+    for ( int i = 0; i < TICKS; ++i )
+    {
+        format_http_date( FIRST + i * STEP, date, sizeof( date ) );
+        CHECK( strlen( date ) == ( size_t )HTTP_DATE_LEN );
+        published[ std::string( date, HTTP_DATE_LEN ) ] = i;
+    }
+    CHECK_EQ( published.size(), ( size_t )TICKS );
+    /* 先刷新一次，读者开始时已经有缓存的值 */
+    http_date_tick( FIRST );
+
+    pthread_t readers[ READERS ];
+    reader_result results[ READERS ];
+    memset( results, 0, sizeof( results ) );
+    for ( int i = 0; i < READERS; ++i )
+    {
+        pthread_create( &readers[i], NULL, reader, &results[i] );
+    }
+    pthread_t writer;
+    pthread_create( &writer, NULL, ticker, NULL );
+    pthread_join( writer, NULL );
+    long reads = 0;
+    long bad = 0;
+    for ( int i = 0; i < READERS; ++i )
+    {
+        pthread_join( readers[i], NULL );
+        reads += results[i].reads;
+        bad += results[i].malformed + results[i].unknown + results[i].backwards;
+    }
+    CHECK( reads > READERS );
+    CHECK_EQ( bad, 0L );
+
+    /* 刷新结束之后读到的是最后一次写入的 */
+    char buf[ HTTP_DATE_LEN + 1 ] = "";
+    format_http_date( FIRST + ( TICKS - 1 ) * STEP, date, sizeof( date ) );
+    http_date( buf );
+    CHECK( memcmp( buf, date, HTTP_DATE_LEN ) == 0 );
+}
+
+int main()
+{
+    /* 必须在第一次刷新之前 */
+    test_fallback();
+    test_concurrent_ticks();
+    return test_result( "http_date_test" );
+}
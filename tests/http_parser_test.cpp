@@ -0,0 +1,279 @@
+/* 请求解析：请求行、头部的完美哈希、Content-Length 的校验、流式和 chunked 消息体，以及流水线中的多个请求，
+包括超过读缓冲上限的流水线 */
+#include <string.h>
+#include <string>
+
+#include "test_util.h"
+#include "conn_harness.h"
+#include "http_header.h"
+#include "http_scan.h"
+
+
+/* 消息体处理函数记下收到的所有事件 */
+static std::string body_log;
+
+static bool record_body( http_conn* conn, http_conn::BODY_EVENT event, const char* data, int len )
+{
+    ( void )conn;
+    if ( event == http_conn::BODY_DATA )
+    {
+        body_log.append( data, len );
+    }
+    else
+    {
+        body_log += ( event == http_conn::BODY_END ) ? "<end>" : "<abort>";
+    }
+    return true;
+}
+
+static void test_scan_line()
+{
+    /* 行尾和冒号分别落在向量宽度之内、之外以及逐字节扫描的尾部 */
+    for ( int pad = 0; pad < 70; ++pad )
+    {
+        std::string line = std::string( pad, 'x' ) + ":v\r\nnext";
+        const char* colon = NULL;
+        const char* eol = scan_line( line.data(), line.data() + line.size(), &colon );
+        CHECK_EQ( eol - line.data(), pad + 2 );
+        CHECK( colon && ( colon - line.data() == pad ) );
+    }
+    /* 行尾之后的冒号不算 */
+    std::string line = std::string( 40, 'a' ) + "\r\nb:c";
+    const char* colon = NULL;
+    const char* eol = scan_line( line.data(), line.data() + line.size(), &colon );
+    CHECK_EQ( eol - line.data(), 40 );
+    CHECK( colon == NULL );
+    /* 没有行尾时返回 end */
+    colon = NULL;
+    CHECK( scan_line( line.data(), line.data() + 10, &colon ) == line.data() + 10 );
+}
+
+static void test_header_lookup()
+{
+#define CHECK_HEADER( id, name ) CHECK_EQ( header_lookup( name, sizeof( name ) - 1 ), id );
+    HTTP_HEADER_LIST( CHECK_HEADER )
+#undef CHECK_HEADER
+    CHECK_EQ( header_lookup( "CONTENT-LENGTH", 14 ), HDR_CONTENT_LENGTH );
+    CHECK_EQ( header_lookup( "Host", 4 ), HDR_HOST );
+    /* 长度、首尾字符都相同但不是同一个字段名 */
+    CHECK_EQ( header_lookup( "hxxt", 4 ), HDR_UNKNOWN );
+    CHECK_EQ( header_lookup( "x-forwarded-for", 15 ), HDR_UNKNOWN );
+    CHECK_EQ( header_lookup( "", 0 ), HDR_UNKNOWN );
+}
+
+static void test_request_line( const std::string& root )
+{
+    write_test_file( root, "a.bin", "hello" );
+    {
+        test_conn c;
+        std::vector< test_response > r = c.exchange( "GET /a.bin HTTP/1.1\r\nHost: x\r\n\r\n" );
+        CHECK_EQ( r.size(), 1u );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) && ( r[0].body == "hello" ) );
+    }
+    const char* bad[] = {
+        "BREW /a.bin HTTP/1.1\r\n\r\n",     // 不支持的方法
+        "GET /a.bin HTTP/1.0\r\n\r\n",      // 只支持 HTTP/1.1
+        "GET\r\n\r\n",                      // 没有 URL
+    };
+    for ( unsigned i = 0; i < sizeof( bad ) / sizeof( bad[0] ); ++i )
+    {
+        test_conn c;
+        std::vector< test_response > r = c.exchange( bad[i] );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 400 ) );
+        CHECK( c.closed() );
+    }
+    {
+        test_conn c;
+        std::vector< test_response > r = c.exchange( "GET /missing HTTP/1.1\r\n\r\n" );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 404 ) );
+    }
+}
+
+/* 请求分成很多小段到达，每段都要触发一次解析 */
+static void test_split_request( const std::string& root )
+{
+    write_test_file( root, "split.bin", "split body" );
+    test_conn c;
+    std::string request = "GET /split.bin HTTP/1.1\r\nHost: x\r\nUser-Agent: test\r\nConnection: keep-alive\r\n\r\n";
+    for ( size_t i = 0; i < request.size(); i += 3 )
+    {
+        c.send_raw( request.substr( i, 3 ) );
+        c.responses( 0 );
+    }
+    std::vector< test_response > r = c.responses( 1 );
+    CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) && ( r[0].body == "split body" ) );
+    CHECK( !c.closed() );
+}
+
+static void test_content_length()
+{
+    const char* bad[] = { "abc", "-5", "12x", "+5", " ", "99999999999999999999", "0x10" };
+    for ( unsigned i = 0; i < sizeof( bad ) / sizeof( bad[0] ); ++i )
+    {
+        test_conn c;
+        std::string request = std::string( "POST /upload HTTP/1.1\r\nContent-Length: " ) + bad[i] + "\r\n\r\nhello";
+        std::vector< test_response > r = c.exchange( request );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 400 ) );
+        CHECK( c.closed() );
+    }
+}
+
+static void test_bodies()
+{
+    http_conn::m_body_handler = record_body;
+    {
+        /* Content-Length 的消息体之后紧跟着流水线中的下一个请求 */
+        body_log.clear();
+        test_conn c;
+        std::vector< test_response > r = c.exchange(
+            "POST /upload HTTP/1.1\r\nContent-Length: 5\r\nConnection: keep-alive\r\n\r\nhello"
+            "PUT /upload HTTP/1.1\r\nContent-Length: 3\r\nConnection: keep-alive\r\n\r\nabc", 2 );
+        CHECK_EQ( r.size(), 2u );
+        CHECK( ( r.size() == 2 ) && ( r[0].status == 204 ) && ( r[1].status == 204 ) );
+        CHECK_EQ( body_log, std::string( "hello<end>abc<end>" ) );
+    }
+    {
+        /* chunked 消息体：带扩展的 chunk 大小行、trailer，chunk 跨越多次读取 */
+        body_log.clear();
+        test_conn c;
+        c.send_raw( "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n"
+            "5;ext=1\r\nhel" );
+        c.responses( 0 );
+        c.send_raw( "lo\r\nA\r\n0123456789\r\n0\r\nX-Trailer: t\r\n\r\n" );
+        std::vector< test_response > r = c.responses( 1 );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 204 ) );
+        CHECK_EQ( body_log, std::string( "hello0123456789<end>" ) );
+        CHECK( !c.closed() );
+    }
+    {
+        /* chunk 数据之后不是 CRLF */
+        body_log.clear();
+        test_conn c;
+        std::vector< test_response > r = c.exchange(
+            "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n0\r\n\r\n" );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 400 ) );
+        CHECK( c.closed() );
+    }
+    {
+        /* 非法的 chunk 大小 */
+        test_conn c;
+        std::vector< test_response > r = c.exchange(
+            "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\nabc\r\n0\r\n\r\n" );
+        CHECK( ( r.size() == 1 ) && ( r[0].status == 400 ) );
+    }
+    {
+        /* 消息体没有收完连接就断开，处理函数收到 BODY_ABORT */
+        body_log.clear();
+        test_conn* c = new test_conn;
+        c->exchange( "POST /upload HTTP/1.1\r\nContent-Length: 10\r\n\r\nabc", 0 );
+        delete c;
+        CHECK_EQ( body_log, std::string( "abc<abort>" ) );
+    }
+    http_conn::m_body_handler = NULL;
+}
+
+/* 连接在请求之间只重置下标，不清零缓冲：前一个请求留下的更长的内容不能影响后一个请求 */
+static void test_buffer_reuse( const std::string& root )
+{
+    write_test_file( root, "a.bin", "hello" );
+    /* 先把内存池中文件名所用那一级的块都写脏，连接拿到的缓冲不会恰好是全 0 的 */
+    std::vector< char* > dirty;
+    size_t capacity = 0;
+    for ( int i = 0; i < 64; ++i )
+    {
+        dirty.push_back( http_conn::m_buffer_pool->acquire( http_conn::FILENAME_LEN, &capacity ) );
+        memset( dirty.back(), 'z', capacity );
+    }
+    for ( size_t i = 0; i < dirty.size(); ++i )
+    {
+        http_conn::m_buffer_pool->release( dirty[i], capacity );
+    }
+    test_conn c;
+    std::vector< test_response > r = c.exchange( "GET /a.bin HTTP/1.1\r\nX-Pad: " + std::string( 3000, 'p' )
+        + "\r\nConnection: keep-alive\r\n\r\n" );
+    CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) && ( r[0].body == "hello" ) );
+    /* 文件名超出 FILENAME_LEN 时被截断，截断处必须有结尾的 '\0'，否则后面是缓冲中残留的内容。
+    让截断后的文件名恰好存在，就能从应答看出来 */
+    std::string truncated( http_conn::FILENAME_LEN - 1 - root.size() - 1, 'x' );
+    write_test_file( root, truncated.c_str(), "truncated" );
+    r = c.exchange( "GET /" + truncated + std::string( 50, 'x' ) + " HTTP/1.1\r\nConnection: keep-alive\r\n\r\n" );
+    CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) && ( r[0].body == "truncated" ) );
+    r = c.exchange( "GET /a.bin HTTP/1.1\r\nConnection: keep-alive\r\n\r\n" );
+    CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) && ( r[0].body == "hello" ) );
+    CHECK( !c.closed() );
+}
+
+/* 一次发来的多个请求合并成一批应答，按请求的顺序返回 */
+static void test_pipeline( const std::string& root )
+{
+    write_test_file( root, "one.bin", "first" );
+    write_test_file( root, "two.bin", "second!" );
+    test_conn c;
+    std::string request;
+    for ( int i = 0; i < 20; ++i )
+    {
+        request += ( i % 2 ) ? "GET /two.bin HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+            : "GET /one.bin HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    }
+    request += "GET /missing HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    request += "GET /one.bin HTTP/1.1\r\n\r\n";
+    std::vector< test_response > r = c.exchange( request, 22 );
+    CHECK_EQ( r.size(), 22u );
+    for ( size_t i = 0; ( i < 20 ) && ( i < r.size() ); ++i )
+    {
+        CHECK_EQ( r[i].status, 200 );
+        CHECK_EQ( r[i].body, std::string( ( i % 2 ) ? "second!" : "first" ) );
+    }
+    if ( r.size() == 22 )
+    {
+        CHECK_EQ( r[20].status, 404 );
+        CHECK_EQ( r[21].body, std::string( "first" ) );
+    }
+    /* 最后一个请求没有要求保持连接 */
+    CHECK( c.closed() );
+}
+
+/* 流水线发来的请求超过读缓冲的上限时，应答了前面的请求腾出空间之后继续读取，不断开连接。
+一个请求的头部就放满读缓冲时才关闭连接 */
+static void test_pipeline_overflow( const std::string& root )
+{
+    write_test_file( root, "one.bin", "first" );
+    std::string one = "GET /one.bin HTTP/1.1\r\nX-Pad: " + std::string( 200, 'p' ) + "\r\nConnection: keep-alive\r\n\r\n";
+    int count = 2 * http_conn::MAX_READ_BUFFER_SIZE / ( int )one.size();
+    std::string request;
+    for ( int i = 0; i < count; ++i )
+    {
+        request += one;
+    }
+    test_conn c;
+    std::vector< test_response > r = c.exchange( request, count );
+    CHECK_EQ( r.size(), ( size_t )count );
+    bool ok = true;
+    for ( size_t i = 0; i < r.size(); ++i )
+    {
+        ok = ok && ( r[i].status == 200 ) && ( r[i].body == "first" );
+    }
+    CHECK( ok );
+    CHECK( !c.closed() );
+
+    test_conn big;
+    r = big.exchange( "GET /one.bin HTTP/1.1\r\nX-Pad: " + std::string( http_conn::MAX_READ_BUFFER_SIZE, 'p' ) + "\r\n\r\n" );
+    CHECK( r.empty() );
+    CHECK( big.closed() );
+}
+
+int main()
+{
+    std::string root = setup_doc_root();
+    test_scan_line();
+    test_header_lookup();
+    test_request_line( root );
+    test_split_request( root );
+    test_content_length();
+    test_bodies();
+    test_buffer_reuse( root );
+    test_pipeline( root );
+    test_pipeline_overflow( root );
+    remove_doc_root( root );
+    return test_result( "http_parser_test" );
+}
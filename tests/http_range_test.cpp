@@ -0,0 +1,178 @@
+/* 条件请求和 Range：304、If-Range、单区间、多区间（multipart/byteranges）、416，分别在有和没有文件缓存、
+mmap 和 sendfile 两种发送方式下检查 */
+#include <string.h>
+#include <string>
+
+#include "test_util.h"
+#include "conn_harness.h"
+
+
+static test_response get( const std::string& request )
+{
+    test_conn c;
+    std::vector< test_response > r = c.exchange( request );
+    CHECK_EQ( r.size(), 1u );
+    return r.empty() ? test_response() : r[0];
+}
+
+static std::string request( const char* path, const std::string& headers )
+{
+    return std::string( "GET " ) + path + " HTTP/1.1\r\nHost: x\r\n" + headers + "\r\n";
+}
+
+static void test_conditional()
+{
+    test_response full = get( request( "/digits.bin", "" ) );
+    CHECK_EQ( full.status, 200 );
+    CHECK_EQ( full.body, std::string( "0123456789" ) );
+    CHECK( full.header( "etag" ) && full.header( "last-modified" ) );
+    if ( !full.header( "etag" ) || !full.header( "last-modified" ) )
+    {
+        return;
+    }
+    std::string etag = full.header( "etag" );
+    std::string modified = full.header( "last-modified" );
+
+    test_response r = get( request( "/digits.bin", "If-None-Match: " + etag + "\r\n" ) );
+    CHECK_EQ( r.status, 304 );
+    CHECK( r.body.empty() );
+    CHECK( r.header( "etag" ) && ( etag == r.header( "etag" ) ) );
+
+    r = get( request( "/digits.bin", "If-None-Match: \"other\", " + etag + "\r\n" ) );
+    CHECK_EQ( r.status, 304 );
+    r = get( request( "/digits.bin", "If-None-Match: \"other\"\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+
+    r = get( request( "/digits.bin", "If-Modified-Since: " + modified + "\r\n" ) );
+    CHECK_EQ( r.status, 304 );
+    r = get( request( "/digits.bin", "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+    /* If-None-Match 存在时忽略 If-Modified-Since */
+    r = get( request( "/digits.bin", "If-None-Match: \"other\"\r\nIf-Modified-Since: " + modified + "\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+
+    /* If-Range 与当前版本一致时才按 Range 发送 */
+    r = get( request( "/digits.bin", "Range: bytes=2-3\r\nIf-Range: " + etag + "\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK_EQ( r.body, std::string( "23" ) );
+    r = get( request( "/digits.bin", "Range: bytes=2-3\r\nIf-Range: \"stale\"\r\n" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK_EQ( r.body, std::string( "0123456789" ) );
+}
+
+static void test_single_range()
+{
+    struct
+    {
+        const char* range;
+        const char* body;
+        const char* content_range;
+    } cases[] = {
+        { "bytes=0-4", "01234", "bytes 0-4/10" },
+        { "bytes=7-", "789", "bytes 7-9/10" },
+        { "bytes=-3", "789", "bytes 7-9/10" },
+        { "bytes=-30", "0123456789", "bytes 0-9/10" },
+        { "bytes=8-100", "89", "bytes 8-9/10" },
+        { "bytes=20-30, 3-3", "3", "bytes 3-3/10" },
+    };
+    for ( unsigned i = 0; i < sizeof( cases ) / sizeof( cases[0] ); ++i )
+    {
+        test_response r = get( request( "/digits.bin", std::string( "Range: " ) + cases[i].range + "\r\n" ) );
+        CHECK_EQ( r.status, 206 );
+        CHECK_EQ( r.body, std::string( cases[i].body ) );
+        CHECK( r.header( "content-range" ) && ( strcmp( r.header( "content-range" ), cases[i].content_range ) == 0 ) );
+    }
+
+    /* 语法错误的 Range 被忽略 */
+    const char* ignored[] = { "bytes=5-2", "bytes=abc", "items=0-1", "bytes=0-1;x" };
+    for ( unsigned i = 0; i < sizeof( ignored ) / sizeof( ignored[0] ); ++i )
+    {
+        test_response r = get( request( "/digits.bin", std::string( "Range: " ) + ignored[i] + "\r\n" ) );
+        CHECK_EQ( r.status, 200 );
+        CHECK_EQ( r.body, std::string( "0123456789" ) );
+    }
+
+    /* HEAD 请求不处理 Range */
+    test_conn c;
+    std::vector< bool > heads( 1, true );
+    std::vector< test_response > r = c.exchange( "HEAD /digits.bin HTTP/1.1\r\nRange: bytes=0-1\r\n\r\n", 1, heads );
+    CHECK( ( r.size() == 1 ) && ( r[0].status == 200 ) );
+}
+
+static void test_multi_range()
+{
+    test_response r = get( request( "/digits.bin", "Range: bytes=0-1,4-5,-2\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    const char* type = r.header( "content-type" );
+    CHECK( type && ( strncmp( type, "multipart/byteranges; boundary=", 31 ) == 0 ) );
+    if ( !type || ( strlen( type ) <= 31 ) )
+    {
+        return;
+    }
+    std::string boundary = type + 31;
+    std::string expected;
+    const char* parts[][2] = { { "0-1", "01" }, { "4-5", "45" }, { "8-9", "89" } };
+    for ( int i = 0; i < 3; ++i )
+    {
+        expected += "\r\n--" + boundary + "\r\nContent-Range: bytes " + parts[i][0] + "/10\r\n\r\n" + parts[i][1];
+    }
+    expected += "\r\n--" + boundary + "--\r\n";
+    /* Content-Length 必须恰好是消息体的长度，否则会和下一个应答错位 */
+    CHECK_EQ( r.body, expected );
+}
+
+static void test_unsatisfiable()
+{
+    test_conn c;
+    std::vector< test_response > r = c.exchange(
+        request( "/digits.bin", "Range: bytes=10-20\r\nConnection: keep-alive\r\n" )
+        + request( "/digits.bin", "Range: bytes=-0\r\nConnection: keep-alive\r\n" ), 2 );
+    CHECK_EQ( r.size(), 2u );
+    for ( size_t i = 0; i < r.size(); ++i )
+    {
+        CHECK_EQ( r[i].status, 416 );
+        CHECK( r[i].header( "content-range" ) && ( strcmp( r[i].header( "content-range" ), "bytes */10" ) == 0 ) );
+        CHECK( !r[i].body.empty() );
+    }
+    CHECK( !c.closed() );
+}
+
+/* 超过 SENDFILE_THRESHOLD 的文件用 sendfile 发送，单个区间同样只发送这一段 */
+static void test_sendfile_range( const std::string& root )
+{
+    std::string big( http_conn::SENDFILE_THRESHOLD + 4096, '\0' );
+    for ( size_t i = 0; i < big.size(); ++i )
+    {
+        big[i] = ( char )( 'a' + i % 26 );
+    }
+    write_test_file( root, "big.bin", big );
+    test_response r = get( request( "/big.bin", "Range: bytes=1000000-1000099\r\n" ) );
+    CHECK_EQ( r.status, 206 );
+    CHECK_EQ( r.body, big.substr( 1000000, 100 ) );
+    r = get( request( "/big.bin", "" ) );
+    CHECK_EQ( r.status, 200 );
+    CHECK( r.body == big );
+}
+
+static void run_all( const std::string& root )
+{
+    test_conditional();
+    test_single_range();
+    test_multi_range();
+    test_unsatisfiable();
+    test_sendfile_range( root );
+}
+
+int main()
+{
+    std::string root = setup_doc_root();
+    write_test_file( root, "digits.bin", "0123456789" );
+    run_all( root );
+    /* 再打开文件缓存跑一遍：第一次请求放入缓存，之后都是命中 */
+    http_conn::m_file_cache = new file_cache();
+    run_all( root );
+    delete http_conn::m_file_cache;
+    http_conn::m_file_cache = NULL;
+    remove_doc_root( root );
+    return test_result( "http_range_test" );
+}
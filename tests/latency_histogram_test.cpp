@@ -0,0 +1,171 @@
+/* 延迟直方图：小值各占一个桶，其余的值所在桶的上界不小于它、相对误差小于 1/SUB_COUNT，桶随值单调，
+超出量程的都落在最后一个桶；快照的计数、平均值、百分位和相减，以及线程池只对部分任务采样计时 */
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "test_util.h"
+#include "latency_histogram.h"
+#include "15-3_threadpoll.h"
+
+
+typedef latency_histogram hist;
+
+static void test_buckets()
+{
+    bool exact = true;
+    for ( int v = 0; v < hist::SUB_COUNT; ++v )
+    {
+        exact = exact && ( hist::bucket( v ) == v ) && ( hist::bucket_limit( v ) == ( unsigned long long )v );
+    }
+    CHECK( exact );
+
+    /* 每个 2 的幂附近和区间中间的值：v 落在上界不小于它的第一个桶中 */
+    bool bounded = true;
+    bool tight = true;
+    bool monotonic = true;
+    int last = -1;
+    for ( int bit = 4; bit < 36; ++bit )
+    {
+        unsigned long long base = 1ULL << bit;
+        const unsigned long long values[] = { base - 1, base, base + 1, base + base / 3, base + base / 2 + 7, 2 * base - 1 };
+        for ( unsigned i = 0; i < sizeof( values ) / sizeof( values[0] ); ++i )
+        {
+            unsigned long long v = values[i];
+            int b = hist::bucket( v );
+            unsigned long long limit = hist::bucket_limit( b );
+            bounded = bounded && ( limit >= v ) && ( ( limit - v ) * hist::SUB_COUNT < v );
+            tight = tight && ( hist::bucket_limit( b - 1 ) < v );
+            monotonic = monotonic && ( b >= last );
+            last = b;
+        }
+    }
+    CHECK( bounded );
+    CHECK( tight );
+    CHECK( monotonic );
+
+    bool increasing = true;
+    for ( int i = 1; i < hist::BUCKETS - 1; ++i )
+    {
+        increasing = increasing && ( hist::bucket_limit( i ) > hist::bucket_limit( i - 1 ) );
+    }
+    CHECK( increasing );
+
+    /* 量程之外的值都记在最后一个桶中 */
+    CHECK( hist::bucket( hist::bucket_limit( hist::BUCKETS - 2 ) ) == hist::BUCKETS - 2 );
+    CHECK( hist::bucket( hist::bucket_limit( hist::BUCKETS - 2 ) + 1 ) == hist::BUCKETS - 1 );
+    CHECK( hist::bucket( 1ULL << 40 ) == hist::BUCKETS - 1 );
+    CHECK( hist::bucket( ~0ULL ) == hist::BUCKETS - 1 );
+}
+
+static void test_snapshot()
+{
+    latency_snapshot empty;
+    CHECK_EQ( empty.count(), 0u );
+    CHECK_EQ( empty.percentile( 50 ), 0u );
+    CHECK_EQ( empty.mean(), 0u );
+
+    /* 1 到 1000 各记一次 */
+    hist h;
+    for ( unsigned long long v = 1; v <= 1000; ++v )
+    {
+        h.record( v );
+    }
+    latency_snapshot first;
+    first.add( h );
+    CHECK_EQ( first.count(), 1000u );
+    CHECK_EQ( first.mean(), 500u );
+    CHECK_EQ( first.max(), 1000u );
+    CHECK_EQ( first.percentile( 0 ), 1u );
+    CHECK_EQ( first.percentile( 50 ), hist::bucket_limit( hist::bucket( 500 ) ) );
+    CHECK_EQ( first.percentile( 99 ), hist::bucket_limit( hist::bucket( 990 ) ) );
+    CHECK( first.percentile( 100 ) >= 1000u );
+
+    /* 之后的 100 次都是 5000，相减之后只剩这一段 */
+    for ( int i = 0; i < 100; ++i )
+    {
+        h.record( 5000 );
+    }
+    latency_snapshot second;
+    second.add( h );
+    CHECK_EQ( second.count(), 1100u );
+    second.subtract( first );
+    CHECK_EQ( second.count(), 100u );
+    CHECK_EQ( second.mean(), 5000u );
+    CHECK_EQ( second.percentile( 1 ), hist::bucket_limit( hist::bucket( 5000 ) ) );
+    CHECK_EQ( second.max(), 5000u );
+
+    /* 合并两个直方图 */
+    hist other;
+    other.record( 20000 );
+    latency_snapshot merged;
+    merged.add( h );
+    merged.add( other );
+    CHECK_EQ( merged.count(), 1101u );
+    CHECK_EQ( merged.max(), 20000u );
+}
+
+struct noop_task
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+    std::atomic< int >* done;
+
+    void process()
+    {
+        done->fetch_add( 1 );
+    }
+};
+
+/* 同一个线程提交的任务每 SAMPLE_EVERY 个计时一个，任务数本身总是准确的 */
+static void test_pool_sampling()
+{
+    const int TASKS = 100 * threadpoll< noop_task >::SAMPLE_EVERY;
+    std::vector< noop_task > tasks( TASKS );
+    std::atomic< int > done( 0 );
+    for ( int i = 0; i < TASKS; ++i )
+    {
+        tasks[i].m_deadline_ns = 0;
+        tasks[i].m_priority = 0;
+        tasks[i].done = &done;
+    }
+    threadpoll< noop_task > pool( 2, TASKS );
+    for ( int i = 0; i < TASKS; ++i )
+    {
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    while ( done.load() < TASKS )
+    {
+        sched_yield();
+    }
+    /* 运行时间在 process() 返回之后才记下，最后几个任务的可能还没有记完 */
+    threadpoll_snapshot s;
+    unsigned long tasks_seen = 0;
+    for ( int i = 0; i < 1000; ++i )
+    {
+        pool.snapshot( s );
+        tasks_seen = 0;
+        for ( size_t w = 0; w < s.per_worker.size(); ++w )
+        {
+            tasks_seen += s.per_worker[w].tasks;
+        }
+        if ( s.service.count() >= 100u )
+        {
+            break;
+        }
+        usleep( 1000 );
+    }
+    CHECK_EQ( tasks_seen, ( unsigned long )TASKS );
+    CHECK_EQ( s.wait.count(), 100u );
+    CHECK_EQ( s.service.count(), 100u );
+}
+
+int main()
+{
+    test_buckets();
+    test_snapshot();
+    test_pool_sampling();
+    return test_result( "latency_histogram_test" );
+}
@@ -0,0 +1,319 @@
+/* 无锁环形队列：容量取整、先进先出、满和空的判断、多轮回绕、成批放入，多个生产者（逐个或成批放入）和消费者
+并发时每个元素正好取出一次，以及线程池用它作为共享队列时每个任务正好执行一次、成批提交时超出上限的是后面的一部分 */
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+
+#include "test_util.h"
+#include "mpmc_queue.h"
+#include "15-3_threadpoll.h"
+
+
+static const int PRODUCERS = 4;
+static const int CONSUMERS = 4;
+static const int PER_PRODUCER = 50000;
+static const int BULK = 7;
+
+static void test_single_thread()
+{
+    CHECK_EQ( mpmc_queue< int >( 1 ).capacity(), 2u );
+    CHECK_EQ( mpmc_queue< int >( 5 ).capacity(), 8u );
+    CHECK_EQ( mpmc_queue< int >( 8 ).capacity(), 8u );
+
+    int items[ 9 ];
+    mpmc_queue< int > q( 8 );
+    int* out = NULL;
+    CHECK( !q.pop( out ) );
+    for ( int i = 0; i < 8; ++i )
+    {
+        CHECK( q.push( &items[i] ) );
+    }
+    CHECK( !q.push( &items[8] ) );
+    CHECK_EQ( q.size(), 8u );
+    for ( int i = 0; i < 8; ++i )
+    {
+        CHECK( q.pop( out ) && ( out == &items[i] ) );
+    }
+    CHECK( !q.pop( out ) );
+    CHECK_EQ( q.size(), 0u );
+
+    /* 每轮放入 5 个再取出，下标在槽位上回绕很多圈，顺序保持不变 */
+    bool ok = true;
+    for ( int round = 0; round < 1000; ++round )
+    {
+        for ( int i = 0; i < 5; ++i )
+        {
+            ok = ok && q.push( &items[ ( round + i ) % 9 ] );
+        }
+        for ( int i = 0; i < 5; ++i )
+        {
+            ok = ok && q.pop( out ) && ( out == &items[ ( round + i ) % 9 ] );
+        }
+    }
+    CHECK( ok );
+}
+
+static void test_bulk()
+{
+    int items[ 16 ];
+    int* batch[ 16 ];
+    for ( int i = 0; i < 16; ++i )
+    {
+        batch[i] = &items[i];
+    }
+    mpmc_queue< int > q( 8 );
+    int* out = NULL;
+    CHECK_EQ( q.push_bulk( batch, 3 ), 3u );
+    /* 只剩 5 个槽位，放入前 5 个 */
+    CHECK_EQ( q.push_bulk( batch + 3, 10 ), 5u );
+    CHECK_EQ( q.push_bulk( batch + 8, 1 ), 0u );
+    for ( int i = 0; i < 8; ++i )
+    {
+        CHECK( q.pop( out ) && ( out == &items[i] ) );
+    }
+    CHECK( !q.pop( out ) );
+
+    /* 跨过环形队列末尾的一段 */
+    CHECK_EQ( q.push_bulk( batch, 6 ), 6u );
+    for ( int i = 0; i < 6; ++i )
+    {
+        CHECK( q.pop( out ) && ( out == &items[i] ) );
+    }
+    CHECK_EQ( q.push_bulk( batch + 6, 8 ), 8u );
+    for ( int i = 6; i < 14; ++i )
+    {
+        CHECK( q.pop( out ) && ( out == &items[i] ) );
+    }
+}
+
+struct concurrent_arg
+{
+    mpmc_queue< int >* queue;
+    int* items;                      // 所有生产者的元素，p 号生产者放入 items[ p * PER_PRODUCER ] 开始的一段
+    std::atomic< int >* seen;        // 每个元素被取出的次数
+    std::atomic< int >* consumed;    // 所有消费者一共取出的个数
+    int id;
+    bool bulk;                       // 生产者每次放入 BULK 个
+    bool ordered;                    // 消费者看到的同一个生产者的元素是否按放入的顺序
+};
+
+static void* produce( void* arg )
+{
+    concurrent_arg* a = ( concurrent_arg* )arg;
+    int* batch[ BULK ];
+    for ( int i = 0; i < PER_PRODUCER; )
+    {
+        if ( !a->bulk )
+        {
+            if ( a->queue->push( &a->items[ a->id * PER_PRODUCER + i ] ) )
+                ++i;
+            else
+                sched_yield();
+            continue;
+        }
+        int n = ( PER_PRODUCER - i < BULK ) ? PER_PRODUCER - i : BULK;
+        for ( int j = 0; j < n; ++j )
+        {
+            batch[j] = &a->items[ a->id * PER_PRODUCER + i + j ];
+        }
+        size_t pushed = a->queue->push_bulk( batch, n );
+        if ( pushed == 0 )
+            sched_yield();
+        i += ( int )pushed;
+    }
+    return NULL;
+}
+
+static void* consume( void* arg )
+{
+    concurrent_arg* a = ( concurrent_arg* )arg;
+    int last[ PRODUCERS ];
+    for ( int p = 0; p < PRODUCERS; ++p )
+    {
+        last[p] = -1;
+    }
+    a->ordered = true;
+    while ( a->consumed->load() < PRODUCERS * PER_PRODUCER )
+    {
+        int* item = NULL;
+        if ( !a->queue->pop( item ) )
+        {
+            sched_yield();
+            continue;
+        }
+        int index = ( int )( item - a->items );
+        int producer = index / PER_PRODUCER;
+        a->ordered = a->ordered && ( index > last[ producer ] );
+        last[ producer ] = index;
+        a->seen[ index ].fetch_add( 1 );
+        a->consumed->fetch_add( 1 );
+    }
+    return NULL;
+}
+
+static void test_concurrent( bool bulk )
+{
+    mpmc_queue< int > q( 1024 );
+    std::vector< int > items( PRODUCERS * PER_PRODUCER );
+    std::vector< std::atomic< int > > seen( PRODUCERS * PER_PRODUCER );
+    for ( size_t i = 0; i < seen.size(); ++i )
+    {
+        seen[i].store( 0 );
+    }
+    std::atomic< int > consumed( 0 );
+
+    pthread_t threads[ PRODUCERS + CONSUMERS ];
+    concurrent_arg args[ PRODUCERS + CONSUMERS ];
+    for ( int i = 0; i < PRODUCERS + CONSUMERS; ++i )
+    {
+        args[i].queue = &q;
+        args[i].items = &items[0];
+        args[i].seen = &seen[0];
+        args[i].consumed = &consumed;
+        args[i].id = ( i < PRODUCERS ) ? i : i - PRODUCERS;
+        args[i].bulk = bulk;
+        args[i].ordered = true;
+        pthread_create( &threads[i], NULL, ( i < PRODUCERS ) ? produce : consume, &args[i] );
+    }
+    for ( int i = 0; i < PRODUCERS + CONSUMERS; ++i )
+    {
+        pthread_join( threads[i], NULL );
+    }
+
+    bool once = true;
+    for ( size_t i = 0; i < seen.size(); ++i )
+    {
+        once = once && ( seen[i].load() == 1 );
+    }
+    CHECK( once );
+    for ( int i = PRODUCERS; i < PRODUCERS + CONSUMERS; ++i )
+    {
+        CHECK( args[i].ordered );
+    }
+    CHECK_EQ( q.size(), 0u );
+}
+
+/* 线程池的任务：记录自己被执行的次数。hold 不为空时等它变为 true 才结束，用来占住工作线程 */
+struct count_task
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+    std::atomic< int > runs;
+    std::atomic< int >* done;
+    const std::atomic< bool >* hold;
+
+    void process()
+    {
+        runs.fetch_add( 1 );
+        while ( hold && !hold->load() )
+        {
+            sched_yield();
+        }
+        done->fetch_add( 1 );
+    }
+};
+
+static void init_tasks( std::vector< count_task >& tasks, std::atomic< int >* done )
+{
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].m_deadline_ns = 0;
+        tasks[i].m_priority = 0;
+        tasks[i].runs.store( 0 );
+        tasks[i].done = done;
+        tasks[i].hold = NULL;
+    }
+}
+
+static void test_pool()
+{
+    const int TASKS = 20000;
+    std::vector< count_task > tasks( TASKS );
+    std::atomic< int > done( 0 );
+    init_tasks( tasks, &done );
+    {
+        /* 队列比任务少，放不进去时等工作线程消化一些 */
+        threadpoll< count_task > pool( 4, 256 );
+        for ( int i = 0; i < TASKS; ++i )
+        {
+            while ( !pool.append( &tasks[i] ) )
+            {
+                sched_yield();
+            }
+        }
+        while ( done.load() < TASKS )
+        {
+            sched_yield();
+        }
+        CHECK_EQ( pool.depth(), 0 );
+    }
+    bool once = true;
+    for ( int i = 0; i < TASKS; ++i )
+    {
+        once = once && ( tasks[i].runs.load() == 1 );
+    }
+    CHECK( once );
+    CHECK_EQ( done.load(), TASKS );
+}
+
+/* 唯一的工作线程被占住时成批提交：队列上限是 8，前 8 个入队，后面的被拒绝并计数，放开之后只有入队的执行 */
+static void test_pool_batch()
+{
+    std::vector< count_task > tasks( 21 );
+    std::atomic< int > done( 0 );
+    std::atomic< bool > release( false );
+    init_tasks( tasks, &done );
+    tasks[0].hold = &release;
+    count_task* batch[ 20 ];
+    bool accepted[ 20 ];
+    for ( int i = 0; i < 20; ++i )
+    {
+        batch[i] = &tasks[ i + 1 ];
+    }
+    {
+        threadpoll< count_task > pool( 1, 8 );
+        CHECK( pool.append( &tasks[0] ) );
+        while ( tasks[0].runs.load() == 0 )
+        {
+            sched_yield();
+        }
+        CHECK_EQ( pool.append_batch( batch, 20, accepted ), 8u );
+        bool prefix = true;
+        for ( int i = 0; i < 20; ++i )
+        {
+            prefix = prefix && ( accepted[i] == ( i < 8 ) );
+        }
+        CHECK( prefix );
+        CHECK_EQ( pool.depth(), 8 );
+        CHECK_EQ( pool.append_batch( batch, 0, accepted ), 0u );
+
+        release.store( true );
+        while ( done.load() < 9 )
+        {
+            sched_yield();
+        }
+        threadpoll_snapshot s;
+        pool.snapshot( s );
+        CHECK_EQ( s.rejected_full, 12u );
+        CHECK_EQ( s.rejected_closing, 0u );
+    }
+    bool ran = true;
+    for ( int i = 1; i <= 20; ++i )
+    {
+        ran = ran && ( tasks[i].runs.load() == ( i <= 8 ? 1 : 0 ) );
+    }
+    CHECK( ran );
+}
+
+int main()
+{
+    test_single_thread();
+    test_bulk();
+    test_concurrent( false );
+    test_concurrent( true );
+    test_pool();
+    test_pool_batch();
+    return test_result( "mpmc_queue_test" );
+}
@@ -0,0 +1,117 @@
+/* CPU 列表的解析：范围、单个的 CPU、反向的范围、末尾的逗号、空串和非法字符、超出 cpu_set_t 的编号；
+CPU 所在的节点；以及为 reactor 挑选 home 工作线程，包括 reactor 的 CPU 不在工作线程绑定的 CPU 之中的情况 */
+#include <sched.h>
+
+#include "test_util.h"
+#include "placement.h"
+
+
+static bool same( const int* cpus, int count, const int* expected, int expected_count )
+{
+    if ( count != expected_count )
+    {
+        return false;
+    }
+    for ( int i = 0; i < count; ++i )
+    {
+        if ( cpus[i] != expected[i] )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_parse()
+{
+    int cpus[ MAX_CPUS ];
+    const int range[] = { 0, 1, 2, 3, 8 };
+    CHECK( same( cpus, parse_cpu_list( "0-3,8", cpus, MAX_CPUS ), range, 5 ) );
+    const int singles[] = { 5, 2, 7 };
+    CHECK( same( cpus, parse_cpu_list( "5,2,7", cpus, MAX_CPUS ), singles, 3 ) );
+    const int one[] = { 4 };
+    CHECK( same( cpus, parse_cpu_list( "4", cpus, MAX_CPUS ), one, 1 ) );
+    CHECK( same( cpus, parse_cpu_list( "4-4", cpus, MAX_CPUS ), one, 1 ) );
+    /* 末尾的逗号被忽略 */
+    const int trailing[] = { 1, 2 };
+    CHECK( same( cpus, parse_cpu_list( "1-2,", cpus, MAX_CPUS ), trailing, 2 ) );
+
+    /* 反向的范围、空串、非法字符都是格式错误 */
+    CHECK_EQ( parse_cpu_list( "3-1", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( ",", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "1,,2", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "abc", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "1x", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "1-", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "-1", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "1 2", cpus, MAX_CPUS ), -1 );
+
+    /* 编号必须能放进 cpu_set_t */
+    CHECK( MAX_CPUS <= CPU_SETSIZE );
+    const int last[] = { MAX_CPUS - 1 };
+    CHECK( same( cpus, parse_cpu_list( "1023", cpus, MAX_CPUS ), last, 1 ) );
+    CHECK_EQ( parse_cpu_list( "1024", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "0-1024", cpus, MAX_CPUS ), -1 );
+    CHECK_EQ( parse_cpu_list( "99999999999999999999", cpus, MAX_CPUS ), -1 );
+    CHECK( !pin_current_thread( CPU_SETSIZE ) );
+    CHECK( !pin_current_thread( -1 ) );
+
+    /* 超出 max 个时是错误，而不是截断 */
+    CHECK_EQ( parse_cpu_list( "0-3", cpus, 4 ), 4 );
+    CHECK_EQ( parse_cpu_list( "0-4", cpus, 4 ), -1 );
+}
+
+static void test_cpu_node()
+{
+    /* 不存在的 CPU 没有 NUMA 信息 */
+    CHECK_EQ( cpu_node( MAX_CPUS + 7 ), 0 );
+    int node = cpu_node( sched_getcpu() );
+    CHECK( ( node >= 0 ) && ( node < MAX_NODES ) );
+}
+
+/* 测试用的拓扑：每 4 个 CPU 一个节点 */
+static int fake_node( int cpu )
+{
+    return cpu / 4;
+}
+
+static void test_home_worker()
+{
+    /* 6 个工作线程依次绑定在 1、5、2、6、1、5 上 */
+    const int workers[] = { 1, 5, 2, 6 };
+
+    /* 同一个核上的优先，即使前面已经有同一个节点上的 */
+    CHECK_EQ( home_worker( 2, workers, 4, 6, fake_node ), 2 );
+    CHECK_EQ( home_worker( 6, workers, 4, 6, fake_node ), 3 );
+    /* 不在工作线程的 CPU 之中：选同一个节点上的第一个 */
+    CHECK_EQ( home_worker( 3, workers, 4, 6, fake_node ), 0 );
+    CHECK_EQ( home_worker( 7, workers, 4, 6, fake_node ), 1 );
+    /* 节点上也没有工作线程 */
+    CHECK_EQ( home_worker( 9, workers, 4, 6, fake_node ), -1 );
+    /* 只有前两个工作线程时 CPU 2 不在其中，退而选同一个节点上的 */
+    CHECK_EQ( home_worker( 2, workers, 4, 2, fake_node ), 0 );
+    /* 线程比 CPU 多时循环使用 CPU 列表 */
+    const int single[] = { 9 };
+    CHECK_EQ( home_worker( 9, single, 1, 3, fake_node ), 0 );
+    CHECK_EQ( home_worker( 10, single, 1, 3, fake_node ), 0 );
+
+    /* reactor 或者工作线程没有绑定 */
+    CHECK_EQ( home_worker( -1, workers, 4, 6, fake_node ), -1 );
+    CHECK_EQ( home_worker( 2, workers, 0, 6, fake_node ), -1 );
+    CHECK_EQ( home_worker( 2, NULL, 0, 6, fake_node ), -1 );
+    CHECK_EQ( home_worker( 2, workers, 4, 0, fake_node ), -1 );
+
+    /* 真实的拓扑：本机上的 CPU 总能找到同一个节点上的工作线程 */
+    int cpu = sched_getcpu();
+    const int here[] = { cpu };
+    CHECK_EQ( home_worker( cpu, here, 1, 1, cpu_node ), 0 );
+}
+
+int main()
+{
+    test_parse();
+    test_cpu_node();
+    test_home_worker();
+    return test_result( "placement_test" );
+}
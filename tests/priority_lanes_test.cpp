@@ -0,0 +1,225 @@
+/* 优先级通道：任务按优先级进入通道，忙的时候各通道按 8:4:1 的权重分享工作线程，优先的通道为空时依次看其他通道，
+总容量和成批放入的限制；以及线程池对超过期限的任务不执行 process()，交给过期处理函数并计数 */
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "test_util.h"
+#include "scheduler.h"
+#include "15-3_threadpoll.h"
+
+
+struct lane_item
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+};
+
+static std::vector< lane_item > make_items( int count, int priority )
+{
+    std::vector< lane_item > items( count );
+    for ( int i = 0; i < count; ++i )
+    {
+        items[i].m_enqueue_ns = 0;
+        items[i].m_deadline_ns = 0;
+        items[i].m_priority = priority;
+    }
+    return items;
+}
+
+static void test_weights()
+{
+    const int PER_LANE = 40;
+    std::vector< lane_item > lanes[ 3 ];
+    priority_lanes< lane_item > s( 1, 128 );
+    for ( int l = 0; l < 3; ++l )
+    {
+        lanes[l] = make_items( PER_LANE, l );
+        for ( int i = 0; i < PER_LANE; ++i )
+        {
+            CHECK( s.push( &lanes[l][i], -1, 0 ) >= 0 );
+        }
+    }
+    CHECK_EQ( s.size(), 120u );
+
+    /* 三个通道都有任务时每 13 个里 8 个来自 0 号、4 个来自 1 号、1 个来自 2 号，同一个通道内先进先出 */
+    int taken[ 3 ] = { 0, 0, 0 };
+    bool fifo = true;
+    lane_item* out = NULL;
+    for ( int i = 0; i < 26; ++i )
+    {
+        CHECK( s.pop( 0, out ) );
+        int l = out->m_priority;
+        fifo = fifo && ( out == &lanes[l][ taken[l] ] );
+        ++taken[l];
+    }
+    CHECK_EQ( taken[0], 16 );
+    CHECK_EQ( taken[1], 8 );
+    CHECK_EQ( taken[2], 2 );
+    CHECK( fifo );
+
+    while ( s.pop( 0, out ) )
+    {
+        int l = out->m_priority;
+        fifo = fifo && ( out == &lanes[l][ taken[l] ] );
+        ++taken[l];
+    }
+    CHECK( fifo );
+    CHECK( ( taken[0] == PER_LANE ) && ( taken[1] == PER_LANE ) && ( taken[2] == PER_LANE ) );
+
+    /* 轮到的通道为空时按优先级看其他通道：0 号通道没有任务，它的 8 份归 1 号通道 */
+    priority_lanes< lane_item > t( 1, 128 );
+    for ( int l = 1; l < 3; ++l )
+    {
+        for ( int i = 0; i < PER_LANE; ++i )
+        {
+            CHECK( t.push( &lanes[l][i], -1, 0 ) >= 0 );
+        }
+    }
+    taken[1] = taken[2] = 0;
+    for ( int i = 0; i < 13; ++i )
+    {
+        CHECK( t.pop( 0, out ) );
+        ++taken[ out->m_priority ];
+    }
+    CHECK_EQ( taken[1], 12 );
+    CHECK_EQ( taken[2], 1 );
+}
+
+static void test_limits()
+{
+    /* 超出范围的优先级归入第一个或最后一个通道 */
+    std::vector< lane_item > odd = make_items( 2, -5 );
+    odd[1].m_priority = 9;
+    std::vector< lane_item > middle = make_items( 1, 1 );
+    priority_lanes< lane_item > s( 2, 4 );
+    CHECK_EQ( s.push( &odd[1], -1, 1 ), 1 );
+    CHECK_EQ( s.push( &middle[0], 0, 1 ), 0 );
+    CHECK_EQ( s.push( &odd[0], -1, -1 ), 0 );
+    lane_item* out = NULL;
+    CHECK( s.pop( 1, out ) && ( out == &odd[0] ) );
+    CHECK( s.pop( 1, out ) && ( out == &middle[0] ) );
+    CHECK( s.pop( 1, out ) && ( out == &odd[1] ) );
+    CHECK( !s.pop( 1, out ) );
+
+    /* 总容量是 4：一批 6 个只放入前 4 个，再放单个的也被拒绝 */
+    std::vector< lane_item > batch_items = make_items( 6, 2 );
+    batch_items[1].m_priority = 0;
+    batch_items[2].m_priority = 0;
+    lane_item* batch[ 6 ];
+    for ( int i = 0; i < 6; ++i )
+    {
+        batch[i] = &batch_items[i];
+    }
+    int target = -1;
+    CHECK_EQ( s.push_batch( batch, 6, -1, 1, &target ), 4u );
+    CHECK_EQ( target, 1 );
+    CHECK_EQ( s.push( &middle[0], -1, 0 ), -1 );
+    CHECK_EQ( s.size(), 4u );
+    CHECK( s.pop( 0, out ) && ( out == &batch_items[1] ) );
+    CHECK( s.pop( 0, out ) && ( out == &batch_items[2] ) );
+    CHECK( s.pop( 0, out ) && ( out == &batch_items[0] ) );
+    CHECK( s.pop( 0, out ) && ( out == &batch_items[3] ) );
+    CHECK_EQ( s.size(), 0u );
+}
+
+/* 线程池的任务：hold 不为空时等它变为 true 才结束，用来占住工作线程 */
+struct deadline_task
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+    std::atomic< int > runs;
+    std::atomic< int > expired;
+    const std::atomic< bool >* hold;
+
+    void process()
+    {
+        while ( hold && !hold->load() )
+        {
+            sched_yield();
+        }
+        runs.fetch_add( 1 );
+    }
+};
+
+typedef threadpoll< deadline_task, priority_lanes< deadline_task > > lane_pool;
+
+static void on_expired( deadline_task* task )
+{
+    task->expired.fetch_add( 1 );
+}
+
+/* 唯一的工作线程被占住时，一部分任务的期限已经过去：放开之后它们交给过期处理函数，其余的照常执行 */
+static void test_deadlines()
+{
+    std::vector< deadline_task > tasks( 13 );
+    std::atomic< bool > release( false );
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        tasks[i].m_deadline_ns = 0;
+        tasks[i].m_priority = ( int )i % 3;
+        tasks[i].runs.store( 0 );
+        tasks[i].expired.store( 0 );
+        tasks[i].hold = NULL;
+    }
+    tasks[0].hold = &release;
+    lane_pool pool( 1, 64 );
+    pool.set_expired_handler( on_expired );
+    CHECK( pool.append( &tasks[0] ) );
+    while ( pool.depth() > 0 )
+    {
+        sched_yield();
+    }
+
+    /* 单数号的任务 1 毫秒后过期，双数号的没有期限或者期限还很远 */
+    long long now = lane_pool::now_ns();
+    for ( size_t i = 1; i < tasks.size(); ++i )
+    {
+        tasks[i].m_deadline_ns = ( i % 2 ) ? now + 1000000 : ( ( i % 4 ) ? 0 : now + 60000000000LL );
+        CHECK( pool.append( &tasks[i] ) );
+    }
+    usleep( 20000 );
+    release.store( true );
+
+    threadpoll_snapshot s;
+    int finished = 0;
+    for ( int i = 0; ( i < 1000 ) && ( finished < 13 ); ++i )
+    {
+        finished = 0;
+        for ( size_t j = 0; j < tasks.size(); ++j )
+        {
+            finished += tasks[j].runs.load() + tasks[j].expired.load();
+        }
+        if ( finished < 13 )
+        {
+            usleep( 1000 );
+        }
+    }
+    CHECK_EQ( finished, 13 );
+    bool ok = true;
+    for ( size_t i = 0; i < tasks.size(); ++i )
+    {
+        bool late = ( i % 2 ) == 1;
+        ok = ok && ( tasks[i].runs.load() == ( late ? 0 : 1 ) ) && ( tasks[i].expired.load() == ( late ? 1 : 0 ) );
+    }
+    CHECK( ok );
+    pool.snapshot( s );
+    CHECK_EQ( s.expired, 6u );
+    CHECK_EQ( s.per_worker.size(), 1u );
+    if ( s.per_worker.size() == 1 )
+    {
+        CHECK_EQ( s.per_worker[0].expired, 6u );
+        CHECK_EQ( s.per_worker[0].tasks, 13u );
+    }
+}
+
+int main()
+{
+    test_weights();
+    test_limits();
+    test_deadlines();
+    return test_result( "priority_lanes_test" );
+}
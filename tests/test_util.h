@@ -0,0 +1,40 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdio.h>
+
+/* 测试程序共用的检查宏：失败时打印位置和表达式并继续执行，main 最后用 test_result() 作为退出码 */
+static int test_failures = 0;
+
+#define CHECK( cond ) \
+    do \
+    { \
+        if ( !( cond ) ) \
+        { \
+            fprintf( stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond ); \
+            ++test_failures; \
+        } \
+    } while ( 0 )
+
+#define CHECK_EQ( a, b ) \
+    do \
+    { \
+        if ( !( ( a ) == ( b ) ) ) \
+        { \
+            fprintf( stderr, "%s:%d: CHECK failed: %s == %s\n", __FILE__, __LINE__, #a, #b ); \
+            ++test_failures; \
+        } \
+    } while ( 0 )
+
+static inline int test_result( const char* name )
+{
+    if ( test_failures )
+    {
+        fprintf( stderr, "%s: %d check(s) failed\n", name, test_failures );
+        return 1;
+    }
+    printf( "%s: ok\n", name );
+    return 0;
+}
+
+#endif
@@ -0,0 +1,281 @@
+/* 工作窃取：Chase-Lev 双端队列所有者后进先出、窃取者先进先出，所有者和多个窃取者并发时每个元素正好取出一次；
+work_stealing 只把外部任务放进正在运行的线程的收件箱，空闲线程能从收件箱和双端队列中窃取；
+线程池在工作线程中提交的后续任务也都正好执行一次 */
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+
+#include "test_util.h"
+#include "chase_lev_deque.h"
+#include "scheduler.h"
+#include "15-3_threadpoll.h"
+
+
+static const int THIEVES = 3;
+static const int ITEMS = 200000;
+
+static void test_deque_single_thread()
+{
+    int items[ 9 ];
+    chase_lev_deque< int > d( 8 );
+    bool lost = false;
+    CHECK( d.take() == NULL );
+    CHECK( ( d.steal( &lost ) == NULL ) && !lost );
+    for ( int i = 0; i < 8; ++i )
+    {
+        CHECK( d.push( &items[i] ) );
+    }
+    CHECK( !d.push( &items[8] ) );
+    CHECK_EQ( d.size(), 8u );
+
+    /* 所有者从底部取最近放入的，窃取者从顶部取最早放入的 */
+    CHECK( d.take() == &items[7] );
+    CHECK( d.steal( &lost ) == &items[0] );
+    CHECK( d.take() == &items[6] );
+    CHECK( d.steal( &lost ) == &items[1] );
+    CHECK_EQ( d.size(), 4u );
+    for ( int i = 5; i >= 2; --i )
+    {
+        CHECK( d.take() == &items[i] );
+    }
+    CHECK( d.take() == NULL );
+    CHECK( d.steal( &lost ) == NULL );
+    CHECK( !lost );
+
+    /* 下标不断增长，在缓冲区上回绕很多圈 */
+    bool ok = true;
+    for ( int round = 0; round < 1000; ++round )
+    {
+        ok = ok && d.push( &items[0] ) && d.push( &items[1] ) && d.push( &items[2] );
+        ok = ok && ( d.steal( &lost ) == &items[0] ) && ( d.take() == &items[2] ) && ( d.take() == &items[1] );
+    }
+    CHECK( ok );
+}
+
+struct deque_arg
+{
+    chase_lev_deque< int >* deque;
+    int* items;
+    std::atomic< int >* seen;
+    std::atomic< int >* taken;  // 所有线程一共取出的个数
+};
+
+/* 所有者放入全部元素，每放几个自己也取一个，队列满时先自己取 */
+static void* own( void* arg )
+{
+    deque_arg* a = ( deque_arg* )arg;
+    for ( int i = 0; i < ITEMS; ++i )
+    {
+        while ( !a->deque->push( &a->items[i] ) )
+        {
+            int* item = a->deque->take();
+            if ( item )
+            {
+                a->seen[ item - a->items ].fetch_add( 1 );
+                a->taken->fetch_add( 1 );
+            }
+        }
+        if ( i % 3 == 0 )
+        {
+            int* item = a->deque->take();
+            if ( item )
+            {
+                a->seen[ item - a->items ].fetch_add( 1 );
+                a->taken->fetch_add( 1 );
+            }
+        }
+    }
+    while ( a->taken->load() < ITEMS )
+    {
+        int* item = a->deque->take();
+        if ( item )
+        {
+            a->seen[ item - a->items ].fetch_add( 1 );
+            a->taken->fetch_add( 1 );
+        }
+    }
+    return NULL;
+}
+
+static void* steal( void* arg )
+{
+    deque_arg* a = ( deque_arg* )arg;
+    while ( a->taken->load() < ITEMS )
+    {
+        bool lost = false;
+        int* item = a->deque->steal( &lost );
+        if ( item )
+        {
+            a->seen[ item - a->items ].fetch_add( 1 );
+            a->taken->fetch_add( 1 );
+        }
+        else if ( !lost )
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void test_deque_concurrent()
+{
+    chase_lev_deque< int > d( 64 );
+    std::vector< int > items( ITEMS );
+    std::vector< std::atomic< int > > seen( ITEMS );
+    for ( int i = 0; i < ITEMS; ++i )
+    {
+        seen[i].store( 0 );
+    }
+    std::atomic< int > taken( 0 );
+    deque_arg arg = { &d, &items[0], &seen[0], &taken };
+
+    pthread_t threads[ THIEVES + 1 ];
+    pthread_create( &threads[0], NULL, own, &arg );
+    for ( int i = 1; i <= THIEVES; ++i )
+    {
+        pthread_create( &threads[i], NULL, steal, &arg );
+    }
+    for ( int i = 0; i <= THIEVES; ++i )
+    {
+        pthread_join( threads[i], NULL );
+    }
+    bool once = true;
+    for ( int i = 0; i < ITEMS; ++i )
+    {
+        once = once && ( seen[i].load() == 1 );
+    }
+    CHECK( once );
+    CHECK_EQ( taken.load(), ITEMS );
+}
+
+/* 单线程地按各种身份调用 work_stealing，检查任务落在哪里、从哪里取出 */
+static void test_scheduler()
+{
+    int items[ 64 ];
+    int* out = NULL;
+    work_stealing< int > s( 3, 96 );
+
+    /* 没有线程在运行时外部任务无处可放 */
+    CHECK_EQ( s.push( &items[0], -1, 1 ), -1 );
+    s.set_running( 0, true );
+    s.set_running( 1, true );
+
+    /* 外部任务放进 home 线程的收件箱，home 没有在运行时换一个正在运行的线程 */
+    CHECK_EQ( s.push( &items[0], -1, 1 ), 1 );
+    int target = s.push( &items[1], -1, 2 );
+    CHECK( ( target == 0 ) || ( target == 1 ) );
+    CHECK_EQ( s.size(), 2u );
+
+    /* 0 号线程先取自己收件箱中的任务，再从 1 号的收件箱中窃取 */
+    int* first = ( target == 0 ) ? &items[1] : &items[0];
+    int* second = ( target == 0 ) ? &items[0] : &items[1];
+    CHECK( s.pop( 0, out ) && ( out == first ) );
+    CHECK( s.pop( 0, out ) && ( out == second ) );
+    CHECK( !s.pop( 0, out ) );
+
+    /* 工作线程自己提交的任务进自己的双端队列，后进先出；其他线程从顶部窃取最早的 */
+    for ( int i = 0; i < 4; ++i )
+    {
+        CHECK_EQ( s.push( &items[ 10 + i ], 0, -1 ), 0 );
+    }
+    CHECK( s.pop( 0, out ) && ( out == &items[13] ) );
+    CHECK( s.pop( 1, out ) && ( out == &items[10] ) );
+    CHECK( s.pop( 2, out ) && ( out == &items[11] ) );
+    CHECK( s.pop( 0, out ) && ( out == &items[12] ) );
+    CHECK_EQ( s.size(), 0u );
+
+    /* 一批任务先填满 home 线程的收件箱（容量 32），剩下的放进另一个正在运行的线程，不会落在 2 号上 */
+    int* batch[ 40 ];
+    for ( int i = 0; i < 40; ++i )
+    {
+        batch[i] = &items[ i % 64 ];
+    }
+    CHECK_EQ( s.push_batch( batch, 40, -1, 1, &target ), 40u );
+    CHECK_EQ( target, 1 );
+    int count = 0;
+    while ( s.pop( 0, out ) )
+    {
+        ++count;
+    }
+    CHECK_EQ( count, 40 );
+
+    /* 收件箱都满了时只放进一部分 */
+    int* many[ 80 ];
+    for ( int i = 0; i < 80; ++i )
+    {
+        many[i] = &items[ i % 64 ];
+    }
+    CHECK_EQ( s.push_batch( many, 80, -1, 0, &target ), 64u );
+}
+
+/* 线程池的任务：根任务在工作线程中再提交一个后续任务 */
+struct chain_task
+{
+    long long m_enqueue_ns;
+    long long m_deadline_ns;
+    int m_priority;
+    std::atomic< int > runs;
+    chain_task* next;
+    std::atomic< int >* done;
+    threadpoll< chain_task, work_stealing< chain_task > >* pool;
+
+    void process()
+    {
+        runs.fetch_add( 1 );
+        if ( next )
+        {
+            while ( !pool->append( next ) )
+            {
+                sched_yield();
+            }
+        }
+        done->fetch_add( 1 );
+    }
+};
+
+static void test_pool()
+{
+    const int ROOTS = 5000;
+    std::vector< chain_task > tasks( 2 * ROOTS );
+    std::atomic< int > done( 0 );
+    {
+        threadpoll< chain_task, work_stealing< chain_task > > pool( 4, 1024 );
+        for ( int i = 0; i < 2 * ROOTS; ++i )
+        {
+            tasks[i].m_deadline_ns = 0;
+            tasks[i].m_priority = 0;
+            tasks[i].runs.store( 0 );
+            tasks[i].next = ( i < ROOTS ) ? &tasks[ ROOTS + i ] : NULL;
+            tasks[i].done = &done;
+            tasks[i].pool = &pool;
+        }
+        for ( int i = 0; i < ROOTS; ++i )
+        {
+            while ( !pool.append( &tasks[i] ) )
+            {
+                sched_yield();
+            }
+        }
+        while ( done.load() < 2 * ROOTS )
+        {
+            sched_yield();
+        }
+        CHECK_EQ( pool.depth(), 0 );
+    }
+    bool once = true;
+    for ( int i = 0; i < 2 * ROOTS; ++i )
+    {
+        once = once && ( tasks[i].runs.load() == 1 );
+    }
+    CHECK( once );
+}
+
+int main()
+{
+    test_deque_single_thread();
+    test_deque_concurrent();
+    test_scheduler();
+    test_pool();
+    return test_result( "work_stealing_test" );
+}
@@ -0,0 +1,165 @@
+/* 比较 threadpoll 的调度策略：所有线程共享一个环形队列（shared_queue）、每个线程一个双端队列加窃取（work_stealing）
+与按优先级分通道加权出队（priority_lanes，任务轮流落在三个通道上）。
+若干生产者线程模拟 reactor 不停地提交小任务（-b 大于 1 时用 append_batch 成批提交），每个任务做一小段计算，输出 8、16、64 个工作线程时每个任务的平均开销和吞吐量。
+编译运行：g++ -O2 -std=c++11 -pthread -o threadpoll_bench threadpoll_bench.cpp placement.cpp && ./threadpoll_bench -n 1000000 -p 2 -w 200 -b 1 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "15-3_threadpoll.h"
+
+/* 每个任务独占一条缓存行（数组按 64 字节对齐分配），避免不同工作线程写相邻任务时伪共享 */
+struct alignas( 64 ) bench_task
+{
+    unsigned seed;
+    int work;
+    unsigned result;
+    std::atomic< int > done;
+    long long m_enqueue_ns;  // 线程池记录入队时刻
+    long long m_deadline_ns;  // 没有期限
+    int m_priority;  // priority_lanes 的通道
+
+    void process()
+    {
+        unsigned x = seed;
+        for ( int i = 0; i < work; ++i )
+        {
+            x = x * 1103515245u + 12345u;
+        }
+        result = x;
+        done.store( 1, std::memory_order_release );
+    }
+};
+
+template< typename S >
+struct producer_arg
+{
+    threadpoll< bench_task, S >* pool;
+    bench_task* tasks;
+    long begin;
+    long end;
+    int batch;
+    pthread_t thread;
+};
+
+template< typename S >
+static void* produce( void* arg )
+{
+    producer_arg< S >* p = ( producer_arg< S >* )arg;
+    bench_task* batch[ 256 ];
+    for ( long i = p->begin; i < p->end; )
+    {
+        size_t n = 0;
+        if ( p->batch <= 1 )
+        {
+            n = p->pool->append( &p->tasks[i] ) ? 1 : 0;
+        }
+        else
+        {
+            size_t want = ( p->end - i < p->batch ) ? ( size_t )( p->end - i ) : ( size_t )p->batch;
+            for ( size_t j = 0; j < want; ++j )
+                batch[j] = &p->tasks[ i + j ];
+            n = p->pool->append_batch( batch, want );
+        }
+        if ( n > 0 )
+            i += n;
+        else
+            sched_yield();  // 队列满了，让工作线程先消化
+    }
+    return NULL;
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template< typename S >
+static void run( const char* name, int threads, int producers, int batch, long n, int work, bench_task* tasks )
+{
+    for ( long i = 0; i < n; ++i )
+    {
+        tasks[i].seed = ( unsigned )i;
+        tasks[i].work = work;
+        tasks[i].done.store( 0, std::memory_order_relaxed );
+        tasks[i].m_deadline_ns = 0;
+        tasks[i].m_priority = ( int )( i % 3 );
+    }
+    threadpoll< bench_task, S >* pool = new threadpoll< bench_task, S >( threads, 4096 );
+    producer_arg< S >* args = new producer_arg< S >[ producers ];
+
+    double begin = now_sec();
+    for ( int i = 0; i < producers; ++i )
+    {
+        args[i].pool = pool;
+        args[i].tasks = tasks;
+        args[i].begin = n * i / producers;
+        args[i].end = n * ( i + 1 ) / producers;
+        args[i].batch = batch;
+        pthread_create( &args[i].thread, NULL, produce< S >, &args[i] );
+    }
+    for ( int i = 0; i < producers; ++i )
+    {
+        pthread_join( args[i].thread, NULL );
+    }
+    for ( long i = 0; i < n; ++i )
+    {
+        while ( !tasks[i].done.load( std::memory_order_acquire ) )
+            sched_yield();
+    }
+    double elapsed = now_sec() - begin;
+
+    fprintf( stderr, "%-14s %3d threads: %8.1f ns/task %12.0f tasks/s\n", name, threads, elapsed * 1e9 / n, n / elapsed );
+    /* 唤醒并回收所有工作线程，下一轮测试不会和空闲的旧线程混在一起 */
+    delete pool;
+    delete []args;
+}
+
+int main( int argc, char* argv[] )
+{
+    long n = 1000000;
+    int producers = 2;
+    int work = 200;
+    int batch = 1;
+    int opt = 0;
+    while ( ( opt = getopt( argc, argv, "n:p:w:b:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'n': n = atol( optarg ); break;
+            case 'p': producers = atoi( optarg ); break;
+            case 'w': work = atoi( optarg ); break;
+            case 'b': batch = atoi( optarg ); break;
+            default:
+                fprintf( stderr, "usage: %s [-n tasks] [-p producers] [-w work_per_task] [-b batch]\n", argv[0] );
+                return 1;
+        }
+    }
+    if ( ( n <= 0 ) || ( producers <= 0 ) || ( work < 0 ) || ( batch <= 0 ) || ( batch > 256 ) )
+    {
+        return 1;
+    }
+
+    /* C++11 的 new 不保证超过 16 字节的对齐 */
+    void* memory = NULL;
+    if ( posix_memalign( &memory, 64, n * sizeof( bench_task ) ) != 0 )
+    {
+        return 1;
+    }
+    bench_task* tasks = ( bench_task* )memory;
+    const int thread_counts[] = { 8, 16, 64 };
+    for ( unsigned i = 0; i < sizeof( thread_counts ) / sizeof( thread_counts[0] ); ++i )
+    {
+        run< shared_queue< bench_task > >( "shared_queue", thread_counts[i], producers, batch, n, work, tasks );
+        run< work_stealing< bench_task > >( "work_stealing", thread_counts[i], producers, batch, n, work, tasks );
+        run< priority_lanes< bench_task > >( "priority_lanes", thread_counts[i], producers, batch, n, work, tasks );
+    }
+    free( memory );
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "variant_cache.h"
+#include <stdlib.h>
+#include <zlib.h>
+#include "http_response.h"
+
+
+variant_cache::variant_cache( size_t max_bytes, size_t max_file_size, int level ):
+    m_max_file_size( max_file_size ), m_level( level ), m_entries( max_bytes )
+{
+}
+
+std::string variant_cache::make_key( const char* path, CONTENT_ENCODING encoding )
+{
+    std::string key( path );
+    key += '\0';
+    key += ( char )( '0' + encoding );
+    return key;
+}
+
+/* 用 zlib 一次性压缩整个文件。gzip 和 deflate（zlib 格式）只是 windowBits 不同 */
+bool variant_cache::compress( CONTENT_ENCODING encoding, const char* content, size_t len, char** out, size_t* out_len )
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    int window_bits = ( encoding == ENCODING_GZIP ) ? 15 + 16 : 15;
+    if ( deflateInit2( &zs, m_level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        return false;
+    }
+    size_t bound = deflateBound( &zs, len );
+    char* buf = ( char* )malloc( bound );
+    if ( !buf )
+    {
+        deflateEnd( &zs );
+        return false;
+    }
+    zs.next_in = ( Bytef* )content;
+    zs.avail_in = len;
+    zs.next_out = ( Bytef* )buf;
+    zs.avail_out = bound;
+    int ret = deflate( &zs, Z_FINISH );
+    size_t compressed = zs.total_out;
+    deflateEnd( &zs );
+    if ( ret != Z_STREAM_END )
+    {
+        free( buf );
+        return false;
+    }
+
+    /* 压缩后没有变小就不值得用，记一个空结果 */
+    if ( compressed >= len )
+    {
+        free( buf );
+        *out = NULL;
+        *out_len = 0;
+        return true;
+    }
+    char* shrunk = ( char* )realloc( buf, compressed );
+    *out = shrunk ? shrunk : buf;
+    *out_len = compressed;
+    return true;
+}
+
+void variant_cache_policy::destroy( variant_entry* entry )
+{
+    free( entry->data );
+    delete entry;
+}
+
+bool variant_cache::same_file::operator()( variant_entry* entry )
+{
+    return ( st.st_ino == entry->st.st_ino ) && ( st.st_dev == entry->st.st_dev )
+        && ( st.st_size == entry->st.st_size ) && ( st.st_mtim.tv_sec == entry->st.st_mtim.tv_sec )
+        && ( st.st_mtim.tv_nsec == entry->st.st_mtim.tv_nsec );
+}
+
+variant_entry* variant_cache::lookup( const char* path, CONTENT_ENCODING encoding, const struct stat& st )
+{
+    same_file check = { st };
+    return m_entries.lookup( make_key( path, encoding ), check );
+}
+
+variant_entry* variant_cache::insert( const char* path, CONTENT_ENCODING encoding, const struct stat& st, const char* content )
+{
+    if ( ( st.st_size <= 0 ) || ( ( size_t )st.st_size > m_max_file_size ) )
+    {
+        return NULL;
+    }
+
+    /* 压缩在锁外进行，多个线程同时压缩同一个文件时以最后插入的为准 */
+    char* data = NULL;
+    size_t size = 0;
+    if ( !compress( encoding, content, st.st_size, &data, &size ) )
+    {
+        return NULL;
+    }
+
+    variant_entry* entry = new variant_entry;
+    entry->key = make_key( path, encoding );
+    entry->data = data;
+    entry->size = size;
+    entry->st = st;
+    if ( data )
+    {
+        struct stat variant_st = st;
+        variant_st.st_size = size;
+        char header[ 512 ];
+        int header_len = render_file_header( header, sizeof( header ), variant_st, encoding, true );
+        if ( header_len > 0 )
+        {
+            entry->header.assign( header, header_len );
+        }
+    }
+    return m_entries.insert( entry );
+}
+
+void variant_cache::release( variant_entry* entry )
+{
+    m_entries.release( entry );
+}
@@ -0,0 +1,73 @@
+#ifndef VARIANT_CACHE_H
+#define VARIANT_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "lru_cache.h"
+
+
+/* 应答体的内容编码 */
+enum CONTENT_ENCODING
+{
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE
+};
+
+/* 一个文件压缩后的版本。data 为空表示压缩后并没有变小，记下这个结果以免每次请求都重新压缩 */
+struct variant_entry
+{
+    std::string key;           // 文件的完整路径加上编码
+    char* data;                // 压缩后的内容，由 malloc 分配
+    size_t size;               // 压缩后的长度
+    struct stat st;            // 压缩时原文件的状态，原文件的 inode/size/mtime 变化后该版本失效
+    std::string header;        // 预先渲染好的 200 应答头部，Date 字段留空
+    int refcount;              // 正在发送该版本的连接数，外加缓存自身持有的一个引用
+    bool linked;               // 是否仍在哈希表和 LRU 链表中
+    variant_entry* prev;       // LRU 链表，表头是最近使用的
+    variant_entry* next;
+};
+
+/* lru_cache 的策略：缓存项自身的开销也计入字节预算，这样“压缩后没有变小”的空项也会被淘汰 */
+struct variant_cache_policy
+{
+    static const std::string& key( const variant_entry* entry ) { return entry->key; }
+    static size_t bytes( const variant_entry* entry ) { return entry->size + sizeof( variant_entry ) + entry->key.size(); }
+    static void destroy( variant_entry* entry );
+};
+
+
+/* 进程内共享的压缩版本缓存。每个文件的每种编码只压缩一次，以路径和编码为键、以原文件的 inode/size/mtime 校验，
+按压缩后的字节数做 LRU 淘汰 */
+class variant_cache
+{
+public:
+    variant_cache( size_t max_bytes = 16 * 1024 * 1024, size_t max_file_size = 1024 * 1024, int level = 6 );
+
+    /* 查找文件 path（当前状态为 st）的 encoding 版本，命中则增加引用计数后返回，否则返回 NULL */
+    variant_entry* lookup( const char* path, CONTENT_ENCODING encoding, const struct stat& st );
+    /* 压缩 content（长度为 st.st_size）并放入缓存，返回带引用的缓存项；文件过大或者压缩失败时返回 NULL */
+    variant_entry* insert( const char* path, CONTENT_ENCODING encoding, const struct stat& st, const char* content );
+    /* 释放 lookup/insert 得到的引用，最后一个引用释放时才释放内存 */
+    void release( variant_entry* entry );
+
+private:
+    static std::string make_key( const char* path, CONTENT_ENCODING encoding );
+    bool compress( CONTENT_ENCODING encoding, const char* content, size_t len, char** out, size_t* out_len );
+
+    /* lookup 在锁内对命中的项调用的校验：原文件的 inode/size/mtime 变化后压缩版本作废 */
+    struct same_file
+    {
+        const struct stat& st;
+        bool operator()( variant_entry* entry );
+    };
+
+private:
+    size_t m_max_file_size;    // 超过该大小的原文件不做实时压缩
+    int m_level;               // zlib 压缩级别
+    lru_cache< variant_entry, variant_cache_policy > m_entries;  // 按压缩后的字节数做 LRU 淘汰
+};
+
+#endif